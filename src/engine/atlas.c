@@ -2,18 +2,94 @@
 #include "atlas.h"
 
 #include "image.h"
+#include "vector.h"
+
+#define MAX_PAGE_SIZE    2048
+#define MIN_PAGE_SIZE    64
+#define MAX_SHARED_IMAGE 256
+#define MAX_SPARE_PAGES  1
+#define SHARED_PAGE_SIZE 1024
 
 struct atlas
 {
 	unsigned int  id;
-	image_t*      image;
-	rect_t        size;
-	int           pitch;
+	bool          is_locked;
 	int           max_width, max_height;
+	int           num_images;
+	int           num_placed;
+	int           num_reserved;
+	vector_t*     pages;
+	atlas_t*      pool;
+	double        reserved_area;
+	struct slot*  slots;
+};
+
+struct page
+{
+	int           height;
+	image_t*      image;
 	image_lock_t* lock;
+	vector_t*     skyline;
+	vector_t*     slices;  // pool pages only
+	int           width;
+};
+
+struct skyline
+{
+	int x, y;
+	int width;
+};
+
+struct slice
+{
+	image_t* image;
+	rect_t   xy;
 };
 
+struct slot
+{
+	int    height;
+	bool   is_placed;
+	bool   is_reserved;
+	int    page;
+	int    width;
+	rect_t xy;
+};
+
+static struct page* add_page          (atlas_t* atlas, int min_width, int min_height);
+static struct page* allot_rect        (atlas_t* atlas, int width, int height, int* out_page_index, int* out_x, int* out_y);
+static void         claim_slice       (struct page* page, rect_t xy, image_t* image);
+static int          compare_slots     (const void* in_a, const void* in_b);
+static void         drop_slice        (struct page* page, rect_t xy);
+static bool         find_spot         (const struct page* page, int width, int height, int* out_x, int* out_y, int* out_index);
+static void         free_page         (struct page* page);
+static struct page* pack_image        (atlas_t* atlas, int index, int width, int height);
+static void         pack_reservations (atlas_t* atlas);
+static struct page* place_image       (atlas_t* atlas, int index, int width, int height);
+static void         place_rect        (struct page* page, int index, int x, int y, int width, int height);
+static void         rebuild_skyline   (struct page* page);
+static void         recycle_pages     (atlas_t* atlas);
+
 static unsigned int s_next_atlas_id = 0;
+static int          s_num_shared = 0;
+static atlas_t*     s_shared_pool = NULL;
+
+void
+initialize_atlases(void)
+{
+	console_log(1, "initializing shared texture atlas");
+	s_shared_pool = atlas_new(0, SHARED_PAGE_SIZE, SHARED_PAGE_SIZE);
+}
+
+void
+shutdown_atlases(void)
+{
+	console_log(1, "shutting down shared texture atlas");
+	if (s_shared_pool != NULL)
+		console_log(2, "    pages used: %i", atlas_num_pages(s_shared_pool));
+	atlas_free(s_shared_pool);
+	s_shared_pool = NULL;
+}
 
 atlas_t*
 atlas_new(int num_images, int max_width, int max_height)
@@ -22,100 +98,642 @@ atlas_new(int num_images, int max_width, int max_height)
 
 	console_log(4, "creating atlas #%u at %ix%i per image", s_next_atlas_id,
 		max_width, max_height);
-	
+
 	atlas = calloc(1, sizeof(atlas_t));
-	atlas->pitch = ceil(sqrt(num_images));
 	atlas->max_width = max_width;
 	atlas->max_height = max_height;
-	atlas->size = new_rect(0, 0, atlas->pitch * atlas->max_width, atlas->pitch * atlas->max_height);
-	if (!(atlas->image = image_new(atlas->size.x2, atlas->size.y2)))
+	atlas->num_images = num_images;
+	if (num_images > 0 && !(atlas->slots = calloc(num_images, sizeof(struct slot))))
 		goto on_error;
-	
+	if (!(atlas->pages = vector_new(sizeof(struct page))))
+		goto on_error;
+
 	atlas->id = s_next_atlas_id++;
 	return atlas;
 
 on_error:
 	console_log(4, "failed to create atlas #%u", s_next_atlas_id++);
-	if (atlas != NULL) {
-		image_free(atlas->image);
-		free(atlas);
-	}
+	atlas_free(atlas);
+	return NULL;
+}
+
+atlas_t*
+atlas_new_shared(int num_images, int max_width, int max_height)
+{
+	// a shared atlas packs its images onto the pages of the engine-wide pool, so
+	// that sprites from different spritesets can be drawn without switching
+	// textures.  images too large for the pool get a private atlas instead.
+
+	atlas_t* atlas;
+
+	if (s_shared_pool == NULL || max_width > MAX_SHARED_IMAGE || max_height > MAX_SHARED_IMAGE)
+		return atlas_new(num_images, max_width, max_height);
+
+	console_log(4, "creating atlas #%u in shared pool", s_next_atlas_id);
+	recycle_pages(s_shared_pool);
+	atlas = calloc(1, sizeof(atlas_t));
+	atlas->max_width = max_width;
+	atlas->max_height = max_height;
+	atlas->num_images = num_images;
+	atlas->pages = s_shared_pool->pages;
+	atlas->pool = s_shared_pool;
+	if (num_images > 0 && !(atlas->slots = calloc(num_images, sizeof(struct slot))))
+		goto on_error;
+	++s_num_shared;
+	atlas->id = s_next_atlas_id++;
+	return atlas;
+
+on_error:
+	console_log(4, "failed to create atlas #%u", s_next_atlas_id++);
+	free(atlas);
 	return NULL;
 }
 
 void
 atlas_free(atlas_t* atlas)
 {
+	struct slot* slot;
+
+	iter_t iter;
+	int    i;
+
+	if (atlas == NULL)
+		return;
+
 	console_log(4, "disposing atlas #%u no longer in use", atlas->id);
-	
-	if (atlas->lock != NULL)
-		image_unlock(atlas->image, atlas->lock);
-	image_free(atlas->image);
+	if (atlas->pool != NULL) {
+		// the pages belong to the pool, so only the bookkeeping is ours to free.
+		// space set aside for images that were never loaded is given back.
+		for (i = 0; i < atlas->num_images; ++i) {
+			slot = &atlas->slots[i];
+			if (slot->is_placed)
+				drop_slice(vector_get(atlas->pages, slot->page), slot->xy);
+		}
+		--s_num_shared;
+		free(atlas->slots);
+		free(atlas);
+		return;
+	}
+	if (atlas->pages != NULL) {
+		iter = vector_enum(atlas->pages);
+		while (vector_next(&iter))
+			free_page(iter.ptr);
+		vector_free(atlas->pages);
+	}
+	free(atlas->slots);
 	free(atlas);
 }
 
 image_t*
-atlas_image(const atlas_t* atlas)
+atlas_image(const atlas_t* atlas, int image_index)
 {
-	return atlas->image;
+	struct page* page;
+
+	if (!atlas->slots[image_index].is_placed)
+		return NULL;
+	page = vector_get(atlas->pages, atlas->slots[image_index].page);
+	return page->image;
 }
 
-float_rect_t
-atlas_uv(const atlas_t* atlas, int image_index)
+int
+atlas_num_pages(const atlas_t* atlas)
 {
-	float        atlas_height;
-	float        atlas_width;
-	float_rect_t uv;
-	
-	atlas_width = image_width(atlas->image);
-	atlas_height = image_height(atlas->image);
-	uv.x1 = (image_index % atlas->pitch) * atlas->max_width;
-	uv.y1 = (image_index / atlas->pitch) * atlas->max_height;
-	uv.x2 = uv.x1 + atlas->max_width;
-	uv.y2 = uv.y1 + atlas->max_height;
-	return uv;
+	return (int)vector_len(atlas->pages);
 }
 
 rect_t
 atlas_xy(const atlas_t* atlas, int image_index)
 {
-	float  atlas_height;
-	float  atlas_width;
-	rect_t xy;
+	return atlas->slots[image_index].xy;
+}
+
+bool
+atlas_reserve(atlas_t* atlas, int index, int width, int height)
+{
+	// callers which know the sizes of all images up front should reserve space for
+	// them before loading anything.  reserved images are packed all at once,
+	// tallest first, which wastes far less space than packing them in file order.
 
-	atlas_width = image_width(atlas->image);
-	atlas_height = image_height(atlas->image);
-	xy.x1 = (image_index % atlas->pitch) * atlas->max_width;
-	xy.y1 = (image_index / atlas->pitch) * atlas->max_height;
-	xy.x2 = xy.x1 + atlas->max_width;
-	xy.y2 = xy.y1 + atlas->max_height;
-	return xy;
+	struct slot* slot;
+
+	if (index < 0 || index >= atlas->num_images)
+		return false;
+	slot = &atlas->slots[index];
+	if (slot->is_placed || slot->is_reserved)
+		return false;
+	slot->is_reserved = true;
+	slot->width = width;
+	slot->height = height;
+	atlas->reserved_area += (double)width * height;
+	++atlas->num_reserved;
+	return true;
 }
 
 void
 atlas_lock(atlas_t* atlas)
 {
+	// pages of the shared pool are only locked once an image is packed onto them;
+	// locking every page in the pool for each spriteset load would be wasteful.
+
+	struct page* page;
+
+	iter_t iter;
+
 	console_log(4, "locking atlas #%u for direct access", atlas->id);
-	atlas->lock = image_lock(atlas->image);
+	atlas->is_locked = true;
+	if (atlas->pool != NULL)
+		return;
+	iter = vector_enum(atlas->pages);
+	while (page = vector_next(&iter)) {
+		if (page->lock == NULL)
+			page->lock = image_lock(page->image);
+	}
 }
 
 void
 atlas_unlock(atlas_t* atlas)
 {
+	struct page* page;
+
+	iter_t iter;
+
 	console_log(4, "unlocking atlas #%u", atlas->id);
-	image_unlock(atlas->image, atlas->lock);
-	atlas->lock = NULL;
+	iter = vector_enum(atlas->pages);
+	while (page = vector_next(&iter)) {
+		if (page->lock != NULL)
+			image_unlock(page->image, page->lock);
+		page->lock = NULL;
+	}
+	atlas->is_locked = false;
+}
+
+image_t*
+atlas_add(atlas_t* atlas, int index, int width, int height)
+{
+	image_t*     image;
+	struct page* page;
+	rect_t       xy;
+
+	if (!(page = pack_image(atlas, index, width, height)))
+		return NULL;
+	xy = atlas->slots[index].xy;
+	if (!(image = image_new_slice(page->image, xy.x1, xy.y1, width, height)))
+		return NULL;
+	claim_slice(page, xy, image);
+	return image;
+}
+
+image_t*
+atlas_share(image_t* image)
+{
+	// moves a small standalone image onto a page of the shared pool.  ownership of
+	// the image passes to the pool; the caller gets back either a subimage of
+	// the pool page or, if the image can't be shared, the original image.
+
+	int          height;
+	struct page* page;
+	int          page_index;
+	image_t*     slice;
+	int          width;
+	int          x, y;
+
+	if (image == NULL || s_shared_pool == NULL || g_screen == NULL)
+		return image;
+	width = image_width(image);
+	height = image_height(image);
+	if (width > MAX_SHARED_IMAGE || height > MAX_SHARED_IMAGE)
+		return image;
+	recycle_pages(s_shared_pool);
+	if (!(page = allot_rect(s_shared_pool, width, height, &page_index, &x, &y)))
+		return image;
+	if (!(slice = image_new_slice(page->image, x, y, width, height))) {
+		drop_slice(page, new_rect(x, y, x + width, y + height));
+		return image;
+	}
+	claim_slice(page, new_rect(x, y, x + width, y + height), slice);
+	image_blit(image, page->image, x, y);
+	image_free(image);
+	return slice;
 }
 
 image_t*
 atlas_load(atlas_t* atlas, sfs_file_t* file, int index, int width, int height)
 {
-	int off_x, off_y;
-	
-	if (width > atlas->max_width || height > atlas->max_height)
+	image_t*     image;
+	struct page* page;
+	rect_t       xy;
+
+	if (!(page = pack_image(atlas, index, width, height)))
+		return NULL;
+	xy = atlas->slots[index].xy;
+	if (!(image = image_read_slice(file, page->image, xy.x1, xy.y1, width, height)))
+		return NULL;
+	claim_slice(page, xy, image);
+	return image;
+}
+
+static struct page*
+add_page(atlas_t* atlas, int min_width, int min_height)
+{
+	// size the page to hold all remaining images if possible.  unless space was
+	// reserved, this assumes every image is as big as the largest one.  either way
+	// it's only an estimate; any images that don't fit will spill onto a new page.
+
+	double         area;
+	struct page    page;
+	int            num_left;
+	struct page*   p_page;
+	struct skyline segment;
+
+	if (atlas->pool != NULL)
+		return add_page(atlas->pool, min_width, min_height);
+	if (atlas->num_reserved > 0)
+		area = atlas->reserved_area * 1.1;
+	else {
+		num_left = fmax(atlas->num_images - atlas->num_placed, 1);
+		area = (double)num_left * atlas->max_width * atlas->max_height;
+	}
+	memset(&page, 0, sizeof(struct page));
+	page.width = MIN_PAGE_SIZE;
+	while (page.width < MAX_PAGE_SIZE && (double)page.width * page.width < area)
+		page.width *= 2;
+	page.height = MIN_PAGE_SIZE;
+	while (page.height < page.width && (double)page.width * page.height < area)
+		page.height *= 2;
+	while (page.width < min_width || page.width < atlas->max_width)
+		page.width *= 2;
+	while (page.height < min_height || page.height < atlas->max_height)
+		page.height *= 2;
+
+	console_log(4, "adding %ix%i page to atlas #%u", page.width, page.height, atlas->id);
+	if (!(page.image = image_new(page.width, page.height)))
+		goto on_error;
+	if (!(page.skyline = vector_new(sizeof(struct skyline))))
+		goto on_error;
+	if (atlas == s_shared_pool && !(page.slices = vector_new(sizeof(struct slice))))
+		goto on_error;
+	segment.x = 0; segment.y = 0;
+	segment.width = page.width;
+	vector_push(page.skyline, &segment);
+	if (atlas->is_locked)
+		page.lock = image_lock(page.image);
+	if (!vector_push(atlas->pages, &page))
+		goto on_error;
+	p_page = vector_get(atlas->pages, vector_len(atlas->pages) - 1);
+	return p_page;
+
+on_error:
+	free_page(&page);
+	return NULL;
+}
+
+static struct page*
+allot_rect(atlas_t* atlas, int width, int height, int* out_page_index, int* out_x, int* out_y)
+{
+	// images are packed using a skyline: each page tracks the height of its used
+	// area as a list of horizontal segments, and each new image is placed on the
+	// segment giving the lowest top edge.  when no page has room, a new page is
+	// added, sized for the images which are still to come.
+
+	struct page* page = NULL;
+	int          page_index;
+	int          seg_index;
+	struct slice slice;
+	int          x, y;
+
+	for (page_index = 0; page_index < (int)vector_len(atlas->pages); ++page_index) {
+		page = vector_get(atlas->pages, page_index);
+		if (find_spot(page, width, height, &x, &y, &seg_index))
+			break;
+		page = NULL;
+	}
+	if (page == NULL) {
+		if (!(page = add_page(atlas, width, height)))
+			return NULL;
+		page_index = (int)vector_len(atlas->pages) - 1;
+		if (!find_spot(page, width, height, &x, &y, &seg_index))
+			return NULL;
+	}
+	if (page->slices != NULL) {
+		// the space is spoken for from here on, even before an image is made from it
+		slice.image = NULL;
+		slice.xy = new_rect(x, y, x + width, y + height);
+		if (!vector_push(page->slices, &slice))
+			return NULL;
+	}
+	place_rect(page, seg_index, x, y, width, height);
+	*out_page_index = page_index;
+	*out_x = x;
+	*out_y = y;
+	return page;
+}
+
+static void
+claim_slice(struct page* page, rect_t xy, image_t* image)
+{
+	// the pool keeps its own reference to each image it hands out; once that's the
+	// only one left, nobody else is using the space and it can be reclaimed.
+
+	struct slice  new_slice;
+	struct slice* slice;
+
+	iter_t iter;
+
+	if (page->slices == NULL)
+		return;
+	iter = vector_enum(page->slices);
+	while (slice = vector_next(&iter)) {
+		if (slice->image == NULL && memcmp(&slice->xy, &xy, sizeof(rect_t)) == 0) {
+			slice->image = image_ref(image);
+			return;
+		}
+	}
+	new_slice.image = image_ref(image);
+	new_slice.xy = xy;
+	if (!vector_push(page->slices, &new_slice))
+		image_free(image);
+}
+
+static int
+compare_slots(const void* in_a, const void* in_b)
+{
+	const struct slot* a = *(const struct slot**)in_a;
+	const struct slot* b = *(const struct slot**)in_b;
+
+	return a->height != b->height ? b->height - a->height
+		: b->width - a->width;
+}
+
+static void
+drop_slice(struct page* page, rect_t xy)
+{
+	struct slice* slice;
+
+	iter_t iter;
+
+	if (page->slices == NULL)
+		return;
+	iter = vector_enum(page->slices);
+	while (slice = vector_next(&iter)) {
+		if (slice->image == NULL && memcmp(&slice->xy, &xy, sizeof(rect_t)) == 0) {
+			iter_remove(&iter);
+			return;
+		}
+	}
+}
+
+static bool
+find_spot(const struct page* page, int width, int height, int* out_x, int* out_y, int* out_index)
+{
+	int                   best_index = -1;
+	int                   best_width;
+	int                   best_y;
+	int                   num_segments;
+	const struct skyline* segment;
+	int                   width_left;
+	int                   y;
+
+	int i, j;
+
+	num_segments = (int)vector_len(page->skyline);
+	for (i = 0; i < num_segments; ++i) {
+		segment = vector_get(page->skyline, i);
+		if (segment->x + width > page->width)
+			break;
+
+		// the image rests on the highest segment it spans
+		y = 0;
+		width_left = width;
+		for (j = i; width_left > 0; ++j) {
+			segment = vector_get(page->skyline, j);
+			y = fmax(y, segment->y);
+			width_left -= segment->width;
+		}
+		if (y + height > page->height)
+			continue;
+		segment = vector_get(page->skyline, i);
+		if (best_index < 0 || y < best_y || (y == best_y && segment->width < best_width)) {
+			best_index = i;
+			best_width = segment->width;
+			best_y = y;
+			*out_x = segment->x;
+		}
+	}
+	if (best_index < 0)
+		return false;
+	*out_y = best_y;
+	*out_index = best_index;
+	return true;
+}
+
+static void
+free_page(struct page* page)
+{
+	struct slice* slice;
+
+	iter_t iter;
+
+	if (page->slices != NULL) {
+		iter = vector_enum(page->slices);
+		while (slice = vector_next(&iter))
+			image_free(slice->image);
+		vector_free(page->slices);
+	}
+	if (page->lock != NULL)
+		image_unlock(page->image, page->lock);
+	image_free(page->image);
+	vector_free(page->skyline);
+}
+
+static struct page*
+pack_image(atlas_t* atlas, int index, int width, int height)
+{
+	struct page* page;
+	struct slot* slot;
+
+	if (index < 0 || index >= atlas->num_images)
+		return NULL;
+	if (atlas->num_reserved > 0)
+		pack_reservations(atlas);
+	slot = &atlas->slots[index];
+	if (slot->is_placed) {
+		if (width != slot->width || height != slot->height)
+			return NULL;
+		page = vector_get(atlas->pages, slot->page);
+	}
+	else if (!(page = place_image(atlas, index, width, height)))
 		return NULL;
-	if (index >= atlas->pitch * atlas->pitch) return NULL;
-	off_x = index % atlas->pitch * atlas->max_width;
-	off_y = index / atlas->pitch * atlas->max_height;
-	return image_read_slice(file, atlas->image, off_x, off_y, width, height);
+	if (atlas->is_locked && page->lock == NULL)
+		page->lock = image_lock(page->image);
+	return page;
+}
+
+static void
+pack_reservations(atlas_t* atlas)
+{
+	const struct slot** order;
+	int                 num_pending = 0;
+	struct slot*        slot;
+
+	int i;
+
+	if (!(order = malloc(atlas->num_reserved * sizeof(struct slot*))))
+		return;
+	for (i = 0; i < atlas->num_images; ++i) {
+		slot = &atlas->slots[i];
+		if (slot->is_reserved && !slot->is_placed)
+			order[num_pending++] = slot;
+	}
+	qsort(order, num_pending, sizeof(struct slot*), compare_slots);
+	for (i = 0; i < num_pending; ++i) {
+		slot = (struct slot*)order[i];
+		if (place_image(atlas, (int)(slot - atlas->slots), slot->width, slot->height))
+			continue;
+
+		// if a reservation can't be honored, forget it; the image will be packed
+		// normally when it's actually loaded.
+		atlas->reserved_area -= (double)slot->width * slot->height;
+		--atlas->num_reserved;
+		slot->is_reserved = false;
+	}
+	free(order);
+}
+
+static struct page*
+place_image(atlas_t* atlas, int index, int width, int height)
+{
+	struct page* page;
+	int          page_index;
+	struct slot* slot;
+	int          x, y;
+
+	slot = &atlas->slots[index];
+	if (!(page = allot_rect(atlas, width, height, &page_index, &x, &y)))
+		return NULL;
+	if (slot->is_reserved) {
+		atlas->reserved_area -= (double)width * height;
+		--atlas->num_reserved;
+	}
+	slot->is_placed = true;
+	slot->page = page_index;
+	slot->width = width;
+	slot->height = height;
+	slot->xy = new_rect(x, y, x + width, y + height);
+	++atlas->num_placed;
+	return page;
+}
+
+static void
+place_rect(struct page* page, int index, int x, int y, int width, int height)
+{
+	struct skyline  new_segment;
+	struct skyline* next;
+	struct skyline* prev;
+	int             shrink;
+
+	int i;
+
+	new_segment.x = x;
+	new_segment.y = y + height;
+	new_segment.width = width;
+	vector_insert(page->skyline, index, &new_segment);
+
+	// trim or remove the segments now covered by the new one
+	for (i = index + 1; i < (int)vector_len(page->skyline); ++i) {
+		prev = vector_get(page->skyline, i - 1);
+		next = vector_get(page->skyline, i);
+		if (next->x >= prev->x + prev->width)
+			break;
+		shrink = prev->x + prev->width - next->x;
+		next->x += shrink;
+		next->width -= shrink;
+		if (next->width > 0)
+			break;
+		vector_remove(page->skyline, i--);
+	}
+
+	// merge neighboring segments at the same height
+	for (i = 0; i < (int)vector_len(page->skyline) - 1; ++i) {
+		prev = vector_get(page->skyline, i);
+		next = vector_get(page->skyline, i + 1);
+		if (prev->y == next->y) {
+			prev->width += next->width;
+			vector_remove(page->skyline, i + 1);
+			--i;
+		}
+	}
+}
+
+static void
+rebuild_skyline(struct page* page)
+{
+	// the skyline can't describe holes, so the best that can be done is to lower
+	// each column to the bottom edge of the lowest slice still in it.
+
+	int*           heights;
+	struct skyline segment;
+	struct slice*  slice;
+
+	iter_t iter;
+	int    x;
+
+	if (!(heights = calloc(page->width, sizeof(int))))
+		return;
+	iter = vector_enum(page->slices);
+	while (slice = vector_next(&iter)) {
+		for (x = slice->xy.x1; x < slice->xy.x2; ++x)
+			heights[x] = fmax(heights[x], slice->xy.y2);
+	}
+	vector_clear(page->skyline);
+	segment.x = 0; segment.y = heights[0];
+	segment.width = 0;
+	for (x = 0; x < page->width; ++x) {
+		if (heights[x] != segment.y) {
+			vector_push(page->skyline, &segment);
+			segment.x = x; segment.y = heights[x];
+			segment.width = 0;
+		}
+		++segment.width;
+	}
+	vector_push(page->skyline, &segment);
+	free(heights);
+}
+
+static void
+recycle_pages(atlas_t* atlas)
+{
+	// slices no longer referenced by anyone but the pool are released, and any
+	// page which lost some has its skyline rebuilt so the space can be reused.
+	// pages left empty are destroyed, save for a few spares, but only while no
+	// shared atlas is being filled since those refer to pages by index.
+
+	bool          is_dirty;
+	int           num_empty = 0;
+	struct page*  page;
+	struct slice* slice;
+
+	iter_t iter;
+	iter_t slice_iter;
+
+	iter = vector_enum(atlas->pages);
+	while (page = vector_next(&iter)) {
+		is_dirty = false;
+		slice_iter = vector_enum(page->slices);
+		while (slice = vector_next(&slice_iter)) {
+			if (slice->image == NULL || image_refcount(slice->image) > 1)
+				continue;
+			image_free(slice->image);
+			iter_remove(&slice_iter);
+			is_dirty = true;
+		}
+		if (vector_len(page->slices) == 0 && s_num_shared == 0 && ++num_empty > MAX_SPARE_PAGES) {
+			console_log(4, "freeing %ix%i page of atlas #%u", page->width, page->height, atlas->id);
+			free_page(page);
+			iter_remove(&iter);
+		}
+		else if (is_dirty) {
+			console_log(4, "repacking %ix%i page of atlas #%u", page->width, page->height, atlas->id);
+			rebuild_skyline(page);
+		}
+	}
 }
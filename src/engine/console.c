@@ -1,7 +1,9 @@
 #include "minisphere.h"
 #include "console.h"
 
-static int s_verbosity = 1;
+static vector_t*      s_deferred_lines = NULL;
+static ALLEGRO_MUTEX* s_deferred_mutex = NULL;
+static int            s_verbosity = 1;
 
 void
 initialize_console(int verbosity)
@@ -15,15 +17,63 @@ get_log_verbosity(void)
 	return s_verbosity;
 }
 
+bool
+console_defer(bool is_deferred)
+{
+	// while output is deferred, log lines are queued instead of printed, so that
+	// another thread can log without its lines getting mixed up with ours.  the
+	// queue is printed in order once deferral is switched back off.
+	// note: this must only be called from the main thread, and never while any
+	//       other thread might still be logging.
+
+	iter_t      iter;
+	lstring_t** p_line;
+
+	if (is_deferred) {
+		if (s_deferred_lines != NULL)
+			return true;
+		if (!(s_deferred_mutex = al_create_mutex()))
+			return false;
+		if (!(s_deferred_lines = vector_new(sizeof(lstring_t*)))) {
+			al_destroy_mutex(s_deferred_mutex);
+			s_deferred_mutex = NULL;
+			return false;
+		}
+	}
+	else if (s_deferred_lines != NULL) {
+		iter = vector_enum(s_deferred_lines);
+		while (p_line = vector_next(&iter)) {
+			printf("%s\n", lstr_cstr(*p_line));
+			lstr_free(*p_line);
+		}
+		vector_free(s_deferred_lines);
+		al_destroy_mutex(s_deferred_mutex);
+		s_deferred_lines = NULL;
+		s_deferred_mutex = NULL;
+	}
+	return true;
+}
+
 void
 console_log(int level, const char* fmt, ...)
 {
-	va_list ap;
+	va_list    ap;
+	lstring_t* line;
 
 	if (level > s_verbosity)
 		return;
 	va_start(ap, fmt);
-	vprintf(fmt, ap);
-	fputc('\n', stdout);
+	if (s_deferred_lines != NULL) {
+		if (line = lstr_vnewf(fmt, ap)) {
+			al_lock_mutex(s_deferred_mutex);
+			if (!vector_push(s_deferred_lines, &line))
+				lstr_free(line);
+			al_unlock_mutex(s_deferred_mutex);
+		}
+	}
+	else {
+		vprintf(fmt, ap);
+		fputc('\n', stdout);
+	}
 	va_end(ap);
 }
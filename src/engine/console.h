@@ -3,6 +3,7 @@
 
 void initialize_console (int verbosity);
 int  get_log_verbosity  (void);
+bool console_defer      (bool is_deferred);
 void console_log        (int level, const char* fmt, ...);
 
 #endif // MINISPHERE__CONSOLE_H__INCLUDED
@@ -1,6 +1,7 @@
 #include "minisphere.h"
 #include "font.h"
 
+#include "atlas.h"
 #include "color.h"
 #include "image.h"
 #include "unicode.h"
@@ -53,9 +54,7 @@ static unsigned int s_next_font_id = 0;
 font_t*
 font_load(const char* filename)
 {
-	image_t*                atlas = NULL;
-	int                     atlas_x, atlas_y;
-	int                     atlas_size_x, atlas_size_y;
+	atlas_t*                atlas = NULL;
 	sfs_file_t*             file;
 	font_t*                 font = NULL;
 	struct font_glyph*      glyph;
@@ -65,11 +64,11 @@ font_load(const char* filename)
 	image_lock_t*           lock = NULL;
 	int                     max_x = 0, max_y = 0;
 	int                     min_width = INT_MAX;
-	int64_t                 n_glyphs_per_row;
 	int                     pixel_size;
 	struct rfn_header       rfn;
 	uint8_t                 *psrc;
 	color_t                 *pdest;
+	rect_t                  xy;
 
 	int i, x, y;
 
@@ -105,46 +104,48 @@ font_load(const char* filename)
 	font->height = max_y;
 
 	// create glyph atlas
-	n_glyphs_per_row = ceil(sqrt(rfn.num_chars));
-	atlas_size_x = max_x * n_glyphs_per_row;
-	atlas_size_y = max_y * n_glyphs_per_row;
-	if ((atlas = image_new(atlas_size_x, atlas_size_y)) == NULL)
+	if (!(atlas = atlas_new(rfn.num_chars, max_x, max_y)))
 		goto on_error;
+	for (i = 0; i < rfn.num_chars; ++i)
+		atlas_reserve(atlas, i, font->glyphs[i].width, font->glyphs[i].height);
 
 	// pass 2: load glyph data
 	sfs_fseek(file, glyph_start, SFS_SEEK_SET);
-	if (!(lock = image_lock(atlas))) goto on_error;
+	atlas_lock(atlas);
 	for (i = 0; i < rfn.num_chars; ++i) {
 		glyph = &font->glyphs[i];
 		if (sfs_fread(&glyph_hdr, sizeof(struct rfn_glyph_header), 1, file) != 1)
 			goto on_error;
-		atlas_x = i % n_glyphs_per_row * max_x;
-		atlas_y = i / n_glyphs_per_row * max_y;
 		switch (rfn.version) {
 		case 1: // RFN v1: 8-bit grayscale glyphs
-			if (!(glyph->image = image_new_slice(atlas, atlas_x, atlas_y, glyph_hdr.width, glyph_hdr.height)))
+			if (!(glyph->image = atlas_add(atlas, i, glyph_hdr.width, glyph_hdr.height)))
 				goto on_error;
 			grayscale = malloc(glyph_hdr.width * glyph_hdr.height);
 			if (sfs_fread(grayscale, glyph_hdr.width * glyph_hdr.height, 1, file) != 1)
 				goto on_error;
+			if (!(lock = image_lock(atlas_image(atlas, i))))
+				goto on_error;
+			xy = atlas_xy(atlas, i);
 			psrc = grayscale;
-			pdest = lock->pixels + atlas_x + atlas_y * lock->pitch;
+			pdest = lock->pixels + xy.x1 + xy.y1 * lock->pitch;
 			for (y = 0; y < glyph_hdr.height; ++y) {
 				for (x = 0; x < glyph_hdr.width; ++x)
 					pdest[x] = color_new(psrc[x], psrc[x], psrc[x], 255);
 				pdest += lock->pitch;
 				psrc += glyph_hdr.width;
 			}
+			image_unlock(atlas_image(atlas, i), lock);
+			free(grayscale);
 			break;
 		case 2: // RFN v2: 32-bit truecolor glyphs
-			if (!(glyph->image = image_read_slice(file, atlas, atlas_x, atlas_y, glyph_hdr.width, glyph_hdr.height)))
+			if (!(glyph->image = atlas_load(atlas, file, i, glyph_hdr.width, glyph_hdr.height)))
 				goto on_error;
 			break;
 		}
 	}
-	image_unlock(atlas, lock);
+	atlas_unlock(atlas);
 	sfs_fclose(file);
-	image_free(atlas);
+	atlas_free(atlas);
 
 	font->id = s_next_font_id++;
 	return font_ref(font);
@@ -159,8 +160,10 @@ on_error:
 		free(font->glyphs);
 		free(font);
 	}
-	if (lock != NULL) image_unlock(atlas, lock);
-	if (atlas != NULL) image_free(atlas);
+	if (atlas != NULL) {
+		atlas_unlock(atlas);
+		atlas_free(atlas);
+	}
 	return NULL;
 }
 
@@ -266,7 +269,6 @@ font_draw_text(const font_t* font, color_t color, int x, int y, text_align_t ali
 		x -= font_get_width(font, text);
 
 	tab_width = font->glyphs[' '].width * 3;
-	al_hold_bitmap_drawing(true);
 	for (;;) {
 		utf8state = UTF8_ACCEPT;
 		while (utf8decode(&utf8state, &cp, ch_byte = *text++) > UTF8_REJECT);
@@ -312,7 +314,6 @@ font_draw_text(const font_t* font, color_t color, int x, int y, text_align_t ali
 			x += font->glyphs[cp].width;
 		}
 	}
-	al_hold_bitmap_drawing(false);
 }
 
 void
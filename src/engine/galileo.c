@@ -5,10 +5,6 @@
 #include "shader.h"
 #include "vector.h"
 
-static void free_cached_uniform (group_t* group, const char* name);
-static bool have_vertex_buffer  (const shape_t* shape);
-static void render_shape        (shape_t* shape);
-
 enum uniform_type
 {
 	UNIFORM_INT,
@@ -19,7 +15,10 @@ enum uniform_type
 };
 struct uniform
 {
-	char              name[256];
+	uint32_t          hash;
+	bool              is_dirty;
+	bool              is_missing;
+	char*             name;
 	enum uniform_type type;
 	union {
 		ALLEGRO_TRANSFORM mat_value;
@@ -28,17 +27,50 @@ struct uniform
 	};
 };
 
+struct batch
+{
+	image_t*               texture;
+	int                    draw_mode;
+	bool                   is_dynamic;
+	int                    num_vertices;
+	ALLEGRO_VERTEX*        sw_vbuf;
+#ifdef MINISPHERE_USE_VERTEX_BUF
+	ALLEGRO_VERTEX_BUFFER* vbuf;
+#endif
+};
+
+struct batch_member
+{
+	unsigned int shape_id;
+	unsigned int version;
+	unsigned int layout_version;
+	int          batch_index;
+	int          offset;
+	int          num_vertices;
+};
+
 struct shape
 {
 	unsigned int           refcount;
 	unsigned int           id;
+	unsigned int           version;
+	unsigned int           layout_version;
 	image_t*               texture;
 	shape_type_t           type;
 	ALLEGRO_VERTEX*        sw_vbuf;
+	int                    dirty_end;
+	int                    dirty_start;
+	int*                   indices;
+	bool                   is_dynamic;
+	int                    max_indices;
 	int                    max_vertices;
+	int                    num_indices;
+	int                    num_uploaded;
+	int                    num_uploaded_indices;
 	int                    num_vertices;
 	vertex_t*              vertices;
 #ifdef MINISPHERE_USE_VERTEX_BUF
+	ALLEGRO_INDEX_BUFFER*  ibuf;
 	ALLEGRO_VERTEX_BUFFER* vbuf;
 #endif
 };
@@ -51,9 +83,45 @@ struct group
 	vector_t*    shapes;
 	matrix_t*    transform;
 	vector_t*    uniforms;
+	int*         uniform_slots;
+	int          num_slots;
+	bool         is_batched;
+	vector_t*    batches;
+	vector_t*    batch_members;
 };
 
+static void            append_shape          (vector_t* vertices, const shape_t* shape, int draw_mode);
+static void            commit_batch          (group_t* group, struct batch* batch, vector_t* vertices);
+static void            convert_vertices      (ALLEGRO_VERTEX* out_vertices, const vertex_t* vertices, int count);
+static void            free_batches          (group_t* group);
+static void            free_vertex_buffer    (shape_t* shape);
+static struct uniform* get_uniform           (group_t* group, const char* name, enum uniform_type type);
+static uint32_t        hash_name             (const char* name);
+static bool            have_vertex_buffer    (const shape_t* shape);
+static void            insert_uniform_slot   (group_t* group, int index);
+static void            invalidate_uniforms   (group_t* group);
+static int             list_mode_of          (int draw_mode);
+static bool            patch_batch           (group_t* group, const shape_t* shape, struct batch_member* member);
+static void            read_instance         (const float* record, instance_format_t format, ALLEGRO_TRANSFORM* out_matrix, ALLEGRO_COLOR* out_color);
+static void            rebuild_batches       (group_t* group);
+static void            render_batch          (struct batch* batch);
+static void            render_instances      (shape_t* shape, const float* instances, int num_instances, instance_format_t format);
+static void            render_shape          (shape_t* shape);
+static int             shape_draw_mode       (const shape_t* shape);
+static int             shape_num_elements    (const shape_t* shape);
+static void            update_batches        (group_t* group);
+#ifdef MINISPHERE_USE_VERTEX_BUF
+static bool            upload_indices        (shape_t* shape);
+#endif
+#if defined(MINISPHERE_USE_SHADERS)
+static void            upload_uniforms       (group_t* group, shader_t* shader);
+#endif
+
 static shader_t*    s_def_shader = NULL;
+static unsigned int s_uniform_owner = UINT_MAX;
+static shader_t*    s_uniform_shader = NULL;
+static vector_t*    s_inst_vertices = NULL;
+static vector_t*    s_patch_vertices = NULL;
 static unsigned int s_next_group_id = 0;
 static unsigned int s_next_shape_id = 0;
 
@@ -68,6 +136,8 @@ shutdown_galileo(void)
 {
 	console_log(1, "shutting down Galileo subsystem");
 	shader_free(s_def_shader);
+	vector_free(s_inst_vertices);
+	vector_free(s_patch_vertices);
 }
 
 shader_t*
@@ -91,6 +161,17 @@ get_default_shader(void)
 	return s_def_shader;
 }
 
+int
+instance_format_len(instance_format_t format)
+{
+	// returns the number of floats making up a single instance record.
+	return format == INSTANCE_OFFSET ? 2
+		: format == INSTANCE_OFFSET_COLOR ? 6
+		: format == INSTANCE_MATRIX ? 16
+		: format == INSTANCE_MATRIX_COLOR ? 20
+		: 0;
+}
+
 vertex_t
 vertex(float x, float y, float z, float u, float v, color_t color)
 {
@@ -117,6 +198,8 @@ group_new(shader_t* shader)
 	group->transform = matrix_new();
 	group->shader = shader_ref(shader);
 	group->uniforms = vector_new(sizeof(struct uniform));
+	group->batches = vector_new(sizeof(struct batch));
+	group->batch_members = vector_new(sizeof(struct batch_member));
 
 	group->id = s_next_group_id++;
 	return group_ref(group);
@@ -133,7 +216,8 @@ group_ref(group_t* group)
 void
 group_free(group_t* group)
 {
-	shape_t** i_shape;
+	shape_t**       i_shape;
+	struct uniform* p_uniform;
 
 	iter_t iter;
 
@@ -148,10 +232,23 @@ group_free(group_t* group)
 	vector_free(group->shapes);
 	shader_free(group->shader);
 	matrix_free(group->transform);
+	iter = vector_enum(group->uniforms);
+	while (p_uniform = vector_next(&iter))
+		free(p_uniform->name);
 	vector_free(group->uniforms);
+	free(group->uniform_slots);
+	free_batches(group);
+	vector_free(group->batches);
+	vector_free(group->batch_members);
 	free(group);
 }
 
+bool
+group_get_batched(const group_t* group)
+{
+	return group->is_batched;
+}
+
 shader_t*
 group_get_shader(const group_t* group)
 {
@@ -164,6 +261,14 @@ group_get_transform(const group_t* group)
 	return group->transform;
 }
 
+void
+group_set_batched(group_t* group, bool batched)
+{
+	group->is_batched = batched;
+	if (!batched)
+		free_batches(group);
+}
+
 void
 group_set_shader(group_t* group, shader_t* shader)
 {
@@ -172,6 +277,7 @@ group_set_shader(group_t* group, shader_t* shader)
 	old_shader = group->shader;
 	group->shader = shader_ref(shader);
 	shader_free(old_shader);
+	invalidate_uniforms(group);
 }
 
 void
@@ -191,42 +297,41 @@ group_add_shape(group_t* group, shape_t* shape)
 
 	shape = shape_ref(shape);
 	vector_push(group->shapes, &shape);
+	free_batches(group);
 	return true;
 }
 
 void
-group_draw(const group_t* group, image_t* surface)
+group_draw(group_t* group, image_t* surface)
 {
+	shader_t* shader;
+
 	iter_t iter;
-	struct uniform* p;
 
+	screen_flush(g_screen);
 	if (surface != NULL)
-		al_set_target_bitmap(image_bitmap(surface));
+		screen_set_target(g_screen, image_bitmap(surface));
 
 #if defined(MINISPHERE_USE_SHADERS)
 	if (are_shaders_active()) {
-		shader_use(group->shader != NULL ? group->shader : get_default_shader());
-		iter = vector_enum(group->uniforms);
-		while (p = vector_next(&iter)) {
-			switch (p->type) {
-			case UNIFORM_FLOAT:
-				al_set_shader_float(p->name, p->float_value);
-				break;
-			case UNIFORM_INT:
-				al_set_shader_int(p->name, p->int_value);
-				break;
-			case UNIFORM_MATRIX:
-				al_set_shader_matrix(p->name, &p->mat_value);
-				break;
-			}
-		}
+		shader = group->shader != NULL ? group->shader : get_default_shader();
+		shader_use(shader);
+		upload_uniforms(group, shader);
 	}
 #endif
 
 	screen_transform(g_screen, group->transform);
-	iter = vector_enum(group->shapes);
-	while (vector_next(&iter))
-		render_shape(*(shape_t**)iter.ptr);
+	if (group->is_batched) {
+		update_batches(group);
+		iter = vector_enum(group->batches);
+		while (vector_next(&iter))
+			render_batch(iter.ptr);
+	}
+	else {
+		iter = vector_enum(group->shapes);
+		while (vector_next(&iter))
+			render_shape(*(shape_t**)iter.ptr);
+	}
 	screen_transform(g_screen, NULL);
 
 #if defined(MINISPHERE_USE_SHADERS)
@@ -234,46 +339,34 @@ group_draw(const group_t* group, image_t* surface)
 #endif
 
 	if (surface != NULL)
-		al_set_target_backbuffer(screen_display(g_screen));
+		screen_set_target(g_screen, NULL);
 }
 
 void
 group_put_float(group_t* group, const char* name, float value)
 {
-	struct uniform unif;
+	struct uniform* unif;
 
-	free_cached_uniform(group, name);
-	strncpy(unif.name, name, 255);
-	unif.name[255] = '\0';
-	unif.type = UNIFORM_FLOAT;
-	unif.float_value = value;
-	vector_push(group->uniforms, &unif);
+	unif = get_uniform(group, name, UNIFORM_FLOAT);
+	unif->float_value = value;
 }
 
 void
 group_put_int(group_t* group, const char* name, int value)
 {
-	struct uniform unif;
+	struct uniform* unif;
 
-	free_cached_uniform(group, name);
-	strncpy(unif.name, name, 255);
-	unif.name[255] = '\0';
-	unif.type = UNIFORM_INT;
-	unif.int_value = value;
-	vector_push(group->uniforms, &unif);
+	unif = get_uniform(group, name, UNIFORM_INT);
+	unif->int_value = value;
 }
 
 void
 group_put_matrix(group_t* group, const char* name, const matrix_t* matrix)
 {
-	struct uniform unif;
+	struct uniform* unif;
 
-	free_cached_uniform(group, name);
-	strncpy(unif.name, name, 255);
-	unif.name[255] = '\0';
-	unif.type = UNIFORM_MATRIX;
-	al_copy_transform(&unif.mat_value, matrix_transform(matrix));
-	vector_push(group->uniforms, &unif);
+	unif = get_uniform(group, name, UNIFORM_MATRIX);
+	al_copy_transform(&unif->mat_value, matrix_transform(matrix));
 }
 
 shape_t*
@@ -314,11 +407,8 @@ shape_free(shape_t* shape)
 		return;
 	console_log(4, "disposing shape #%u no longer in use", shape->id);
 	image_free(shape->texture);
-#ifdef MINISPHERE_USE_VERTEX_BUF
-	if (shape->vbuf != NULL)
-		al_destroy_vertex_buffer(shape->vbuf);
-#endif
-	free(shape->sw_vbuf);
+	free_vertex_buffer(shape);
+	free(shape->indices);
 	free(shape->vertices);
 	free(shape);
 }
@@ -344,6 +434,12 @@ shape_bounds(const shape_t* shape)
 	return bounds;
 }
 
+int
+shape_num_vertices(const shape_t* shape)
+{
+	return shape->num_vertices;
+}
+
 image_t*
 shape_texture(const shape_t* shape)
 {
@@ -358,7 +454,8 @@ shape_set_texture(shape_t* shape, image_t* texture)
 	old_texture = shape->texture;
 	shape->texture = image_ref(texture);
 	image_free(old_texture);
-	shape_upload(shape);
+	++shape->version;
+	shape->layout_version = shape->version;
 }
 
 bool
@@ -379,6 +476,54 @@ shape_add_vertex(shape_t* shape, vertex_t vertex)
 	return true;
 }
 
+vertex_t
+shape_get_vertex(const shape_t* shape, int index)
+{
+	return shape->vertices[index];
+}
+
+void
+shape_set_vertex(shape_t* shape, int index, vertex_t vertex)
+{
+	// rewriting a vertex in place switches the shape over to dynamic mode.  the
+	// existing static buffer is discarded here and replaced by a dynamic one on the
+	// next upload; from then on, only the range of vertices touched since the last
+	// upload is sent to the GPU.
+
+	if (!shape->is_dynamic) {
+		console_log(3, "switching shape #%u to dynamic mode", shape->id);
+		shape->is_dynamic = true;
+		free_vertex_buffer(shape);
+	}
+	shape->vertices[index] = vertex;
+	if (shape->dirty_end <= shape->dirty_start) {
+		shape->dirty_start = index;
+		shape->dirty_end = index + 1;
+	}
+	else {
+		shape->dirty_start = index < shape->dirty_start ? index : shape->dirty_start;
+		shape->dirty_end = index + 1 > shape->dirty_end ? index + 1 : shape->dirty_end;
+	}
+}
+
+bool
+shape_add_index(shape_t* shape, int index)
+{
+	int  new_max;
+	int* new_buffer;
+
+	if (shape->num_indices + 1 > shape->max_indices) {
+		new_max = (shape->num_indices + 1) * 2;
+		if (!(new_buffer = realloc(shape->indices, new_max * sizeof(int))))
+			return false;
+		shape->indices = new_buffer;
+		shape->max_indices = new_max;
+	}
+	++shape->num_indices;
+	shape->indices[shape->num_indices - 1] = index;
+	return true;
+}
+
 void
 shape_calculate_uv(shape_t* shape)
 {
@@ -406,35 +551,89 @@ shape_calculate_uv(shape_t* shape)
 void
 shape_draw(shape_t* shape, matrix_t* matrix, image_t* surface)
 {
+	screen_flush(g_screen);
 	if (surface != NULL)
-		al_set_target_bitmap(image_bitmap(surface));
+		screen_set_target(g_screen, image_bitmap(surface));
 	screen_transform(g_screen, matrix);
 	render_shape(shape);
 	screen_transform(g_screen, NULL);
 	if (surface != NULL)
-		al_set_target_backbuffer(screen_display(g_screen));
+		screen_set_target(g_screen, NULL);
 }
 
 void
-shape_upload(shape_t* shape)
+shape_draw_instanced(shape_t* shape, const float* instances, int num_instances, instance_format_t format, image_t* surface)
 {
-	ALLEGRO_BITMAP* bitmap;
-	ALLEGRO_VERTEX* vertices = NULL;
+	// all instances are drawn in a single pass: the render target, shader and screen
+	// transform are set up only once, every instance is transformed on the CPU and the
+	// whole lot is submitted as one primitive.  Allegro has no instanced draw call, so
+	// this beats issuing one draw per instance even when shaders are available.
 
-	int i;
+	if (shape->num_vertices == 0 || num_instances <= 0)
+		return;
 
-	console_log(3, "uploading shape #%u vertices to GPU", shape->id);
+	screen_flush(g_screen);
+	if (surface != NULL)
+		screen_set_target(g_screen, image_bitmap(surface));
+	screen_transform(g_screen, NULL);
+	render_instances(shape, instances, num_instances, format);
+	if (surface != NULL)
+		screen_set_target(g_screen, NULL);
+}
+
+void
+shape_upload(shape_t* shape)
+{
+	ALLEGRO_VERTEX* vertices = NULL;
+	int             num_dirty;
+	int             usage;
+
+	// dynamic shapes already holding a buffer of the right size only need the dirty
+	// range rewritten; everything else gets a brand-new buffer.
+	if (shape->is_dynamic && have_vertex_buffer(shape) && shape->num_uploaded == shape->num_vertices
+		&& shape->num_uploaded_indices == shape->num_indices)
+	{
+		if ((num_dirty = shape->dirty_end - shape->dirty_start) <= 0)
+			return;
+		console_log(4, "updating vertices %d-%d of shape #%u", shape->dirty_start, shape->dirty_end - 1, shape->id);
+		
+		// only the vertices moved, so a batch holding this shape can be patched
+		// in place rather than rebuilt; see update_batches().
+		++shape->version;
 #ifdef MINISPHERE_USE_VERTEX_BUF
-	if (shape->vbuf != NULL)
-		al_destroy_vertex_buffer(shape->vbuf);
+		if (shape->vbuf != NULL)
+			vertices = al_lock_vertex_buffer(shape->vbuf, shape->dirty_start, num_dirty, ALLEGRO_LOCK_WRITEONLY);
+		else
+			vertices = shape->sw_vbuf + shape->dirty_start;
+		if (vertices == NULL)
+			return;
+#else
+		vertices = shape->sw_vbuf + shape->dirty_start;
 #endif
-	free(shape->sw_vbuf); shape->sw_vbuf = NULL;
-	bitmap = shape->texture != NULL ? image_bitmap(shape->texture) : NULL;
+		convert_vertices(vertices, shape->vertices + shape->dirty_start, num_dirty);
+#ifdef MINISPHERE_USE_VERTEX_BUF
+		if (shape->vbuf != NULL)
+			al_unlock_vertex_buffer(shape->vbuf);
+#endif
+		shape->dirty_start = shape->dirty_end = 0;
+		return;
+	}
 
-	// create a vertex buffer
+	console_log(3, "uploading shape #%u vertices to GPU", shape->id);
+	++shape->version;
+	shape->layout_version = shape->version;
+	free_vertex_buffer(shape);
+	shape->dirty_start = shape->dirty_end = 0;
+
+	// create a vertex buffer.  for indexed shapes, the index buffer is created first;
+	// if that fails, the shape is drawn entirely in software since a hardware vertex
+	// buffer can't be paired with a software index list.
 #ifdef MINISPHERE_USE_VERTEX_BUF
-	if (shape->vbuf = al_create_vertex_buffer(NULL, NULL, shape->num_vertices, ALLEGRO_PRIM_BUFFER_STATIC))
-		vertices = al_lock_vertex_buffer(shape->vbuf, 0, shape->num_vertices, ALLEGRO_LOCK_WRITEONLY);
+	usage = shape->is_dynamic ? ALLEGRO_PRIM_BUFFER_DYNAMIC : ALLEGRO_PRIM_BUFFER_STATIC;
+	if (shape->num_indices == 0 || upload_indices(shape)) {
+		if (shape->vbuf = al_create_vertex_buffer(NULL, NULL, shape->num_vertices, usage))
+			vertices = al_lock_vertex_buffer(shape->vbuf, 0, shape->num_vertices, ALLEGRO_LOCK_WRITEONLY);
+	}
 #endif
 	if (vertices == NULL) {
 		// hardware buffer couldn't be created, fall back to software
@@ -445,24 +644,224 @@ shape_upload(shape_t* shape)
 	}
 
 	// upload vertices
-	for (i = 0; i < shape->num_vertices; ++i) {
-		vertices[i].x = shape->vertices[i].x;
-		vertices[i].y = shape->vertices[i].y;
-		vertices[i].z = shape->vertices[i].z;
-		vertices[i].color = nativecolor(shape->vertices[i].color);
-		vertices[i].u = shape->vertices[i].u;
-		vertices[i].v = shape->vertices[i].v;
-	}
+	convert_vertices(vertices, shape->vertices, shape->num_vertices);
+	shape->num_uploaded = shape->num_vertices;
+	shape->num_uploaded_indices = shape->num_indices;
 
 	// unlock hardware buffer, if applicable
 #ifdef MINISPHERE_USE_VERTEX_BUF
 	if (vertices != shape->sw_vbuf)
 		al_unlock_vertex_buffer(shape->vbuf);
-	else if (shape->vbuf != NULL) {
-		al_destroy_vertex_buffer(shape->vbuf);
+	else {
+		if (shape->vbuf != NULL)
+			al_destroy_vertex_buffer(shape->vbuf);
+		if (shape->ibuf != NULL)
+			al_destroy_index_buffer(shape->ibuf);
 		shape->vbuf = NULL;
+		shape->ibuf = NULL;
+	}
+#endif
+}
+
+static void
+append_shape(vector_t* vertices, const shape_t* shape, int draw_mode)
+{
+	// this expands a shape into list form so that it can be concatenated with other
+	// shapes in the same batch.  strips, fans and loops can't simply be appended to one
+	// another, as the primitives would bleed across shape boundaries.
+
+	int            index;
+	ALLEGRO_VERTEX vertex;
+	int            num_vertices;
+	int            order[3];
+	int            stride;
+
+	int i, j;
+
+	num_vertices = shape_num_elements(shape);
+	stride = list_mode_of(draw_mode) == ALLEGRO_PRIM_POINT_LIST ? 1
+		: list_mode_of(draw_mode) == ALLEGRO_PRIM_LINE_LIST ? 2
+		: 3;
+	for (i = 0; i < num_vertices; ++i) {
+		switch (draw_mode) {
+		case ALLEGRO_PRIM_LINE_STRIP:
+		case ALLEGRO_PRIM_LINE_LOOP:
+			if (i == num_vertices - 1 && (draw_mode == ALLEGRO_PRIM_LINE_STRIP || num_vertices < 3))
+				continue;
+			order[0] = i;
+			order[1] = (i + 1) % num_vertices;
+			break;
+		case ALLEGRO_PRIM_TRIANGLE_STRIP:
+			if (i >= num_vertices - 2)
+				continue;
+			order[0] = i % 2 == 0 ? i : i + 1;
+			order[1] = i % 2 == 0 ? i + 1 : i;
+			order[2] = i + 2;
+			break;
+		case ALLEGRO_PRIM_TRIANGLE_FAN:
+			if (i == 0 || i >= num_vertices - 1)
+				continue;
+			order[0] = 0;
+			order[1] = i;
+			order[2] = i + 1;
+			break;
+		default:
+			// point, line and triangle lists are already in the right form, but a
+			// trailing partial primitive must be dropped.
+			if (i % stride != 0 || i + stride > num_vertices)
+				continue;
+			for (j = 0; j < stride; ++j)
+				order[j] = i + j;
+		}
+		for (j = 0; j < stride; ++j) {
+			index = shape->num_indices > 0 ? shape->indices[order[j]] : order[j];
+			convert_vertices(&vertex, &shape->vertices[index], 1);
+			vector_push(vertices, &vertex);
+		}
+	}
+}
+
+static void
+commit_batch(group_t* group, struct batch* batch, vector_t* vertices)
+{
+	// closes off the batch under construction and uploads its vertices to the GPU.
+	// the batch and vertex list are then reset so the next batch can be started.
+
+	if ((batch->num_vertices = (int)vector_len(vertices)) > 0) {
+		image_ref(batch->texture);
+#ifdef MINISPHERE_USE_VERTEX_BUF
+		batch->vbuf = al_create_vertex_buffer(NULL, vector_get(vertices, 0), batch->num_vertices,
+			batch->is_dynamic ? ALLEGRO_PRIM_BUFFER_DYNAMIC : ALLEGRO_PRIM_BUFFER_STATIC);
+		if (batch->vbuf == NULL) {
+#endif
+			batch->sw_vbuf = malloc(batch->num_vertices * sizeof(ALLEGRO_VERTEX));
+			memcpy(batch->sw_vbuf, vector_get(vertices, 0), batch->num_vertices * sizeof(ALLEGRO_VERTEX));
+#ifdef MINISPHERE_USE_VERTEX_BUF
+		}
+#endif
+		vector_push(group->batches, batch);
 	}
+	vector_clear(vertices);
+	memset(batch, 0, sizeof(struct batch));
+}
+
+static void
+convert_vertices(ALLEGRO_VERTEX* out_vertices, const vertex_t* vertices, int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		out_vertices[i].x = vertices[i].x;
+		out_vertices[i].y = vertices[i].y;
+		out_vertices[i].z = vertices[i].z;
+		out_vertices[i].color = nativecolor(vertices[i].color);
+		out_vertices[i].u = vertices[i].u;
+		out_vertices[i].v = vertices[i].v;
+	}
+}
+
+static void
+free_batches(group_t* group)
+{
+	struct batch* batch;
+
+	iter_t iter;
+
+	iter = vector_enum(group->batches);
+	while (batch = vector_next(&iter)) {
+#ifdef MINISPHERE_USE_VERTEX_BUF
+		if (batch->vbuf != NULL)
+			al_destroy_vertex_buffer(batch->vbuf);
 #endif
+		free(batch->sw_vbuf);
+		image_free(batch->texture);
+	}
+	vector_clear(group->batches);
+	vector_clear(group->batch_members);
+}
+
+static void
+free_vertex_buffer(shape_t* shape)
+{
+#ifdef MINISPHERE_USE_VERTEX_BUF
+	if (shape->vbuf != NULL)
+		al_destroy_vertex_buffer(shape->vbuf);
+	if (shape->ibuf != NULL)
+		al_destroy_index_buffer(shape->ibuf);
+	shape->vbuf = NULL;
+	shape->ibuf = NULL;
+#endif
+	free(shape->sw_vbuf);
+	shape->sw_vbuf = NULL;
+	shape->num_uploaded = 0;
+	shape->num_uploaded_indices = 0;
+}
+
+static struct uniform*
+get_uniform(group_t* group, const char* name, enum uniform_type type)
+{
+	// looks up a uniform by name, adding a new entry if it doesn't exist yet.  the
+	// entry is flagged dirty so that its new value is uploaded on the next draw.
+
+	uint32_t        hash;
+	int             index;
+	int*            new_slots;
+	int             new_size;
+	struct uniform  unif;
+	struct uniform* p_uniform;
+	int             slot;
+
+	int i;
+
+	hash = hash_name(name);
+	if (group->num_slots > 0) {
+		slot = hash & (group->num_slots - 1);
+		while ((index = group->uniform_slots[slot]) != 0) {
+			p_uniform = vector_get(group->uniforms, index - 1);
+			if (p_uniform->hash == hash && strcmp(p_uniform->name, name) == 0) {
+				if (p_uniform->type != type)
+					p_uniform->is_missing = false;
+				p_uniform->type = type;
+				p_uniform->is_dirty = true;
+				return p_uniform;
+			}
+			slot = (slot + 1) & (group->num_slots - 1);
+		}
+	}
+
+	// the name isn't in the table yet.  grow the table first if needed to keep the
+	// load factor at or below 50%, then insert the new uniform.
+	memset(&unif, 0, sizeof(struct uniform));
+	unif.hash = hash;
+	unif.name = strdup(name);
+	unif.type = type;
+	unif.is_dirty = true;
+	vector_push(group->uniforms, &unif);
+	index = (int)vector_len(group->uniforms) - 1;
+	if ((index + 1) * 2 > group->num_slots) {
+		new_size = group->num_slots > 0 ? group->num_slots * 2 : 16;
+		new_slots = calloc(new_size, sizeof(int));
+		free(group->uniform_slots);
+		group->uniform_slots = new_slots;
+		group->num_slots = new_size;
+		for (i = 0; i < index; ++i)
+			insert_uniform_slot(group, i);
+	}
+	insert_uniform_slot(group, index);
+	return vector_get(group->uniforms, index);
+}
+
+static uint32_t
+hash_name(const char* name)
+{
+	// 32-bit FNV-1a
+	uint32_t hash = 2166136261u;
+
+	while (*name != '\0') {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
 }
 
 static bool
@@ -475,17 +874,43 @@ have_vertex_buffer(const shape_t* shape)
 #endif
 }
 
+static int
+list_mode_of(int draw_mode)
+{
+	return draw_mode == ALLEGRO_PRIM_POINT_LIST ? ALLEGRO_PRIM_POINT_LIST
+		: draw_mode == ALLEGRO_PRIM_LINE_LIST ? ALLEGRO_PRIM_LINE_LIST
+		: draw_mode == ALLEGRO_PRIM_LINE_LOOP ? ALLEGRO_PRIM_LINE_LIST
+		: draw_mode == ALLEGRO_PRIM_LINE_STRIP ? ALLEGRO_PRIM_LINE_LIST
+		: ALLEGRO_PRIM_TRIANGLE_LIST;
+}
+
 static void
-free_cached_uniform(group_t* group, const char* name)
+insert_uniform_slot(group_t* group, int index)
 {
+	struct uniform* p_uniform;
+	int             slot;
+
+	p_uniform = vector_get(group->uniforms, index);
+	slot = p_uniform->hash & (group->num_slots - 1);
+	while (group->uniform_slots[slot] != 0)
+		slot = (slot + 1) & (group->num_slots - 1);
+	group->uniform_slots[slot] = index + 1;
+}
+
+static void
+invalidate_uniforms(group_t* group)
+{
+	struct uniform* p_uniform;
+
 	iter_t iter;
-	struct uniform* p;
 
 	iter = vector_enum(group->uniforms);
-	while (p = vector_next(&iter)) {
-		if (strcmp(p->name, name) == 0)
-			iter_remove(&iter);
+	while (p_uniform = vector_next(&iter)) {
+		p_uniform->is_dirty = true;
+		p_uniform->is_missing = false;
 	}
+	if (s_uniform_owner == group->id)
+		s_uniform_owner = UINT_MAX;
 }
 
 static void
@@ -499,26 +924,360 @@ render_shape(shape_t* shape)
 
 	if (!have_vertex_buffer(shape))
 		shape_upload(shape);
+	draw_mode = shape_draw_mode(shape);
+
+	bitmap = shape->texture != NULL ? image_bitmap(shape->texture) : NULL;
+#ifdef MINISPHERE_USE_VERTEX_BUF
+	if (shape->vbuf != NULL && shape->ibuf != NULL)
+		al_draw_indexed_buffer(shape->vbuf, bitmap, shape->ibuf, 0, shape->num_indices, draw_mode);
+	else if (shape->vbuf != NULL)
+		al_draw_vertex_buffer(shape->vbuf, bitmap, 0, shape->num_vertices, draw_mode);
+	else if (shape->num_indices > 0)
+		al_draw_indexed_prim(shape->sw_vbuf, NULL, bitmap, shape->indices, shape->num_indices, draw_mode);
+	else
+		al_draw_prim(shape->sw_vbuf, NULL, bitmap, 0, shape->num_vertices, draw_mode);
+#else
+	if (shape->num_indices > 0)
+		al_draw_indexed_prim(shape->sw_vbuf, NULL, bitmap, shape->indices, shape->num_indices, draw_mode);
+	else
+		al_draw_prim(shape->sw_vbuf, NULL, bitmap, 0, shape->num_vertices, draw_mode);
+#endif
+}
+
+static int
+shape_draw_mode(const shape_t* shape)
+{
+	int num_elements;
+
+	num_elements = shape_num_elements(shape);
 	if (shape->type == SHAPE_AUTO)
-		draw_mode = shape->num_vertices == 1 ? ALLEGRO_PRIM_POINT_LIST
-			: shape->num_vertices == 2 ? ALLEGRO_PRIM_LINE_LIST
+		return num_elements == 1 ? ALLEGRO_PRIM_POINT_LIST
+			: num_elements == 2 ? ALLEGRO_PRIM_LINE_LIST
 			: ALLEGRO_PRIM_TRIANGLE_STRIP;
 	else
-		draw_mode = shape->type == SHAPE_LINES ? ALLEGRO_PRIM_LINE_LIST
+		return shape->type == SHAPE_LINES ? ALLEGRO_PRIM_LINE_LIST
 			: shape->type == SHAPE_LINE_LOOP ? ALLEGRO_PRIM_LINE_LOOP
 			: shape->type == SHAPE_LINE_STRIP ? ALLEGRO_PRIM_LINE_STRIP
 			: shape->type == SHAPE_TRIANGLES ? ALLEGRO_PRIM_TRIANGLE_LIST
 			: shape->type == SHAPE_TRI_STRIP ? ALLEGRO_PRIM_TRIANGLE_STRIP
 			: shape->type == SHAPE_TRI_FAN ? ALLEGRO_PRIM_TRIANGLE_FAN
 			: ALLEGRO_PRIM_POINT_LIST;
+}
 
-	bitmap = shape->texture != NULL ? image_bitmap(shape->texture) : NULL;
+static bool
+patch_batch(group_t* group, const shape_t* shape, struct batch_member* member)
+{
+	// writes a shape's vertices over its part of the batch it's in.  this is only
+	// valid if the shape's layout hasn't changed since the batches were built, in
+	// which case it expands to exactly as many vertices as before.
+
+	struct batch*   batch;
+	ALLEGRO_VERTEX* vertices;
+
+	if (member->batch_index < 0)
+		return member->num_vertices == 0;
+	if (member->batch_index >= (int)vector_len(group->batches))
+		return false;
+	batch = vector_get(group->batches, member->batch_index);
+	if (member->offset + member->num_vertices > batch->num_vertices)
+		return false;
+	if (s_patch_vertices == NULL && !(s_patch_vertices = vector_new(sizeof(ALLEGRO_VERTEX))))
+		return false;
+	vector_clear(s_patch_vertices);
+	append_shape(s_patch_vertices, shape, shape_draw_mode(shape));
+	if ((int)vector_len(s_patch_vertices) != member->num_vertices)
+		return false;
 #ifdef MINISPHERE_USE_VERTEX_BUF
-	if (shape->vbuf != NULL)
-		al_draw_vertex_buffer(shape->vbuf, bitmap, 0, shape->num_vertices, draw_mode);
+	if (batch->vbuf != NULL)
+		vertices = al_lock_vertex_buffer(batch->vbuf, member->offset, member->num_vertices, ALLEGRO_LOCK_WRITEONLY);
 	else
-		al_draw_prim(shape->sw_vbuf, NULL, bitmap, 0, shape->num_vertices, draw_mode);
+		vertices = batch->sw_vbuf + member->offset;
+	if (vertices == NULL)
+		return false;
 #else
-	al_draw_prim(shape->sw_vbuf, NULL, bitmap, 0, shape->num_vertices, draw_mode);
+	vertices = batch->sw_vbuf + member->offset;
 #endif
+	memcpy(vertices, vector_get(s_patch_vertices, 0), member->num_vertices * sizeof(ALLEGRO_VERTEX));
+#ifdef MINISPHERE_USE_VERTEX_BUF
+	if (batch->vbuf != NULL)
+		al_unlock_vertex_buffer(batch->vbuf);
+#endif
+	member->version = shape->version;
+	return true;
 }
+
+static void
+read_instance(const float* record, instance_format_t format, ALLEGRO_TRANSFORM* out_matrix, ALLEGRO_COLOR* out_color)
+{
+	int i, j;
+
+	al_identity_transform(out_matrix);
+	*out_color = al_map_rgba(255, 255, 255, 255);
+	if (format == INSTANCE_OFFSET || format == INSTANCE_OFFSET_COLOR) {
+		al_translate_transform(out_matrix, record[0], record[1]);
+		record += 2;
+	}
+	else {
+		for (i = 0; i < 4; ++i) for (j = 0; j < 4; ++j)
+			out_matrix->m[i][j] = record[i * 4 + j];
+		record += 16;
+	}
+	if (format == INSTANCE_OFFSET_COLOR || format == INSTANCE_MATRIX_COLOR) {
+		out_color->r = record[0];
+		out_color->g = record[1];
+		out_color->b = record[2];
+		out_color->a = record[3];
+	}
+}
+
+static void
+rebuild_batches(group_t* group)
+{
+	// each shape's place in the batches is recorded along with its version, so
+	// that if only its vertices change later, patch_batch() knows where to put
+	// them.
+
+	struct batch        batch;
+	int                 draw_mode;
+	struct batch_member member;
+	size_t              num_shapes;
+	shape_t*            shape;
+	vector_t*           vertices;
+
+	size_t i;
+
+	console_log(4, "rebuilding draw batches for group #%u", group->id);
+
+	free_batches(group);
+	vertices = vector_new(sizeof(ALLEGRO_VERTEX));
+	num_shapes = vector_len(group->shapes);
+	memset(&batch, 0, sizeof(struct batch));
+	for (i = 0; i < num_shapes; ++i) {
+		shape = *(shape_t**)vector_get(group->shapes, i);
+		member.shape_id = shape->id;
+		member.version = shape->version;
+		member.layout_version = shape->layout_version;
+		member.batch_index = -1;
+		member.offset = 0;
+		member.num_vertices = 0;
+		if (shape->num_vertices > 0) {
+			draw_mode = shape_draw_mode(shape);
+			if (vector_len(vertices) > 0
+				&& (shape->texture != batch.texture || list_mode_of(draw_mode) != batch.draw_mode))
+			{
+				commit_batch(group, &batch, vertices);
+			}
+			batch.texture = shape->texture;
+			batch.draw_mode = list_mode_of(draw_mode);
+			batch.is_dynamic = batch.is_dynamic || shape->is_dynamic;
+			member.offset = (int)vector_len(vertices);
+			append_shape(vertices, shape, draw_mode);
+			member.num_vertices = (int)vector_len(vertices) - member.offset;
+			if (member.num_vertices > 0)
+				member.batch_index = (int)vector_len(group->batches);
+		}
+		vector_push(group->batch_members, &member);
+	}
+	commit_batch(group, &batch, vertices);
+	vector_free(vertices);
+}
+
+static void
+render_batch(struct batch* batch)
+{
+	ALLEGRO_BITMAP* bitmap;
+
+	bitmap = batch->texture != NULL ? image_bitmap(batch->texture) : NULL;
+#ifdef MINISPHERE_USE_VERTEX_BUF
+	if (batch->vbuf != NULL)
+		al_draw_vertex_buffer(batch->vbuf, bitmap, 0, batch->num_vertices, batch->draw_mode);
+	else
+		al_draw_prim(batch->sw_vbuf, NULL, bitmap, 0, batch->num_vertices, batch->draw_mode);
+#else
+	al_draw_prim(batch->sw_vbuf, NULL, bitmap, 0, batch->num_vertices, batch->draw_mode);
+#endif
+}
+
+static int
+shape_num_elements(const shape_t* shape)
+{
+	// for indexed shapes, primitives are assembled from the index list rather than
+	// directly from the vertex list.
+	return shape->num_indices > 0 ? shape->num_indices : shape->num_vertices;
+}
+
+static void
+update_batches(group_t* group)
+{
+	// a group's batches are rebuilt whenever a shape is added to it or one of its
+	// shapes has been re-uploaded or retextured since the batches were built.  if
+	// a shape's vertices have only been rewritten in place, as happens every frame
+	// for animated shapes, just its part of the batches is rewritten.
+
+	struct batch_member* member;
+	shape_t*             shape;
+
+	size_t i;
+
+	if (vector_len(group->batch_members) != vector_len(group->shapes)) {
+		rebuild_batches(group);
+		return;
+	}
+	for (i = 0; i < vector_len(group->shapes); ++i) {
+		shape = *(shape_t**)vector_get(group->shapes, i);
+		member = vector_get(group->batch_members, i);
+		if (shape->id != member->shape_id || shape->layout_version != member->layout_version) {
+			rebuild_batches(group);
+			return;
+		}
+	}
+	for (i = 0; i < vector_len(group->shapes); ++i) {
+		shape = *(shape_t**)vector_get(group->shapes, i);
+		member = vector_get(group->batch_members, i);
+		if (shape->version != member->version && !patch_batch(group, shape, member)) {
+			rebuild_batches(group);
+			return;
+		}
+	}
+}
+
+#ifdef MINISPHERE_USE_VERTEX_BUF
+static bool
+upload_indices(shape_t* shape)
+{
+	int       index_size;
+	uint16_t* indices16;
+	uint32_t* indices32;
+	void*     p_indices;
+
+	int i;
+
+	index_size = shape->num_vertices > UINT16_MAX ? 4 : 2;
+	if (!(shape->ibuf = al_create_index_buffer(index_size, NULL, shape->num_indices, ALLEGRO_PRIM_BUFFER_STATIC)))
+		goto on_error;
+	if (!(p_indices = al_lock_index_buffer(shape->ibuf, 0, shape->num_indices, ALLEGRO_LOCK_WRITEONLY)))
+		goto on_error;
+	indices16 = p_indices;
+	indices32 = p_indices;
+	for (i = 0; i < shape->num_indices; ++i) {
+		if (index_size == 2)
+			indices16[i] = shape->indices[i];
+		else
+			indices32[i] = shape->indices[i];
+	}
+	al_unlock_index_buffer(shape->ibuf);
+	return true;
+
+on_error:
+	console_log(3, "unable to create an index buffer for shape #%u", shape->id);
+	if (shape->ibuf != NULL)
+		al_destroy_index_buffer(shape->ibuf);
+	shape->ibuf = NULL;
+	return false;
+}
+#endif
+
+static void
+render_instances(shape_t* shape, const float* instances, int num_instances, instance_format_t format)
+{
+	ALLEGRO_BITMAP*   bitmap;
+	ALLEGRO_COLOR     color;
+	ALLEGRO_VERTEX    copy;
+	int               draw_mode;
+	ALLEGRO_TRANSFORM matrix;
+	size_t            num_vertices;
+	int               stride;
+	ALLEGRO_VERTEX*   vertex;
+	float             x, y, z;
+
+	int    i;
+	size_t j;
+
+	// the shape is expanded into list form first so that the individual instances
+	// don't run into one another when submitted as a single primitive.
+	if (s_inst_vertices == NULL && !(s_inst_vertices = vector_new(sizeof(ALLEGRO_VERTEX))))
+		return;
+	vector_clear(s_inst_vertices);
+	draw_mode = shape_draw_mode(shape);
+	append_shape(s_inst_vertices, shape, draw_mode);
+	if ((num_vertices = vector_len(s_inst_vertices)) == 0)
+		return;
+
+	// replicate the expanded vertices once per instance.  this is done up front so
+	// that the vector isn't reallocated while we're holding pointers into it.  if
+	// we run out of memory partway, nothing gets drawn.
+	for (i = 1; i < num_instances; ++i) {
+		for (j = 0; j < num_vertices; ++j) {
+			copy = *(ALLEGRO_VERTEX*)vector_get(s_inst_vertices, j);
+			if (!vector_push(s_inst_vertices, &copy))
+				return;
+		}
+	}
+
+	stride = instance_format_len(format);
+	for (i = 0; i < num_instances; ++i) {
+		read_instance(&instances[i * stride], format, &matrix, &color);
+		for (j = 0; j < num_vertices; ++j) {
+			vertex = vector_get(s_inst_vertices, i * num_vertices + j);
+			x = vertex->x; y = vertex->y; z = vertex->z;
+			vertex->x = matrix.m[0][0] * x + matrix.m[1][0] * y + matrix.m[2][0] * z + matrix.m[3][0];
+			vertex->y = matrix.m[0][1] * x + matrix.m[1][1] * y + matrix.m[2][1] * z + matrix.m[3][1];
+			vertex->z = matrix.m[0][2] * x + matrix.m[1][2] * y + matrix.m[2][2] * z + matrix.m[3][2];
+			vertex->color.r *= color.r;
+			vertex->color.g *= color.g;
+			vertex->color.b *= color.b;
+			vertex->color.a *= color.a;
+		}
+	}
+
+	bitmap = shape->texture != NULL ? image_bitmap(shape->texture) : NULL;
+#if defined(MINISPHERE_USE_SHADERS)
+	shader_use(get_default_shader());
+#endif
+	al_draw_prim(vector_get(s_inst_vertices, 0), NULL, bitmap, 0,
+		(int)vector_len(s_inst_vertices), list_mode_of(draw_mode));
+#if defined(MINISPHERE_USE_SHADERS)
+	shader_use(NULL);
+#endif
+}
+
+#if defined(MINISPHERE_USE_SHADERS)
+static void
+upload_uniforms(group_t* group, shader_t* shader)
+{
+	// uniform values are part of the GL program state, so as long as this group was
+	// the last one to upload uniforms to this shader, only values which changed since
+	// then need to be sent.  uniforms the shader doesn't have are remembered so that
+	// they aren't looked up again on every draw.
+
+	bool            is_full_upload;
+	struct uniform* p;
+	bool            success;
+
+	iter_t iter;
+
+	is_full_upload = s_uniform_owner != group->id || s_uniform_shader != shader;
+	iter = vector_enum(group->uniforms);
+	while (p = vector_next(&iter)) {
+		if (p->is_missing || (!p->is_dirty && !is_full_upload))
+			continue;
+		switch (p->type) {
+		case UNIFORM_FLOAT:
+			success = al_set_shader_float(p->name, p->float_value);
+			break;
+		case UNIFORM_INT:
+			success = al_set_shader_int(p->name, p->int_value);
+			break;
+		case UNIFORM_MATRIX:
+			success = al_set_shader_matrix(p->name, &p->mat_value);
+			break;
+		default:
+			success = true;
+		}
+		p->is_missing = !success;
+		p->is_dirty = false;
+	}
+	s_uniform_owner = group->id;
+	s_uniform_shader = shader;
+}
+#endif
@@ -18,6 +18,7 @@ struct image
 };
 
 static void cache_pixels   (image_t* image);
+static void flush_sprites  (void);
 static void uncache_pixels (image_t* image);
 
 static unsigned int s_next_image_id = 0;
@@ -70,6 +71,7 @@ image_clone(const image_t* src_image)
 		s_next_image_id, src_image->id);
 	
 	image = calloc(1, sizeof(image_t));
+	flush_sprites();
 	if (!(image->bitmap = al_clone_bitmap(src_image->bitmap)))
 		goto on_error;
 	image->id = s_next_image_id++;
@@ -216,6 +218,7 @@ image_free(image_t* image)
 	console_log(3, "disposing image #%u no longer in use",
 		image->id);
 	uncache_pixels(image);
+	flush_sprites();
 	al_destroy_bitmap(image->bitmap);
 	image_free(image->parent);
 	free(image);
@@ -234,6 +237,12 @@ image_height(const image_t* image)
 	return image->height;
 }
 
+unsigned int
+image_refcount(const image_t* image)
+{
+	return image->refcount;
+}
+
 color_t
 image_get_pixel(image_t* image, int x, int y)
 {
@@ -259,9 +268,9 @@ image_set_pixel(image_t* image, int x, int y, color_t color)
 
 	uncache_pixels(image);
 	old_target = al_get_target_bitmap();
-	al_set_target_bitmap(image->bitmap);
+	screen_set_target(g_screen, image->bitmap);
 	al_draw_pixel(x + 0.5, y + 0.5, nativecolor(color));
-	al_set_target_bitmap(old_target);
+	screen_set_target(g_screen, old_target);
 }
 
 bool
@@ -333,6 +342,7 @@ image_apply_lookup(image_t* image, int x, int y, int width, int height, uint8_t
 
 	int i_x, i_y;
 
+	flush_sprites();
 	if ((lock = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888, ALLEGRO_LOCK_READWRITE)) == NULL)
 		return false;
 	uncache_pixels(image);
@@ -354,29 +364,32 @@ image_blit(image_t* image, image_t* target_image, int x, int y)
 	int blend_mode_src;
 	int blend_op;
 
-	al_set_target_bitmap(image_bitmap(target_image));
+	screen_set_target(g_screen, image_bitmap(target_image));
 	al_get_blender(&blend_op, &blend_mode_src, &blend_mode_dest);
-	al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+	screen_set_blender(g_screen, ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
 	al_draw_bitmap(image_bitmap(image), x, y, 0x0);
-	al_set_blender(blend_op, blend_mode_src, blend_mode_dest);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_blender(g_screen, blend_op, blend_mode_src, blend_mode_dest);
+	screen_set_target(g_screen, NULL);
 }
 
 void
 image_draw(image_t* image, int x, int y)
 {
+	screen_batch_sprites(g_screen);
 	al_draw_bitmap(image->bitmap, x, y, 0x0);
 }
 
 void
 image_draw_masked(image_t* image, color_t mask, int x, int y)
 {
+	screen_batch_sprites(g_screen);
 	al_draw_tinted_bitmap(image->bitmap, al_map_rgba(mask.r, mask.g, mask.b, mask.a), x, y, 0x0);
 }
 
 void
 image_draw_scaled(image_t* image, int x, int y, int width, int height)
 {
+	screen_batch_sprites(g_screen);
 	al_draw_scaled_bitmap(image->bitmap,
 		0, 0, al_get_bitmap_width(image->bitmap), al_get_bitmap_height(image->bitmap),
 		x, y, width, height, 0x0);
@@ -385,6 +398,7 @@ image_draw_scaled(image_t* image, int x, int y, int width, int height)
 void
 image_draw_scaled_masked(image_t* image, color_t mask, int x, int y, int width, int height)
 {
+	screen_batch_sprites(g_screen);
 	al_draw_tinted_scaled_bitmap(image->bitmap, nativecolor(mask),
 		0, 0, al_get_bitmap_width(image->bitmap), al_get_bitmap_height(image->bitmap),
 		x, y, width, height, 0x0);
@@ -401,26 +415,26 @@ image_draw_tiled_masked(image_t* image, color_t mask, int x, int y, int width, i
 {
 	ALLEGRO_COLOR native_mask = nativecolor(mask);
 	int           img_w, img_h;
-	bool          is_drawing_held;
 	int           tile_w, tile_h;
 
 	int i_x, i_y;
 
 	img_w = image->width; img_h = image->height;
-	if (img_w >= 16 && img_h >= 16) {
-		// tile in hardware whenever possible
+	if (img_w >= 16 && img_h >= 16 && image->parent == NULL) {
+		// tile in hardware whenever possible.  this doesn't work for subimages
+		// since texture wrapping would pull in pixels from the rest of the parent.
 		ALLEGRO_VERTEX vbuf[] = {
 			{ x, y, 0, 0, 0, native_mask },
 			{ x + width, y, 0, width, 0, native_mask },
 			{ x, y + height, 0, 0, height, native_mask },
 			{ x + width, y + height, 0, width, height, native_mask }
 		};
+		screen_flush(g_screen);
 		al_draw_prim(vbuf, NULL, image->bitmap, 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
 	}
 	else {
-		// texture smaller than 16x16, tile it in software (Allegro pads it)
-		is_drawing_held = al_is_bitmap_drawing_held();
-		al_hold_bitmap_drawing(true);
+		// texture smaller than 16x16 or a subimage, tile it in software
+		screen_batch_sprites(g_screen);
 		for (i_x = width / img_w; i_x >= 0; --i_x) for (i_y = height / img_h; i_y >= 0; --i_y) {
 			tile_w = i_x == width / img_w ? width % img_w : img_w;
 			tile_h = i_y == height / img_h ? height % img_h : img_h;
@@ -428,7 +442,6 @@ image_draw_tiled_masked(image_t* image, color_t mask, int x, int y, int width, i
 				0, 0, tile_w, tile_h,
 				x + i_x * img_w, y + i_y * img_h, 0x0);
 		}
-		al_hold_bitmap_drawing(is_drawing_held);
 	}
 }
 
@@ -438,14 +451,16 @@ image_fill(image_t* image, color_t color)
 	int             clip_x, clip_y, clip_w, clip_h;
 	ALLEGRO_BITMAP* last_target;
 
+	// the clipping rectangle belongs to the target bitmap, so switch targets
+	// first; that also flushes anything still batched against the old clip.
 	uncache_pixels(image);
+	last_target = al_get_target_bitmap();
+	screen_set_target(g_screen, image->bitmap);
 	al_get_clipping_rectangle(&clip_x, &clip_y, &clip_w, &clip_h);
 	al_reset_clipping_rectangle();
-	last_target = al_get_target_bitmap();
-	al_set_target_bitmap(image->bitmap);
 	al_clear_to_color(al_map_rgba(color.r, color.g, color.b, color.a));
-	al_set_target_bitmap(last_target);
 	al_set_clipping_rectangle(clip_x, clip_y, clip_w, clip_h);
+	screen_set_target(g_screen, last_target);
 }
 
 bool
@@ -458,13 +473,14 @@ image_flip(image_t* image, bool is_h_flip, bool is_v_flip)
 	if (!is_h_flip && !is_v_flip)  // this really shouldn't happen...
 		return true;
 	uncache_pixels(image);
+	flush_sprites();
 	if (!(new_bitmap = al_create_bitmap(image->width, image->height))) return false;
 	old_target = al_get_target_bitmap();
-	al_set_target_bitmap(new_bitmap);
+	screen_set_target(g_screen, new_bitmap);
 	if (is_h_flip) draw_flags |= ALLEGRO_FLIP_HORIZONTAL;
 	if (is_v_flip) draw_flags |= ALLEGRO_FLIP_VERTICAL;
 	al_draw_bitmap(image->bitmap, 0, 0, draw_flags);
-	al_set_target_bitmap(old_target);
+	screen_set_target(g_screen, old_target);
 	al_destroy_bitmap(image->bitmap);
 	image->bitmap = new_bitmap;
 	return true;
@@ -476,6 +492,7 @@ image_lock(image_t* image)
 	ALLEGRO_LOCKED_REGION* ll_lock;
 
 	if (image->lock_count == 0) {
+		flush_sprites();
 		if (!(ll_lock = al_lock_bitmap(image->bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READWRITE)))
 			return NULL;
 		image_ref(image);
@@ -497,6 +514,7 @@ image_replace_color(image_t* image, color_t color, color_t new_color)
 
 	int i_x, i_y;
 
+	flush_sprites();
 	if ((lock = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888, ALLEGRO_LOCK_READWRITE)) == NULL)
 		return false;
 	uncache_pixels(image);
@@ -522,6 +540,9 @@ image_replace_color(image_t* image, color_t color, color_t new_color)
 bool
 image_rescale(image_t* image, int width, int height)
 {
+	int             blend_mode_dest;
+	int             blend_mode_src;
+	int             blend_op;
 	ALLEGRO_BITMAP* new_bitmap;
 	ALLEGRO_BITMAP* old_target;
 
@@ -530,12 +551,14 @@ image_rescale(image_t* image, int width, int height)
 	if (!(new_bitmap = al_create_bitmap(width, height)))
 		return false;
 	uncache_pixels(image);
+	flush_sprites();
 	old_target = al_get_target_bitmap();
-	al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
-	al_set_target_bitmap(new_bitmap);
+	screen_set_target(g_screen, new_bitmap);
+	al_get_blender(&blend_op, &blend_mode_src, &blend_mode_dest);
+	screen_set_blender(g_screen, ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
 	al_draw_scaled_bitmap(image->bitmap, 0, 0, image->width, image->height, 0, 0, width, height, 0x0);
-	al_set_target_bitmap(old_target);
-	al_set_blender(ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA);
+	screen_set_blender(g_screen, blend_op, blend_mode_src, blend_mode_dest);
+	screen_set_target(g_screen, old_target);
 	al_destroy_bitmap(image->bitmap);
 	image->bitmap = new_bitmap;
 	image->width = al_get_bitmap_width(image->bitmap);
@@ -553,6 +576,7 @@ image_save(image_t* image, const char* filename)
 	size_t        next_buf_size;
 	bool          result;
 
+	flush_sprites();
 	next_buf_size = 65536;
 	do {
 		buffer = realloc(buffer, next_buf_size);
@@ -611,6 +635,16 @@ on_error:
 		al_unlock_bitmap(image->bitmap);
 }
 
+static void
+flush_sprites(void)
+{
+	// sprite draws may be deferred, so make sure they hit the GPU before a bitmap
+	// is read back or redrawn behind Allegro's back.  note that images can be
+	// loaded before the render context exists.
+	if (g_screen != NULL)
+		screen_flush(g_screen);
+}
+
 static void
 uncache_pixels(image_t* image)
 {
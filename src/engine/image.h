@@ -21,6 +21,7 @@ image_t*        image_ref                (image_t* image);
 void            image_free               (image_t* image);
 ALLEGRO_BITMAP* image_bitmap             (image_t* image);
 int             image_height             (const image_t* image);
+unsigned int    image_refcount           (const image_t* image);
 color_t         image_get_pixel          (image_t* image, int x, int y);
 int             image_width              (const image_t* image);
 void            image_set_pixel          (image_t* image, int x, int y, color_t color);
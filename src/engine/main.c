@@ -4,11 +4,13 @@
 #include <zlib.h>
 #include "api.h"
 #include "async.h"
+#include "atlas.h"
 #include "audio.h"
 #include "debugger.h"
 #include "galileo.h"
 #include "input.h"
 #include "map_engine.h"
+#include "obsmap.h"
 #include "sockets.h"
 #include "spriteset.h"
 
@@ -195,7 +197,7 @@ main(int argc, char* argv[])
 	}
 	
 	al_set_new_bitmap_flags(ALLEGRO_NO_PREMULTIPLIED_ALPHA);
-	al_set_blender(ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA);
+	screen_set_blender(g_screen, ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA);
 	g_events = al_create_event_queue();
 	al_register_event_source(g_events,
 		al_get_display_event_source(screen_display(g_screen)));
@@ -382,6 +384,8 @@ initialize_engine(void)
 	initialize_audio();
 	initialize_input();
 	initialize_sockets();
+	initialize_atlases();
+	initialize_obsmaps();
 	initialize_spritesets();
 	initialize_map_engine();
 	initialize_scripts();
@@ -416,6 +420,8 @@ shutdown_engine(void)
 	dyad_shutdown();
 
 	shutdown_spritesets();
+	shutdown_atlases();
+	shutdown_obsmaps();
 	shutdown_audio();
 	shutdown_galileo();
 	shutdown_async();
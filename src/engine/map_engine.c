@@ -6,14 +6,19 @@
 #include "color.h"
 #include "image.h"
 #include "input.h"
+#include "matrix.h"
 #include "obsmap.h"
 #include "persons.h"
 #include "script.h"
+#include "spatial.h"
+#include "tilemap.h"
 #include "tileset.h"
 #include "vanilla.h"
 #include "vector.h"
 
-#define MAX_PLAYERS 4
+#define MAP_CHUNK_SIZE 32
+#define MAX_PLAYERS    4
+#define ZONE_CELL_SIZE 128
 
 enum map_script_type
 {
@@ -27,16 +32,39 @@ enum map_script_type
 };
 
 static struct map*         load_map               (const char* path);
+static struct map*         read_map               (const char* path);
+static bool                finish_map             (struct map* map, const char* path);
 static void                free_map               (struct map* map);
+static void                build_chunk            (int layer, int chunk_x, int chunk_y);
+static void                free_chunks            (struct map* map, int layer);
+static void                invalidate_chunk       (int layer, int x, int y);
+static void                invalidate_tiles       (const int* tile_indices, int count);
+static void                recolor_chunk          (int layer, int chunk_x, int chunk_y);
+static bool                rebuild_grids          (struct map* map);
 static bool                are_zones_at           (int x, int y, int layer, int* out_count);
 static struct map_trigger* get_trigger_at         (int x, int y, int layer, int* out_index);
-static struct map_zone*    get_zone_at            (int x, int y, int layer, int which, int* out_index);
+static rect_t              get_trigger_bounds     (const struct map* map, const struct map_trigger* trigger);
+static int                 get_zones_at           (int x, int y, int layer, vector_t* out_indices);
+static int                 add_delay_script       (script_t* script, int frames);
+static void                clear_delay_scripts    (void);
+static int                 get_due_delay_script   (void);
+static bool                is_delay_before        (int slot_a, int slot_b);
+static void                set_delay_heap_entry   (int index, int slot);
+static void                sift_delay_script      (int index);
+static script_t*           take_delay_script      (int slot);
 static bool                change_map             (const char* filename, bool preserve_persons);
+static void                discard_preload        (void);
+static void                finish_preload         (bool wait);
+static spriteset_t*        load_person_spriteset  (const char* filename);
+static bool                preload_map            (const char* filename);
+static void                preload_next_spriteset (void);
+static void*               preload_thread         (ALLEGRO_THREAD* thread, void* arg);
 static int                 find_layer             (const char* name);
 static void                map_screen_to_layer    (int layer, int camera_x, int camera_y, int* inout_x, int* inout_y);
 static void                map_screen_to_map      (int camera_x, int camera_y, int* inout_x, int* inout_y);
 static void                process_map_input      (void);
 static void                render_map             (void);
+static void                render_tiles           (int layer, int off_x, int off_y);
 static void                update_map_engine      (bool is_main_loop);
 
 static duk_ret_t js_MapEngine               (duk_context* ctx);
@@ -56,6 +84,7 @@ static duk_ret_t js_GetCurrentZone          (duk_context* ctx);
 static duk_ret_t js_GetInputPerson          (duk_context* ctx);
 static duk_ret_t js_GetLayerHeight          (duk_context* ctx);
 static duk_ret_t js_GetLayerMask            (duk_context* ctx);
+static duk_ret_t js_GetLayerTiles           (duk_context* ctx);
 static duk_ret_t js_GetLayerWidth           (duk_context* ctx);
 static duk_ret_t js_GetMapEngineFrameRate   (duk_context* ctx);
 static duk_ret_t js_GetNextAnimatedTile     (duk_context* ctx);
@@ -90,6 +119,7 @@ static duk_ret_t js_SetLayerMask            (duk_context* ctx);
 static duk_ret_t js_SetLayerReflective      (duk_context* ctx);
 static duk_ret_t js_SetLayerRenderer        (duk_context* ctx);
 static duk_ret_t js_SetLayerSize            (duk_context* ctx);
+static duk_ret_t js_SetLayerTiles           (duk_context* ctx);
 static duk_ret_t js_SetLayerVisible         (duk_context* ctx);
 static duk_ret_t js_SetLayerWidth           (duk_context* ctx);
 static duk_ret_t js_SetMapEngineFrameRate   (duk_context* ctx);
@@ -115,6 +145,7 @@ static duk_ret_t js_AddZone                 (duk_context* ctx);
 static duk_ret_t js_AttachCamera            (duk_context* ctx);
 static duk_ret_t js_AttachInput             (duk_context* ctx);
 static duk_ret_t js_AttachPlayerInput       (duk_context* ctx);
+static duk_ret_t js_CancelDelayScript       (duk_context* ctx);
 static duk_ret_t js_CallDefaultMapScript    (duk_context* ctx);
 static duk_ret_t js_CallMapScript           (duk_context* ctx);
 static duk_ret_t js_ChangeMap               (duk_context* ctx);
@@ -126,6 +157,7 @@ static duk_ret_t js_ExecuteZones            (duk_context* ctx);
 static duk_ret_t js_ExitMapEngine           (duk_context* ctx);
 static duk_ret_t js_MapToScreenX            (duk_context* ctx);
 static duk_ret_t js_MapToScreenY            (duk_context* ctx);
+static duk_ret_t js_PreloadMap              (duk_context* ctx);
 static duk_ret_t js_RemoveTrigger           (duk_context* ctx);
 static duk_ret_t js_RemoveZone              (duk_context* ctx);
 static duk_ret_t js_RenderMap               (duk_context* ctx);
@@ -148,28 +180,48 @@ static int                 s_map_corner_x;
 static int                 s_map_corner_y;
 static int                 s_current_trigger = -1;
 static int                 s_current_zone = -1;
+static matrix_t*           s_chunk_matrix = NULL;
 static script_t*           s_def_scripts[MAP_SCRIPT_MAX];
 static bool                s_exiting = false;
 static int                 s_framerate = 0;
 static unsigned int        s_frames = 0;
 static bool                s_is_map_running = false;
+static bool                s_is_preload_done = false;
 static lstring_t*          s_last_bgm_file = NULL;
 static struct map*         s_map = NULL;
 static sound_t*            s_map_bgm_stream = NULL;
 static char*               s_map_filename = NULL;
 static struct map_trigger* s_on_trigger = NULL;
+static vector_t*           s_grid_hits = NULL;
 static struct player*      s_players;
+static char*               s_preload_filename = NULL;
+static struct map*         s_preload_map = NULL;
+static ALLEGRO_MUTEX*      s_preload_mutex = NULL;
+static struct map*         s_preload_result = NULL;
+static vector_t*           s_preload_spritesets = NULL;
+static ALLEGRO_THREAD*     s_preload_thread = NULL;
 static script_t*           s_render_script = NULL;
 static int                 s_talk_button = 0;
 static script_t*           s_update_script = NULL;
-static int                 s_num_delay_scripts = 0;
-static int                 s_max_delay_scripts = 0;
-static struct delay_script *s_delay_scripts = NULL;
+static unsigned int        s_delay_frame = 0;
+static vector_t*           s_delay_heap = NULL;
+static unsigned int        s_delay_sequence = 0;
+static vector_t*           s_delay_slots = NULL;
+static vector_t*           s_free_delay_slots = NULL;
+
+struct preload_spriteset
+{
+	char*        filename;
+	spriteset_t* spriteset;
+};
 
 struct delay_script
 {
-	script_t* script;
-	int       frames_left;
+	unsigned int due_frame;
+	unsigned int generation;
+	int          heap_index;
+	unsigned int sequence;
+	script_t*    script;
 };
 
 struct map
@@ -181,29 +233,56 @@ struct map
 	script_t*          scripts[MAP_SCRIPT_MAX];
 	tileset_t*         tileset;
 	vector_t*          triggers;
+	spatial_t*         trigger_grid;
 	vector_t*          zones;
+	spatial_t*         zone_grid;
 	int                num_layers;
 	int                num_persons;
 	struct map_layer   *layers;
 	struct map_person  *persons;
+
+	// script source text read in by read_map(), compiled by finish_map()
+	lstring_t*         script_sources[MAP_SCRIPT_MAX];
+	vector_t*          trigger_sources;
+	vector_t*          zone_sources;
 };
 
 struct map_layer
 {
-	lstring_t*       name;
-	bool             is_parallax;
-	bool             is_reflective;
-	bool             is_visible;
-	float            autoscroll_x;
-	float            autoscroll_y;
-	color_t          color_mask;
-	int              height;
-	obsmap_t*        obsmap;
-	float            parallax_x;
-	float            parallax_y;
-	script_t*        render_script;
-	struct map_tile* tilemap;
-	int              width;
+	lstring_t*        name;
+	bool              is_parallax;
+	bool              is_reflective;
+	bool              is_visible;
+	float             autoscroll_x;
+	float             autoscroll_y;
+	struct map_chunk* chunks;
+	color_t           color_mask;
+	int               height;
+	obsmap_t*         obsmap;
+	float             parallax_x;
+	float             parallax_y;
+	script_t*         render_script;
+	tilemap_t*        tilemap;
+	int               width;
+};
+
+struct map_chunk
+{
+	vector_t*           anim_tiles;
+	bool                is_valid;
+	color_t             mask;
+	int                 num_batches;
+	struct chunk_batch* batches;
+};
+
+struct chunk_batch
+{
+	int                    num_vertices;
+	ALLEGRO_VERTEX*        sw_vbuf;
+	image_t*               texture;
+#ifdef MINISPHERE_USE_VERTEX_BUF
+	ALLEGRO_VERTEX_BUFFER* vbuf;
+#endif
 };
 
 struct map_person
@@ -218,12 +297,6 @@ struct map_person
 	lstring_t* touch_script;
 };
 
-struct map_tile
-{
-	int tile_index;
-	int frames_left;
-};
-
 struct map_trigger
 {
 	script_t* script;
@@ -316,14 +389,20 @@ initialize_map_engine(void)
 	s_map = NULL; s_map_filename = NULL;
 	s_camera_person = NULL;
 	s_players = calloc(MAX_PLAYERS, sizeof(struct player));
+	s_chunk_matrix = matrix_new();
+	s_grid_hits = vector_new(sizeof(int));
 	for (i = 0; i < MAX_PLAYERS; ++i)
 		s_players[i].is_talk_allowed = true;
 	s_current_trigger = -1;
 	s_current_zone = -1;
 	s_render_script = 0;
 	s_update_script = 0;
-	s_num_delay_scripts = s_max_delay_scripts = 0;
-	s_delay_scripts = NULL;
+	s_preload_mutex = al_create_mutex();
+	s_preload_spritesets = vector_new(sizeof(struct preload_spriteset));
+	s_delay_frame = 0;
+	s_delay_heap = vector_new(sizeof(int));
+	s_delay_slots = vector_new(sizeof(struct delay_script));
+	s_free_delay_slots = vector_new(sizeof(int));
 	s_talk_button = 0;
 	s_is_map_running = false;
 	s_color_mask = color_new(0, 0, 0, 0);
@@ -337,15 +416,21 @@ shutdown_map_engine(void)
 
 	console_log(1, "shutting down map engine");
 	
-	for (i = 0; i < s_num_delay_scripts; ++i)
-		free_script(s_delay_scripts[i].script);
-	free(s_delay_scripts);
+	discard_preload();
+	vector_free(s_preload_spritesets);
+	al_destroy_mutex(s_preload_mutex);
+	clear_delay_scripts();
+	vector_free(s_delay_heap);
+	vector_free(s_delay_slots);
+	vector_free(s_free_delay_slots);
 	for (i = 0; i < MAP_SCRIPT_MAX; ++i)
 		free_script(s_def_scripts[i]);
 	free_script(s_update_script);
 	free_script(s_render_script);
 	free_map(s_map);
 	free(s_players);
+	matrix_free(s_chunk_matrix);
+	vector_free(s_grid_hits);
 	
 	mixer_free(s_bgm_mixer);
 	
@@ -396,9 +481,7 @@ get_map_tile(int x, int y, int layer)
 		x = (x % layer_w + layer_w) % layer_w;
 		y = (y % layer_h + layer_h) % layer_h;
 	}
-	if (x < 0 || y < 0 || x >= layer_w || y >= layer_h)
-		return -1;
-	return s_map->layers[layer].tilemap[x + y * layer_w].tile_index;
+	return tilemap_get(s_map->layers[layer].tilemap, x, y);
 }
 
 const tileset_t*
@@ -478,8 +561,10 @@ set_trigger_xy(int trigger_index, int x, int y)
 	struct map_trigger* trigger;
 
 	trigger = vector_get(s_map->triggers, trigger_index);
+	spatial_remove(s_map->trigger_grid, trigger_index, get_trigger_bounds(s_map, trigger));
 	trigger->x = x;
 	trigger->y = y;
+	spatial_add(s_map->trigger_grid, trigger_index, get_trigger_bounds(s_map, trigger));
 }
 
 void
@@ -489,7 +574,9 @@ set_zone_bounds(int zone_index, rect_t bounds)
 
 	zone = vector_get(s_map->zones, zone_index);
 	normalize_rect(&bounds);
+	spatial_remove(s_map->zone_grid, zone_index, zone->bounds);
 	zone->bounds = bounds;
+	spatial_add(s_map->zone_grid, zone_index, zone->bounds);
 }
 
 void
@@ -535,8 +622,16 @@ add_trigger(int x, int y, int layer, script_t* script)
 	trigger.z = layer;
 	trigger.script = ref_script(script);
 	if (!vector_push(s_map->triggers, &trigger))
-		return false;
+		goto on_error;
+	if (!spatial_add(s_map->trigger_grid, (int)vector_len(s_map->triggers) - 1, get_trigger_bounds(s_map, &trigger))) {
+		vector_remove(s_map->triggers, vector_len(s_map->triggers) - 1);
+		goto on_error;
+	}
 	return true;
+
+on_error:
+	free_script(trigger.script);
+	return false;
 }
 
 bool
@@ -554,8 +649,16 @@ add_zone(rect_t bounds, int layer, script_t* script, int steps)
 	zone.interval = steps;
 	zone.steps_left = 0;
 	if (!vector_push(s_map->zones, &zone))
-		return false;
+		goto on_error;
+	if (!spatial_add(s_map->zone_grid, (int)vector_len(s_map->zones) - 1, zone.bounds)) {
+		vector_remove(s_map->zones, vector_len(s_map->zones) - 1);
+		goto on_error;
+	}
 	return true;
+
+on_error:
+	free_script(zone.script);
+	return false;
 }
 
 void
@@ -591,57 +694,51 @@ normalize_map_entity_xy(double* inout_x, double* inout_y, int layer)
 void
 remove_trigger(int trigger_index)
 {
+	struct map_trigger* trigger;
+
+	// removing a trigger shifts the indices of everything after it, so the
+	// grid entries after it are renumbered to match.
+	trigger = vector_get(s_map->triggers, trigger_index);
+	spatial_erase(s_map->trigger_grid, trigger_index, get_trigger_bounds(s_map, trigger));
 	vector_remove(s_map->triggers, trigger_index);
 }
 
 void
 remove_zone(int zone_index)
 {
+	struct map_zone* zone;
+
+	zone = vector_get(s_map->zones, zone_index);
+	spatial_erase(s_map->zone_grid, zone_index, zone->bounds);
 	vector_remove(s_map->zones, zone_index);
 }
 
 bool
 resize_map_layer(int layer, int x_size, int y_size)
 {
+	rect_t              bounds;
 	int                 old_height;
 	int                 old_width;
-	struct map_tile*    tile;
 	int                 tile_width;
 	int                 tile_height;
-	struct map_tile*    tilemap;
 	struct map_trigger* trigger;
 	struct map_zone*    zone;
 
-	int x, y, i;
-
-	old_width = s_map->layers[layer].width;
-	old_height = s_map->layers[layer].height;
+	int i;
 
-	// allocate a new tilemap and copy the old layer tiles into it.  we can't simply realloc
-	// because the tilemap is a 2D array.
-	if (!(tilemap = malloc(x_size * y_size * sizeof(struct map_tile))))
+	// resize the tilemap; any new tiles are filled in with tile 0.  the chunk grid
+	// depends on the layer size, so it needs to be rebuilt from scratch.
+	if (!tilemap_resize(s_map->layers[layer].tilemap, x_size, y_size, 0))
 		return false;
-	for (x = 0; x < x_size; ++x) {
-		for (y = 0; y < y_size; ++y) {
-			if (x < old_width && y < old_height)
-				tilemap[x + y * x_size] = s_map->layers[layer].tilemap[x + y * old_width];
-			else {
-				tile = &tilemap[x + y * x_size];
-				tile->frames_left = tileset_get_delay(s_map->tileset, 0);
-				tile->tile_index = 0;
-			}
-		}
-	}
-
-	// free the old tilemap and substitute the new one
-	free(s_map->layers[layer].tilemap);
-	s_map->layers[layer].tilemap = tilemap;
+	free_chunks(s_map, layer);
 	s_map->layers[layer].width = x_size;
 	s_map->layers[layer].height = y_size;
 
 	// if we resize the largest layer, the overall map size will change.
 	// recalcuate it.
 	tileset_get_size(s_map->tileset, &tile_width, &tile_height);
+	old_width = s_map->width;
+	old_height = s_map->height;
 	s_map->width = 0;
 	s_map->height = 0;
 	for (i = 0; i < s_map->num_layers; ++i) {
@@ -656,26 +753,50 @@ resize_map_layer(int layer, int x_size, int y_size)
 	for (i = (int)vector_len(s_map->zones) - 1; i >= 0; --i) {
 		zone = vector_get(s_map->zones, i);
 		if (zone->bounds.x1 >= s_map->width || zone->bounds.y1 >= s_map->height)
-			vector_remove(s_map->zones, i);
-		else {
-			if (zone->bounds.x2 > s_map->width)
-				zone->bounds.x2 = s_map->width;
-			if (zone->bounds.y2 > s_map->height)
-				zone->bounds.y2 = s_map->height;
+			remove_zone(i);
+		else if (zone->bounds.x2 > s_map->width || zone->bounds.y2 > s_map->height) {
+			bounds = zone->bounds;
+			bounds.x2 = fmin(bounds.x2, s_map->width);
+			bounds.y2 = fmin(bounds.y2, s_map->height);
+			set_zone_bounds(i, bounds);
 		}
 	}
 	for (i = (int)vector_len(s_map->triggers) - 1; i >= 0; --i) {
 		trigger = vector_get(s_map->triggers, i);
 		if (trigger->x >= s_map->width || trigger->y >= s_map->height)
-			vector_remove(s_map->triggers, i);
+			remove_trigger(i);
 	}
 
+	// the grids are sized to fit the map, so they only need to be rebuilt if the
+	// map size changed.  the old grids are left in place if that fails; anything
+	// outside of them is clamped to the edge cells, so lookups still work.
+	if (s_map->width != old_width || s_map->height != old_height)
+		rebuild_grids(s_map);
+
 	return true;
 }
 
 static struct map*
 load_map(const char* filename)
 {
+	struct map* map;
+
+	if (!(map = read_map(filename)))
+		return NULL;
+	if (!finish_map(map, filename)) {
+		free_map(map);
+		return NULL;
+	}
+	return map;
+}
+
+static struct map*
+read_map(const char* filename)
+{
+	// reads in everything about a map that doesn't need the GPU or the JS engine:
+	// layers, obstructions, entities, zones and the tileset's pixels.  this makes
+	// it safe to call from a background thread.  finish_map() does the rest.
+	//
 	// strings: 0 - tileset filename
 	//          1 - music filename
 	//          2 - script filename (obsolete, not used)
@@ -693,12 +814,12 @@ load_map(const char* filename)
 	struct map_layer*        layer;
 	struct rmp_layer_header  layer_hdr;
 	struct map*              map = NULL;
-	int                      num_tiles;
 	struct map_person*       person;
 	struct rmp_header        rmp;
 	lstring_t*               script;
 	rect_t                   segment;
-	int16_t*                 tile_data = NULL;
+	uint16_t*                tile_data = NULL;
+	sfs_file_t*              tileset_file;
 	path_t*                  tileset_path;
 	tileset_t*               tileset;
 	struct map_trigger       trigger;
@@ -706,7 +827,7 @@ load_map(const char* filename)
 	struct rmp_zone_header   zone_hdr;
 	lstring_t*               *strings = NULL;
 
-	int i, j, x, y, z;
+	int i, j, y;
 
 	console_log(2, "constructing new map from `%s`", filename);
 	
@@ -714,7 +835,8 @@ load_map(const char* filename)
 	
 	if (!(file = sfs_fopen(g_fs, filename, NULL, "rb")))
 		goto on_error;
-	map = calloc(1, sizeof(struct map));
+	if (!(map = calloc(1, sizeof(struct map))))
+		goto on_error;
 	if (sfs_fread(&rmp, sizeof(struct rmp_header), 1, file) != 1)
 		goto on_error;
 	if (memcmp(rmp.signature, ".rmp", 4) != 0) goto on_error;
@@ -732,10 +854,17 @@ load_map(const char* filename)
 		if (has_failed) goto on_error;
 
 		// pre-allocate map structures
-		map->layers = calloc(rmp.num_layers, sizeof(struct map_layer));
-		map->persons = calloc(rmp.num_entities, sizeof(struct map_person));
+		if (!(map->layers = calloc(rmp.num_layers, sizeof(struct map_layer))))
+			goto on_error;
+		map->num_layers = rmp.num_layers;
+		if (!(map->persons = calloc(rmp.num_entities, sizeof(struct map_person))))
+			goto on_error;
 		map->triggers = vector_new(sizeof(struct map_trigger));
+		map->trigger_sources = vector_new(sizeof(lstring_t*));
 		map->zones = vector_new(sizeof(struct map_zone));
+		map->zone_sources = vector_new(sizeof(lstring_t*));
+		if (!map->triggers || !map->trigger_sources || !map->zones || !map->zone_sources)
+			goto on_error;
 
 		// load layers
 		for (i = 0; i < rmp.num_layers; ++i) {
@@ -756,16 +885,21 @@ load_map(const char* filename)
 				map->width = fmax(map->width, layer->width);
 				map->height = fmax(map->height, layer->height);
 			}
-			if (!(layer->tilemap = malloc(layer_hdr.width * layer_hdr.height * sizeof(struct map_tile))))
+			if (!(layer->tilemap = tilemap_new(layer_hdr.width, layer_hdr.height, 0)))
 				goto on_error;
 			layer->name = read_lstring(file, true);
 			layer->obsmap = obsmap_new();
-			num_tiles = layer_hdr.width * layer_hdr.height;
-			if ((tile_data = malloc(num_tiles * 2)) == NULL) goto on_error;
-			if (sfs_fread(tile_data, 2, num_tiles, file) != num_tiles)
-				goto on_error;
-			for (j = 0; j < num_tiles; ++j)
-				layer->tilemap[j].tile_index = tile_data[j];
+			
+			// read in the tiles one row at a time.  most chunks will be left uniform,
+			// so only the parts of the layer with any detail take up memory.
+			if ((tile_data = malloc(layer_hdr.width * sizeof(uint16_t))) == NULL) goto on_error;
+			for (y = 0; y < layer_hdr.height; ++y) {
+				if (sfs_fread(tile_data, sizeof(uint16_t), layer_hdr.width, file) != layer_hdr.width)
+					goto on_error;
+				if (!tilemap_set_rect(layer->tilemap, 0, y, layer_hdr.width, 1, tile_data))
+					goto on_error;
+			}
+			tilemap_compact(layer->tilemap);
 			for (j = 0; j < layer_hdr.num_segments; ++j) {
 				if (!fread_rect_32(file, &segment)) goto on_error;
 				obsmap_add_line(layer->obsmap, segment);
@@ -808,10 +942,12 @@ load_map(const char* filename)
 				trigger.x = entity_hdr.x;
 				trigger.y = entity_hdr.y;
 				trigger.z = entity_hdr.z;
-				trigger.script = compile_script(script, "%s/trig%d", filename, vector_len(map->triggers));
+				if (!vector_push(map->trigger_sources, &script)) {
+					lstr_free(script);
+					goto on_error;
+				}
 				if (!vector_push(map->triggers, &trigger))
-					return false;
-				lstr_free(script);
+					goto on_error;
 				break;
 			default:
 				goto on_error;
@@ -829,53 +965,47 @@ load_map(const char* filename)
 			zone.bounds = new_rect(zone_hdr.x1, zone_hdr.y1, zone_hdr.x2, zone_hdr.y2);
 			zone.interval = zone_hdr.interval;
 			zone.steps_left = 0;
-			zone.script = compile_script(script, "%s/zone%d", filename, vector_len(map->zones));
+			zone.script = NULL;
 			normalize_rect(&zone.bounds);
+			if (!vector_push(map->zone_sources, &script)) {
+				lstr_free(script);
+				goto on_error;
+			}
 			if (!vector_push(map->zones, &zone))
-				return false;
-			lstr_free(script);
+				goto on_error;
 		}
 
-		// load tileset
+		// load tileset.  its textures aren't created until finish_map().
 		if (strcmp(lstr_cstr(strings[0]), "") != 0) {
 			tileset_path = path_strip(path_new(filename));
 			path_append(tileset_path, lstr_cstr(strings[0]));
-			tileset = tileset_new(path_cstr(tileset_path));
+			tileset_file = sfs_fopen(g_fs, path_cstr(tileset_path), NULL, "rb");
 			path_free(tileset_path);
+			tileset = tileset_decode(tileset_file);
+			sfs_fclose(tileset_file);
 		}
 		else {
-			tileset = tileset_read(file);
+			tileset = tileset_decode(file);
 		}
 		if (tileset == NULL) goto on_error;
 
-		// initialize tile animation
-		for (z = 0; z < rmp.num_layers; ++z) {
-			layer = &map->layers[z];
-			for (x = 0; x < layer->width; ++x) for (y = 0; y < layer->height; ++y) {
-				i = x + y * layer->width;
-				map->layers[z].tilemap[i].frames_left =
-					tileset_get_delay(tileset, map->layers[z].tilemap[i].tile_index);
-			}
-		}
-
 		// wrap things up
 		map->bgm_file = strcmp(lstr_cstr(strings[1]), "") != 0
 			? lstr_dup(strings[1]) : NULL;
-		map->num_layers = rmp.num_layers;
 		map->is_repeating = rmp.repeat_map;
 		map->origin.x = rmp.start_x;
 		map->origin.y = rmp.start_y;
 		map->origin.z = rmp.start_layer;
 		map->tileset = tileset;
-		if (rmp.num_strings >= 5) {
-			map->scripts[MAP_SCRIPT_ON_ENTER] = compile_script(strings[3], "%s/onEnter", filename);
-			map->scripts[MAP_SCRIPT_ON_LEAVE] = compile_script(strings[4], "%s/onLeave", filename);
-		}
-		if (rmp.num_strings >= 9) {
-			map->scripts[MAP_SCRIPT_ON_LEAVE_NORTH] = compile_script(strings[5], "%s/onLeave", filename);
-			map->scripts[MAP_SCRIPT_ON_LEAVE_EAST] = compile_script(strings[6], "%s/onLeaveEast", filename);
-			map->scripts[MAP_SCRIPT_ON_LEAVE_SOUTH] = compile_script(strings[7], "%s/onLeaveSouth", filename);
-			map->scripts[MAP_SCRIPT_ON_LEAVE_WEST] = compile_script(strings[8], "%s/onLeaveWest", filename);
+		if (!rebuild_grids(map))
+			goto on_error;
+
+		// map scripts are in the same order in the file as in the enum
+		for (i = 0; i < MAP_SCRIPT_MAX; ++i) {
+			if (rmp.num_strings < (i < 2 ? 5 : 9))
+				break;
+			map->script_sources[i] = strings[i + 3];
+			strings[i + 3] = NULL;
 		}
 		for (i = 0; i < rmp.num_strings; ++i)
 			lstr_free(strings[i]);
@@ -894,37 +1024,59 @@ on_error:
 		for (i = 0; i < rmp.num_strings; ++i) lstr_free(strings[i]);
 		free(strings);
 	}
-	if (map != NULL) {
-		if (map->layers != NULL) {
-			for (i = 0; i < rmp.num_layers; ++i) {
-				lstr_free(map->layers[i].name);
-				free(map->layers[i].tilemap);
-				obsmap_free(map->layers[i].obsmap);
-			}
-			free(map->layers);
-		}
-		if (map->persons != NULL) {
-			for (i = 0; i < map->num_persons; ++i) {
-				lstr_free(map->persons[i].name);
-				lstr_free(map->persons[i].spriteset);
-				lstr_free(map->persons[i].create_script);
-				lstr_free(map->persons[i].destroy_script);
-				lstr_free(map->persons[i].command_script);
-				lstr_free(map->persons[i].talk_script);
-				lstr_free(map->persons[i].touch_script);
-			}
-			free(map->persons);
-		}
-		vector_free(map->triggers);
-		vector_free(map->zones);
-		free(map);
-	}
+	free_map(map);
 	return NULL;
 }
 
+static bool
+finish_map(struct map* map, const char* filename)
+{
+	// the part of loading a map which has to happen on the main thread: the
+	// tileset's textures are created and all the map's scripts are compiled.
+
+	static const char* const SCRIPT_NAMES[MAP_SCRIPT_MAX] =
+	{
+		"onEnter", "onLeave", "onLeaveNorth", "onLeaveEast", "onLeaveSouth", "onLeaveWest",
+	};
+
+	lstring_t*          source;
+	struct map_trigger* trigger;
+	struct map_zone*    zone;
+
+	iter_t iter;
+	int    i;
+
+	if (!tileset_upload(map->tileset))
+		return false;
+	for (i = 0; i < MAP_SCRIPT_MAX; ++i) {
+		if (map->script_sources[i] != NULL)
+			map->scripts[i] = compile_script(map->script_sources[i], "%s/%s", filename, SCRIPT_NAMES[i]);
+		lstr_free(map->script_sources[i]);
+		map->script_sources[i] = NULL;
+	}
+	iter = vector_enum(map->triggers);
+	while (trigger = vector_next(&iter)) {
+		source = *(lstring_t**)vector_get(map->trigger_sources, iter.index);
+		trigger->script = compile_script(source, "%s/trig%d", filename, (int)iter.index);
+		lstr_free(source);
+	}
+	iter = vector_enum(map->zones);
+	while (zone = vector_next(&iter)) {
+		source = *(lstring_t**)vector_get(map->zone_sources, iter.index);
+		zone->script = compile_script(source, "%s/zone%d", filename, (int)iter.index);
+		lstr_free(source);
+	}
+	vector_free(map->trigger_sources);
+	vector_free(map->zone_sources);
+	map->trigger_sources = NULL;
+	map->zone_sources = NULL;
+	return true;
+}
+
 static void
 free_map(struct map* map)
 {
+	lstring_t**         p_source;
 	struct map_trigger* trigger;
 	struct map_zone*    zone;
 
@@ -933,15 +1085,18 @@ free_map(struct map* map)
 
 	if (map == NULL)
 		return;
-	for (i = 0; i < MAP_SCRIPT_MAX; ++i)
+	for (i = 0; i < MAP_SCRIPT_MAX; ++i) {
 		free_script(map->scripts[i]);
-	for (i = 0; i < map->num_layers; ++i) {
+		lstr_free(map->script_sources[i]);
+	}
+	for (i = 0; map->layers != NULL && i < map->num_layers; ++i) {
+		free_chunks(map, i);
 		free_script(map->layers[i].render_script);
 		lstr_free(map->layers[i].name);
-		free(map->layers[i].tilemap);
+		tilemap_free(map->layers[i].tilemap);
 		obsmap_free(map->layers[i].obsmap);
 	}
-	for (i = 0; i < map->num_persons; ++i) {
+	for (i = 0; map->persons != NULL && i < map->num_persons; ++i) {
 		lstr_free(map->persons[i].name);
 		lstr_free(map->persons[i].spriteset);
 		lstr_free(map->persons[i].create_script);
@@ -950,92 +1105,493 @@ free_map(struct map* map)
 		lstr_free(map->persons[i].talk_script);
 		lstr_free(map->persons[i].touch_script);
 	}
-	iter = vector_enum(s_map->triggers);
-	while (trigger = vector_next(&iter))
-		free_script(trigger->script);
-	iter = vector_enum(s_map->zones);
-	while (zone = vector_next(&iter))
-		free_script(zone->script);
-	lstr_free(s_map->bgm_file);
+	if (map->triggers != NULL) {
+		iter = vector_enum(map->triggers);
+		while (trigger = vector_next(&iter))
+			free_script(trigger->script);
+	}
+	if (map->zones != NULL) {
+		iter = vector_enum(map->zones);
+		while (zone = vector_next(&iter))
+			free_script(zone->script);
+	}
+	if (map->trigger_sources != NULL) {
+		iter = vector_enum(map->trigger_sources);
+		while (p_source = vector_next(&iter))
+			lstr_free(*p_source);
+	}
+	if (map->zone_sources != NULL) {
+		iter = vector_enum(map->zone_sources);
+		while (p_source = vector_next(&iter))
+			lstr_free(*p_source);
+	}
+	lstr_free(map->bgm_file);
 	tileset_free(map->tileset);
 	free(map->layers);
 	free(map->persons);
 	vector_free(map->triggers);
+	vector_free(map->trigger_sources);
 	vector_free(map->zones);
+	vector_free(map->zone_sources);
+	spatial_free(map->trigger_grid);
+	spatial_free(map->zone_grid);
 	free(map);
 }
 
+static void
+build_chunk(int layer, int chunk_x, int chunk_y)
+{
+	// tiles are grouped by the atlas page holding their current frame, so the whole
+	// chunk can be drawn with one call per page--usually just one.
+
+	static const int corner_x[] = { 0, 1, 0, 1, 1, 0 };
+	static const int corner_y[] = { 0, 0, 1, 0, 1, 1 };
+
+	struct chunk_batch* batch;
+	struct map_chunk*   chunk;
+	ALLEGRO_COLOR       color;
+	struct map_layer*   layer_info;
+	int                 max_x, max_y;
+	int                 min_x, min_y;
+	int                 num_textures = 0;
+	image_t*            texture;
+	vector_t*           textures;
+	int                 tile_index;
+	int                 tile_w, tile_h;
+	ALLEGRO_VERTEX      vertex;
+	vector_t*           vertices;
+	rect_t              xy;
+
+	int i, j, x, y;
+
+	layer_info = &s_map->layers[layer];
+	chunk = &layer_info->chunks[chunk_x + chunk_y * ((layer_info->width + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE)];
+	for (i = 0; i < chunk->num_batches; ++i) {
+#ifdef MINISPHERE_USE_VERTEX_BUF
+		if (chunk->batches[i].vbuf != NULL)
+			al_destroy_vertex_buffer(chunk->batches[i].vbuf);
+#endif
+		free(chunk->batches[i].sw_vbuf);
+	}
+	free(chunk->batches);
+	chunk->batches = NULL;
+	chunk->num_batches = 0;
+	vector_free(chunk->anim_tiles);
+	chunk->anim_tiles = NULL;
+	chunk->is_valid = true;
+	chunk->mask = layer_info->color_mask;
+
+	tileset_get_size(s_map->tileset, &tile_w, &tile_h);
+	min_x = chunk_x * MAP_CHUNK_SIZE;
+	min_y = chunk_y * MAP_CHUNK_SIZE;
+	max_x = fmin(min_x + MAP_CHUNK_SIZE, layer_info->width);
+	max_y = fmin(min_y + MAP_CHUNK_SIZE, layer_info->height);
+	color = nativecolor(layer_info->color_mask);
+	textures = vector_new(sizeof(image_t*));
+	vertices = vector_new(sizeof(ALLEGRO_VERTEX));
+	for (y = min_y; y < max_y; ++y) for (x = min_x; x < max_x; ++x) {
+		tile_index = tilemap_get(layer_info->tilemap, x, y);
+		if (tile_index < 0 || tile_index >= tileset_len(s_map->tileset))
+			continue;
+		if (tileset_is_animated(s_map->tileset, tile_index)) {
+			// keep track of animated tiles so the chunk can be rebuilt when they change
+			if (chunk->anim_tiles == NULL)
+				chunk->anim_tiles = vector_new(sizeof(int));
+			for (i = 0; i < (int)vector_len(chunk->anim_tiles); ++i) {
+				if (*(int*)vector_get(chunk->anim_tiles, i) == tile_index)
+					break;
+			}
+			if (i == (int)vector_len(chunk->anim_tiles))
+				vector_push(chunk->anim_tiles, &tile_index);
+		}
+		texture = tileset_get_texture(s_map->tileset, tile_index, &xy);
+		for (i = 0; i < num_textures; ++i) {
+			if (*(image_t**)vector_get(textures, i) == texture)
+				break;
+		}
+		if (i == num_textures && vector_push(textures, &texture))
+			++num_textures;
+	}
+	if (num_textures > 0)
+		chunk->batches = calloc(num_textures, sizeof(struct chunk_batch));
+	for (i = 0; chunk->batches != NULL && i < num_textures; ++i) {
+		texture = *(image_t**)vector_get(textures, i);
+		vector_clear(vertices);
+		for (y = min_y; y < max_y; ++y) for (x = min_x; x < max_x; ++x) {
+			tile_index = tilemap_get(layer_info->tilemap, x, y);
+			if (tile_index < 0 || tile_index >= tileset_len(s_map->tileset))
+				continue;
+			if (tileset_get_texture(s_map->tileset, tile_index, &xy) != texture)
+				continue;
+			for (j = 0; j < 6; ++j) {
+				vertex.x = (x + corner_x[j]) * tile_w;
+				vertex.y = (y + corner_y[j]) * tile_h;
+				vertex.z = 0.0;
+				vertex.u = corner_x[j] ? xy.x2 : xy.x1;
+				vertex.v = corner_y[j] ? xy.y2 : xy.y1;
+				vertex.color = color;
+				vector_push(vertices, &vertex);
+			}
+		}
+		// the vertices are kept in memory even when a vertex buffer is made, so the
+		// colors can be rewritten without going back to the tilemap.  see
+		// recolor_chunk().
+		batch = &chunk->batches[chunk->num_batches];
+		batch->num_vertices = (int)vector_len(vertices);
+		batch->texture = texture;
+		if (!(batch->sw_vbuf = malloc(batch->num_vertices * sizeof(ALLEGRO_VERTEX))))
+			continue;
+		memcpy(batch->sw_vbuf, vector_get(vertices, 0), batch->num_vertices * sizeof(ALLEGRO_VERTEX));
+#ifdef MINISPHERE_USE_VERTEX_BUF
+		batch->vbuf = al_create_vertex_buffer(NULL, batch->sw_vbuf,
+			batch->num_vertices, ALLEGRO_PRIM_BUFFER_STATIC);
+#endif
+		++chunk->num_batches;
+	}
+	vector_free(textures);
+	vector_free(vertices);
+}
+
+static void
+free_chunks(struct map* map, int layer)
+{
+	struct map_chunk* chunk;
+	int               num_chunks;
+	struct map_layer* layer_info;
+
+	int i, j;
+
+	layer_info = &map->layers[layer];
+	if (layer_info->chunks == NULL)
+		return;
+	num_chunks = ((layer_info->width + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE)
+		* ((layer_info->height + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE);
+	for (i = 0; i < num_chunks; ++i) {
+		chunk = &layer_info->chunks[i];
+		for (j = 0; j < chunk->num_batches; ++j) {
+#ifdef MINISPHERE_USE_VERTEX_BUF
+			if (chunk->batches[j].vbuf != NULL)
+				al_destroy_vertex_buffer(chunk->batches[j].vbuf);
+#endif
+			free(chunk->batches[j].sw_vbuf);
+		}
+		free(chunk->batches);
+		vector_free(chunk->anim_tiles);
+	}
+	free(layer_info->chunks);
+	layer_info->chunks = NULL;
+}
+
+static void
+invalidate_chunk(int layer, int x, int y)
+{
+	struct map_layer* layer_info;
+
+	layer_info = &s_map->layers[layer];
+	if (layer_info->chunks == NULL || x < 0 || y < 0 || x >= layer_info->width || y >= layer_info->height)
+		return;
+	x /= MAP_CHUNK_SIZE;
+	y /= MAP_CHUNK_SIZE;
+	layer_info->chunks[x + y * ((layer_info->width + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE)].is_valid = false;
+}
+
+static void
+invalidate_tiles(const int* tile_indices, int count)
+{
+	// mark chunks showing any of the given tiles for rebuild.  only chunks with
+	// animated tiles need to be checked, since the others can't be affected.
+
+	struct map_chunk* chunk;
+	struct map_layer* layer;
+	int               num_chunks;
+	int               tile_index;
+
+	int i, j, k, z;
+
+	for (z = 0; z < s_map->num_layers; ++z) {
+		layer = &s_map->layers[z];
+		if (layer->chunks == NULL)
+			continue;
+		num_chunks = ((layer->width + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE)
+			* ((layer->height + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE);
+		for (i = 0; i < num_chunks; ++i) {
+			chunk = &layer->chunks[i];
+			if (chunk->anim_tiles == NULL || !chunk->is_valid)
+				continue;
+			for (j = 0; j < (int)vector_len(chunk->anim_tiles) && chunk->is_valid; ++j) {
+				tile_index = *(int*)vector_get(chunk->anim_tiles, j);
+				for (k = 0; k < count; ++k) {
+					if (tile_indices[k] == tile_index)
+						chunk->is_valid = false;
+				}
+			}
+		}
+	}
+}
+
 static bool
-are_zones_at(int x, int y, int layer, int* out_count)
+rebuild_grids(struct map* map)
 {
-	int              count = 0;
-	struct map_zone* zone;
-	bool             zone_found;
+	// zones and triggers are bucketed into a coarse grid so that lookups by
+	// position only need to look at the handful of entries nearby instead of
+	// scanning the whole list every time a person takes a step.  the new grids
+	// only replace the old ones once they're fully built.
+
+	int                 height = 0;
+	struct map_trigger* trigger;
+	spatial_t*          trigger_grid = NULL;
+	int                 tile_w, tile_h;
+	int                 width = 0;
+	struct map_zone*    zone;
+	spatial_t*          zone_grid = NULL;
 
 	iter_t iter;
+	int    i;
 
-	zone_found = false;
-	iter = vector_enum(s_map->zones);
-	while (zone = vector_next(&iter)) {
-		if (zone->layer != layer && false)  // layer ignored for compatibility
-			continue;
-		if (is_point_in_rect(x, y, zone->bounds)) {
-			zone_found = true;
-			++count;
+	tileset_get_size(map->tileset, &tile_w, &tile_h);
+	for (i = 0; i < map->num_layers; ++i) {
+		if (!map->layers[i].is_parallax) {
+			width = fmax(width, map->layers[i].width * tile_w);
+			height = fmax(height, map->layers[i].height * tile_h);
 		}
 	}
+	if (!(trigger_grid = spatial_new(width, height, ZONE_CELL_SIZE)))
+		goto on_error;
+	if (!(zone_grid = spatial_new(width, height, ZONE_CELL_SIZE)))
+		goto on_error;
+	iter = vector_enum(map->triggers);
+	while (trigger = vector_next(&iter)) {
+		if (!spatial_add(trigger_grid, (int)iter.index, get_trigger_bounds(map, trigger)))
+			goto on_error;
+	}
+	iter = vector_enum(map->zones);
+	while (zone = vector_next(&iter)) {
+		if (!spatial_add(zone_grid, (int)iter.index, zone->bounds))
+			goto on_error;
+	}
+	spatial_free(map->trigger_grid);
+	spatial_free(map->zone_grid);
+	map->trigger_grid = trigger_grid;
+	map->zone_grid = zone_grid;
+	return true;
+
+on_error:
+	spatial_free(trigger_grid);
+	spatial_free(zone_grid);
+	return false;
+}
+
+static bool
+are_zones_at(int x, int y, int layer, int* out_count)
+{
+	int count;
+
+	count = get_zones_at(x, y, layer, s_grid_hits);
 	if (out_count) *out_count = count;
-	return zone_found;
+	return count > 0;
 }
 
 static struct map_trigger*
 get_trigger_at(int x, int y, int layer, int* out_index)
 {
-	rect_t              bounds;
-	struct map_trigger* found_item = NULL;
-	int                 tile_w, tile_h;
 	struct map_trigger* trigger;
+	int                 trigger_index;
 
-	iter_t iter;
+	int i;
 
-	tileset_get_size(s_map->tileset, &tile_w, &tile_h);
-	iter = vector_enum(s_map->triggers);
-	while (trigger = vector_next(&iter)) {
+	// candidates come back in ascending order, so the first hit is the same
+	// trigger a linear scan would have found.
+	spatial_query(s_map->trigger_grid, new_rect(x, y, x, y), s_grid_hits);
+	for (i = 0; i < (int)vector_len(s_grid_hits); ++i) {
+		trigger_index = *(int*)vector_get(s_grid_hits, i);
+		trigger = vector_get(s_map->triggers, trigger_index);
 		if (trigger->z != layer && false)  // layer ignored for compatibility reasons
 			continue;
-		bounds.x1 = trigger->x - tile_w / 2;
-		bounds.y1 = trigger->y - tile_h / 2;
-		bounds.x2 = bounds.x1 + tile_w;
-		bounds.y2 = bounds.y1 + tile_h;
-		if (is_point_in_rect(x, y, bounds)) {
-			found_item = trigger;
-			if (out_index) *out_index = (int)iter.index;
-			break;
+		if (is_point_in_rect(x, y, get_trigger_bounds(s_map, trigger))) {
+			if (out_index) *out_index = trigger_index;
+			return trigger;
 		}
 	}
-	return found_item;
+	return NULL;
+}
+
+static rect_t
+get_trigger_bounds(const struct map* map, const struct map_trigger* trigger)
+{
+	rect_t bounds;
+	int    tile_w, tile_h;
+
+	tileset_get_size(map->tileset, &tile_w, &tile_h);
+	bounds.x1 = trigger->x - tile_w / 2;
+	bounds.y1 = trigger->y - tile_h / 2;
+	bounds.x2 = bounds.x1 + tile_w;
+	bounds.y2 = bounds.y1 + tile_h;
+	return bounds;
 }
 
-static struct map_zone*
-get_zone_at(int x, int y, int layer, int which, int* out_index)
+static int
+get_zones_at(int x, int y, int layer, vector_t* out_indices)
 {
-	struct map_zone* found_item = NULL;
+	// fills `out_indices` with the index of every zone containing the point,
+	// in ascending order.  returns the number of zones found.
+
+	iter_t           iter;
+	int*             p_index;
 	struct map_zone* zone;
-	
-	iter_t iter;
-	int    i;
 
-	iter = vector_enum(s_map->zones); i = -1;
-	while (zone = vector_next(&iter)) {
+	spatial_query(s_map->zone_grid, new_rect(x, y, x, y), out_indices);
+	iter = vector_enum(out_indices);
+	while (p_index = vector_next(&iter)) {
+		zone = vector_get(s_map->zones, *p_index);
 		if (zone->layer != layer && false)  // layer ignored for compatibility
 			continue;
-		if (is_point_in_rect(x, y, zone->bounds) && which-- == 0) {
-			found_item = zone;
-			if (out_index) *out_index = (int)iter.index;
+		if (!is_point_in_rect(x, y, zone->bounds))
+			iter_remove(&iter);
+	}
+	return (int)vector_len(out_indices);
+}
+
+static int
+add_delay_script(script_t* script, int frames)
+{
+	// delay scripts live in a table of slots so that handles handed out to
+	// script code stay valid while the heap is reshuffled.  the slot's generation
+	// is bumped whenever it's freed, invalidating any outstanding handles.
+	struct delay_script  new_delay;
+	struct delay_script* delay;
+	int                  index;
+	int                  slot;
+
+	if (vector_len(s_free_delay_slots) > 0) {
+		slot = *(int*)vector_get(s_free_delay_slots, vector_len(s_free_delay_slots) - 1);
+		vector_remove(s_free_delay_slots, vector_len(s_free_delay_slots) - 1);
+	}
+	else {
+		if (vector_len(s_delay_slots) > 0xFFFF)
+			return -1;
+		memset(&new_delay, 0, sizeof(struct delay_script));
+		new_delay.heap_index = -1;
+		if (!vector_push(s_delay_slots, &new_delay))
+			return -1;
+		slot = (int)vector_len(s_delay_slots) - 1;
+	}
+	index = (int)vector_len(s_delay_heap);
+	if (!vector_push(s_delay_heap, &slot)) {
+		vector_push(s_free_delay_slots, &slot);
+		return -1;
+	}
+	delay = vector_get(s_delay_slots, slot);
+	delay->due_frame = s_delay_frame + frames + 1;
+	delay->sequence = s_delay_sequence++;
+	delay->script = script;
+	set_delay_heap_entry(index, slot);
+	sift_delay_script(index);
+	return slot;
+}
+
+static void
+clear_delay_scripts(void)
+{
+	int slot;
+	
+	// taking entries from the end of the heap never has to reorder it
+	while (vector_len(s_delay_heap) > 0) {
+		slot = *(int*)vector_get(s_delay_heap, vector_len(s_delay_heap) - 1);
+		free_script(take_delay_script(slot));
+	}
+}
+
+static int
+get_due_delay_script(void)
+{
+	struct delay_script* delay;
+	int                  slot;
+
+	if (vector_len(s_delay_heap) == 0)
+		return -1;
+	slot = *(int*)vector_get(s_delay_heap, 0);
+	delay = vector_get(s_delay_slots, slot);
+	return (int)(delay->due_frame - s_delay_frame) <= 0 ? slot : -1;
+}
+
+static bool
+is_delay_before(int slot_a, int slot_b)
+{
+	// scripts due on the same frame run in the order they were set up, same as
+	// they always have.
+	const struct delay_script* a;
+	const struct delay_script* b;
+
+	a = vector_get(s_delay_slots, slot_a);
+	b = vector_get(s_delay_slots, slot_b);
+	if (a->due_frame != b->due_frame)
+		return (int)(a->due_frame - b->due_frame) < 0;
+	return (int)(a->sequence - b->sequence) < 0;
+}
+
+static void
+set_delay_heap_entry(int index, int slot)
+{
+	struct delay_script* delay;
+
+	vector_set(s_delay_heap, index, &slot);
+	delay = vector_get(s_delay_slots, slot);
+	delay->heap_index = index;
+}
+
+static void
+sift_delay_script(int index)
+{
+	int child;
+	int num_entries;
+	int parent;
+	int slot;
+
+	num_entries = (int)vector_len(s_delay_heap);
+	slot = *(int*)vector_get(s_delay_heap, index);
+	while (index > 0) {
+		parent = (index - 1) / 2;
+		if (!is_delay_before(slot, *(int*)vector_get(s_delay_heap, parent)))
 			break;
+		set_delay_heap_entry(index, *(int*)vector_get(s_delay_heap, parent));
+		index = parent;
+	}
+	while ((child = index * 2 + 1) < num_entries) {
+		if (child + 1 < num_entries
+			&& is_delay_before(*(int*)vector_get(s_delay_heap, child + 1), *(int*)vector_get(s_delay_heap, child)))
+		{
+			++child;
 		}
+		if (!is_delay_before(*(int*)vector_get(s_delay_heap, child), slot))
+			break;
+		set_delay_heap_entry(index, *(int*)vector_get(s_delay_heap, child));
+		index = child;
 	}
-	return found_item;
+	set_delay_heap_entry(index, slot);
+}
+
+static script_t*
+take_delay_script(int slot)
+{
+	struct delay_script* delay;
+	int                  index;
+	int                  last_index;
+	script_t*            script;
+
+	delay = vector_get(s_delay_slots, slot);
+	script = delay->script;
+	index = delay->heap_index;
+	last_index = (int)vector_len(s_delay_heap) - 1;
+	if (index < last_index)
+		set_delay_heap_entry(index, *(int*)vector_get(s_delay_heap, last_index));
+	vector_remove(s_delay_heap, last_index);
+	if (index < last_index)
+		sift_delay_script(index);
+	delay->generation = (delay->generation + 1) & 0xFFFF;
+	delay->heap_index = -1;
+	delay->script = NULL;
+	vector_push(s_free_delay_slots, &slot);
+	return script;
 }
 
 static bool
@@ -1045,6 +1601,7 @@ change_map(const char* filename, bool preserve_persons)
 	//       the map engine may be left in an inconsistent state. it is therefore probably wise
 	//       to consider such a situation unrecoverable.
 	
+	bool               is_preloaded = false;
 	struct map*        map;
 	person_t*          person;
 	struct map_person* person_info;
@@ -1055,7 +1612,18 @@ change_map(const char* filename, bool preserve_persons)
 
 	console_log(2, "changing current map to `%s`", filename);
 	
-	map = load_map(filename);
+	// if the map was preloaded, most of the work is already done.  if it's still
+	// being read in, wait for it; that's no slower than starting over.
+	if (s_preload_filename != NULL && strcmp(filename, s_preload_filename) == 0)
+		finish_preload(true);
+	if (s_preload_map != NULL && strcmp(filename, s_preload_filename) == 0) {
+		console_log(3, "using preloaded map `%s`", filename);
+		map = s_preload_map;
+		s_preload_map = NULL;
+		is_preloaded = true;
+	}
+	else
+		map = load_map(filename);
 	if (map == NULL) return false;
 	if (s_map != NULL) {
 		// run map exit scripts first, before loading new map
@@ -1065,9 +1633,7 @@ change_map(const char* filename, bool preserve_persons)
 	
 	// close out old map and prep for new one
 	free_map(s_map); free(s_map_filename);
-	for (i = 0; i < s_num_delay_scripts; ++i)
-		free_script(s_delay_scripts[i].script);
-	s_num_delay_scripts = 0;
+	clear_delay_scripts();
 	s_map = map; s_map_filename = strdup(filename);
 	reset_persons(preserve_persons);
 
@@ -1075,7 +1641,7 @@ change_map(const char* filename, bool preserve_persons)
 	for (i = 0; i < s_map->num_persons; ++i) {
 		person_info = &s_map->persons[i];
 		path = fs_make_path(lstr_cstr(person_info->spriteset), "spritesets", true);
-		spriteset = load_spriteset(path_cstr(path));
+		spriteset = load_person_spriteset(path_cstr(path));
 		path_free(path);
 		if (spriteset == NULL)
 			goto on_error;
@@ -1094,6 +1660,8 @@ change_map(const char* filename, bool preserve_persons)
 		// the map engine gets the responsibility.
 		call_person_script(person, PERSON_SCRIPT_ON_CREATE, false);
 	}
+	if (is_preloaded && s_preload_map == NULL)
+		discard_preload();  // spritesets are no longer needed, unless another map was preloaded
 
 	// set camera over starting position
 	s_cam_x = s_map->origin.x;
@@ -1130,9 +1698,185 @@ change_map(const char* filename, bool preserve_persons)
 on_error:
 	free_spriteset(spriteset);
 	free_map(s_map);
+	if (is_preloaded && s_preload_map == NULL)
+		discard_preload();
 	return false;
 }
 
+static void
+discard_preload(void)
+{
+	struct preload_spriteset* preload;
+
+	iter_t iter;
+
+	if (s_preload_thread != NULL) {
+		// there's no stopping the thread halfway through reading a map, so this
+		// has to wait for it to finish.
+		al_join_thread(s_preload_thread, NULL);
+		al_destroy_thread(s_preload_thread);
+		s_preload_thread = NULL;
+		console_defer(false);
+		free_map(s_preload_result);
+		s_preload_result = NULL;
+	}
+	free_map(s_preload_map);
+	free(s_preload_filename);
+	s_preload_map = NULL;
+	s_preload_filename = NULL;
+	iter = vector_enum(s_preload_spritesets);
+	while (preload = vector_next(&iter)) {
+		free(preload->filename);
+		free_spriteset(preload->spriteset);
+	}
+	vector_clear(s_preload_spritesets);
+}
+
+static spriteset_t*
+load_person_spriteset(const char* filename)
+{
+	// use the preloaded copy of a spriteset if there is one, otherwise load it
+	// now.  either way the caller gets its own reference.
+
+	struct preload_spriteset* preload;
+
+	iter_t iter;
+
+	iter = vector_enum(s_preload_spritesets);
+	while (preload = vector_next(&iter)) {
+		if (strcmp(filename, preload->filename) == 0 && preload->spriteset != NULL)
+			return ref_spriteset(preload->spriteset);
+	}
+	return load_spriteset(filename);
+}
+
+static bool
+preload_map(const char* filename)
+{
+	// loads a map ahead of time so that a later change_map() to it doesn't need to
+	// stop and load everything at once.  the map file and its tileset are read in
+	// on a background thread; once that's done, the map engine finishes the job
+	// and then loads the spritesets for its persons, one per frame.  whatever
+	// hasn't been loaded by the time the map is entered is loaded then.
+
+	console_log(2, "preloading map `%s`", filename);
+
+	discard_preload();
+	if (!sfs_fexist(g_fs, filename, NULL))
+		return false;
+	s_preload_filename = strdup(filename);
+	s_is_preload_done = false;
+	
+	// the console is deferred for as long as the thread runs, so that anything it
+	// logs comes out in one piece once it's done.
+	if (!console_defer(true) || !(s_preload_thread = al_create_thread(preload_thread, s_preload_filename))) {
+		// if the thread can't be started, just load the map now
+		console_defer(false);
+		console_log(2, "failed to start map preload thread, loading `%s` now", filename);
+		if (!(s_preload_result = read_map(filename)))
+			return false;
+		finish_preload(false);
+		return s_preload_map != NULL;
+	}
+	al_start_thread(s_preload_thread);
+	return true;
+}
+
+static void
+preload_next_spriteset(void)
+{
+	struct preload_spriteset* preload;
+
+	iter_t iter;
+
+	iter = vector_enum(s_preload_spritesets);
+	while (preload = vector_next(&iter)) {
+		if (preload->spriteset != NULL)
+			continue;
+		if (!(preload->spriteset = load_spriteset(preload->filename))) {
+			// leave it for change_map() to report
+			free(preload->filename);
+			iter_remove(&iter);
+			continue;
+		}
+		break;
+	}
+}
+
+static void
+finish_preload(bool wait)
+{
+	// picks up the map read in by the preload thread once it's done and does the
+	// main-thread part of loading it.  the spritesets for its persons are then
+	// queued up to be loaded by preload_next_spriteset().
+
+	bool                     is_done;
+	struct map*              map;
+	path_t*                  path;
+	struct map_person*       person_info;
+	struct preload_spriteset preload;
+	struct preload_spriteset *p_preload;
+
+	iter_t iter;
+	int    i;
+
+	if (s_preload_thread == NULL && s_preload_result == NULL)
+		return;
+	if (s_preload_thread != NULL) {
+		al_lock_mutex(s_preload_mutex);
+		is_done = s_is_preload_done;
+		al_unlock_mutex(s_preload_mutex);
+		if (!is_done && !wait)
+			return;
+		al_join_thread(s_preload_thread, NULL);
+		al_destroy_thread(s_preload_thread);
+		s_preload_thread = NULL;
+		console_defer(false);
+	}
+	map = s_preload_result;
+	s_preload_result = NULL;
+	if (map == NULL || !finish_map(map, s_preload_filename)) {
+		// leave it for change_map() to report
+		console_log(2, "failed to preload map `%s`", s_preload_filename);
+		free_map(map);
+		return;
+	}
+	s_preload_map = map;
+	for (i = 0; i < s_preload_map->num_persons; ++i) {
+		person_info = &s_preload_map->persons[i];
+		path = fs_make_path(lstr_cstr(person_info->spriteset), "spritesets", true);
+		iter = vector_enum(s_preload_spritesets);
+		while (p_preload = vector_next(&iter)) {
+			if (strcmp(path_cstr(path), p_preload->filename) == 0)
+				break;
+		}
+		if (p_preload == NULL) {
+			preload.filename = strdup(path_cstr(path));
+			preload.spriteset = NULL;
+			vector_push(s_preload_spritesets, &preload);
+		}
+		path_free(path);
+	}
+}
+
+static void*
+preload_thread(ALLEGRO_THREAD* thread, void* arg)
+{
+	// this runs on its own thread, so it must not touch the GPU, the JS engine or
+	// any of the map engine's state.  the main thread polls s_is_preload_done.
+	// note: logging is fine here, since the console is deferred until the thread
+	//       has been joined.
+
+	struct map* map;
+
+	map = read_map(arg);
+	al_lock_mutex(s_preload_mutex);
+	s_preload_result = map;
+	s_is_preload_done = true;
+	al_unlock_mutex(s_preload_mutex);
+	return NULL;
+}
+
 static int
 find_layer(const char* name)
 {
@@ -1316,20 +2060,16 @@ static void
 render_map(void)
 {
 	bool              is_repeating;
-	int               cell_x;
-	int               cell_y;
-	int               first_cell_x;
-	int               first_cell_y;
 	struct map_layer* layer;
 	int               layer_height;
 	int               layer_width;
 	ALLEGRO_COLOR     overlay_color;
+	int               repeat_w, repeat_h;
 	int               tile_height;
-	int               tile_index;
 	int               tile_width;
 	int               off_x, off_y;
 	
-	int x, y, z;
+	int z;
 	
 	if (screen_is_skipframe(g_screen))
 		return;
@@ -1345,49 +2085,148 @@ render_map(void)
 		map_screen_to_layer(z, s_cam_x, s_cam_y, &off_x, &off_y);
 
 		// render person reflections if layer is reflective
-		al_hold_bitmap_drawing(true);
-		if (layer->is_reflective) {
-			if (is_repeating) {  // for small repeating maps, persons need to be repeated as well
-				for (y = 0; y < g_res_y / layer_height + 2; ++y) for (x = 0; x < g_res_x / layer_width + 2; ++x)
-					render_persons(z, true, off_x - x * layer_width, off_y - y * layer_height);
-			}
-			else {
-				render_persons(z, true, off_x, off_y);
-			}
-		}
+		// note: for small repeating maps, persons need to be repeated as well.
+		//       render_persons() takes care of that, along with culling.
+		repeat_w = is_repeating ? layer_width : 0;
+		repeat_h = is_repeating ? layer_height : 0;
+		screen_batch_sprites(g_screen);
+		if (layer->is_reflective)
+			render_persons(z, true, off_x, off_y, repeat_w, repeat_h);
 		
 		// render tiles, but only if the layer is visible
-		if (layer->is_visible) {
-			first_cell_x = off_x / tile_width;
-			first_cell_y = off_y / tile_height;
-			for (y = 0; y < g_res_y / tile_height + 2; ++y) for (x = 0; x < g_res_x / tile_width + 2; ++x) {
-				cell_x = is_repeating ? (x + first_cell_x) % layer->width : x + first_cell_x;
-				cell_y = is_repeating ? (y + first_cell_y) % layer->height : y + first_cell_y;
-				if (cell_x < 0 || cell_x >= layer->width || cell_y < 0 || cell_y >= layer->height)
-					continue;
-				tile_index = layer->tilemap[cell_x + cell_y * layer->width].tile_index;
-				tileset_draw(s_map->tileset, layer->color_mask, x * tile_width - off_x % tile_width, y * tile_height - off_y % tile_height, tile_index);
-			}
-		}
+		if (layer->is_visible)
+			render_tiles(z, off_x, off_y);
 
 		// render persons
-		if (is_repeating) {  // for small repeating maps, persons need to be repeated as well
-			for (y = 0; y < g_res_y / layer_height + 2; ++y) for (x = 0; x < g_res_x / layer_width + 2; ++x)
-				render_persons(z, false, off_x - x * layer_width, off_y - y * layer_height);
-		}
-		else {
-			render_persons(z, false, off_x, off_y);
-		}
-		al_hold_bitmap_drawing(false);
+		render_persons(z, false, off_x, off_y, repeat_w, repeat_h);
 
 		run_script(layer->render_script, false);
 	}
 
 	overlay_color = al_map_rgba(s_color_mask.r, s_color_mask.g, s_color_mask.b, s_color_mask.a);
+	screen_flush(g_screen);
 	al_draw_filled_rectangle(0, 0, g_res_x, g_res_y, overlay_color);
 	run_script(s_render_script, false);
 }
 
+static void
+render_tiles(int layer, int off_x, int off_y)
+{
+	// tiles are drawn from prebuilt per-chunk geometry, so a full screen of tiles
+	// costs only a few draw calls.  the chunks are positioned in layer space; a
+	// translation per copy of the layer moves them into place on screen, which
+	// also takes care of repeating layers.
+
+	struct chunk_batch* batch;
+	int                 chunk_w, chunk_h;
+	struct map_chunk*   chunk;
+	int                 first_copy_x, first_copy_y;
+	bool                is_repeating;
+	int                 last_copy_x, last_copy_y;
+	struct map_layer*   layer_info;
+	int                 layer_w, layer_h;
+	int                 num_chunks_x, num_chunks_y;
+	int                 tile_w, tile_h;
+	int                 view_x1, view_y1;
+	int                 view_x2, view_y2;
+
+	int copy_x, copy_y;
+	int i, x, y;
+
+	layer_info = &s_map->layers[layer];
+	is_repeating = s_map->is_repeating || layer_info->is_parallax;
+	tileset_get_size(s_map->tileset, &tile_w, &tile_h);
+	num_chunks_x = (layer_info->width + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE;
+	num_chunks_y = (layer_info->height + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE;
+	if (layer_info->chunks == NULL) {
+		if (!(layer_info->chunks = calloc(num_chunks_x * num_chunks_y, sizeof(struct map_chunk))))
+			return;
+	}
+	layer_w = layer_info->width * tile_w;
+	layer_h = layer_info->height * tile_h;
+	chunk_w = MAP_CHUNK_SIZE * tile_w;
+	chunk_h = MAP_CHUNK_SIZE * tile_h;
+	first_copy_x = last_copy_x = 0;
+	first_copy_y = last_copy_y = 0;
+	if (is_repeating) {
+		first_copy_x = floor((double)off_x / layer_w);
+		first_copy_y = floor((double)off_y / layer_h);
+		last_copy_x = floor((double)(off_x + g_res_x - 1) / layer_w);
+		last_copy_y = floor((double)(off_y + g_res_y - 1) / layer_h);
+	}
+	screen_flush(g_screen);
+	for (copy_y = first_copy_y; copy_y <= last_copy_y; ++copy_y) for (copy_x = first_copy_x; copy_x <= last_copy_x; ++copy_x) {
+		matrix_identity(s_chunk_matrix);
+		matrix_translate(s_chunk_matrix, copy_x * layer_w - off_x, copy_y * layer_h - off_y, 0.0);
+		screen_transform(g_screen, s_chunk_matrix);
+		view_x1 = fmax(off_x - copy_x * layer_w, 0);
+		view_y1 = fmax(off_y - copy_y * layer_h, 0);
+		view_x2 = fmin(off_x - copy_x * layer_w + g_res_x, layer_w);
+		view_y2 = fmin(off_y - copy_y * layer_h + g_res_y, layer_h);
+		if (view_x2 <= view_x1 || view_y2 <= view_y1)
+			continue;
+		for (y = view_y1 / chunk_h; y <= (view_y2 - 1) / chunk_h; ++y) for (x = view_x1 / chunk_w; x <= (view_x2 - 1) / chunk_w; ++x) {
+			chunk = &layer_info->chunks[x + y * num_chunks_x];
+			if (!chunk->is_valid)
+				build_chunk(layer, x, y);
+			else if (memcmp(&chunk->mask, &layer_info->color_mask, sizeof(color_t)) != 0)
+				recolor_chunk(layer, x, y);
+			for (i = 0; i < chunk->num_batches; ++i) {
+				batch = &chunk->batches[i];
+#ifdef MINISPHERE_USE_VERTEX_BUF
+				if (batch->vbuf != NULL) {
+					al_draw_vertex_buffer(batch->vbuf, image_bitmap(batch->texture), 0, batch->num_vertices, ALLEGRO_PRIM_TRIANGLE_LIST);
+					continue;
+				}
+#endif
+				al_draw_prim(batch->sw_vbuf, NULL, image_bitmap(batch->texture), 0, batch->num_vertices, ALLEGRO_PRIM_TRIANGLE_LIST);
+			}
+		}
+	}
+	screen_transform(g_screen, NULL);
+}
+
+static void
+recolor_chunk(int layer, int chunk_x, int chunk_y)
+{
+	// the layer mask is carried in the vertex colors.  a mask change, e.g. during
+	// a fade, only rewrites the colors of the vertices already built instead of
+	// rebuilding the chunk from the tilemap.
+
+	struct chunk_batch* batch;
+	struct map_chunk*   chunk;
+	ALLEGRO_COLOR       color;
+	struct map_layer*   layer_info;
+#ifdef MINISPHERE_USE_VERTEX_BUF
+	ALLEGRO_VERTEX*     vertices;
+#endif
+
+	int i, j;
+
+	layer_info = &s_map->layers[layer];
+	chunk = &layer_info->chunks[chunk_x + chunk_y * ((layer_info->width + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE)];
+	color = nativecolor(layer_info->color_mask);
+	for (i = 0; i < chunk->num_batches; ++i) {
+		batch = &chunk->batches[i];
+		for (j = 0; j < batch->num_vertices; ++j)
+			batch->sw_vbuf[j].color = color;
+#ifdef MINISPHERE_USE_VERTEX_BUF
+		if (batch->vbuf == NULL)
+			continue;
+		if (vertices = al_lock_vertex_buffer(batch->vbuf, 0, batch->num_vertices, ALLEGRO_LOCK_WRITEONLY)) {
+			memcpy(vertices, batch->sw_vbuf, batch->num_vertices * sizeof(ALLEGRO_VERTEX));
+			al_unlock_vertex_buffer(batch->vbuf);
+		}
+		else {
+			// if the buffer can't be updated, draw from memory from now on
+			al_destroy_vertex_buffer(batch->vbuf);
+			batch->vbuf = NULL;
+		}
+#endif
+	}
+	chunk->mask = layer_info->color_mask;
+}
+
 static void
 update_map_engine(bool is_main_loop)
 {
@@ -1395,25 +2234,32 @@ update_map_engine(bool is_main_loop)
 	int                 last_trigger;
 	int                 last_zone;
 	int                 layer;
+	const int*          changed_tiles;
 	int                 map_w, map_h;
+	int                 num_changed;
 	int                 num_zone_steps;
 	script_t*           script_to_run;
 	int                 script_type;
+	int                 slot;
 	double              start_x[MAX_PLAYERS];
 	double              start_y[MAX_PLAYERS];
 	int                 tile_w, tile_h;
 	struct map_trigger* trigger;
 	double              x, y, px, py;
 	struct map_zone*    zone;
+	vector_t*           zone_hits = NULL;
 
 	int i, j, k;
 	
 	++s_frames;
+	finish_preload(false);
+	preload_next_spriteset();
 	tileset_get_size(s_map->tileset, &tile_w, &tile_h);
 	map_w = s_map->width * tile_w;
 	map_h = s_map->height * tile_h;
 	
-	tileset_update(s_map->tileset);
+	if (num_changed = tileset_update(s_map->tileset, &changed_tiles))
+		invalidate_tiles(changed_tiles, num_changed);
 
 	for (i = 0; i < MAX_PLAYERS; ++i) if (s_players[i].person != NULL)
 		get_person_xy(s_players[i].person, &start_x[i], &start_y[i], false);
@@ -1469,9 +2315,16 @@ update_map_engine(bool is_main_loop)
 		px = abs(x - start_x[k]);
 		py = abs(y - start_y[k]);
 		num_zone_steps = px > py ? px : py;
-		for (i = 0; i < num_zone_steps; ++i) {
-			j = 0;
-			while (zone = get_zone_at(x, y, layer, j++, &index)) {
+		if (num_zone_steps > 0 && zone_hits == NULL)
+			zone_hits = vector_new(sizeof(int));
+		for (i = 0; zone_hits != NULL && i < num_zone_steps; ++i) {
+			// zone scripts may add or remove zones, so query again on each step
+			get_zones_at(x, y, layer, zone_hits);
+			for (j = 0; j < (int)vector_len(zone_hits); ++j) {
+				index = *(int*)vector_get(zone_hits, j);
+				if (index >= (int)vector_len(s_map->zones))
+					continue;
+				zone = vector_get(s_map->zones, index);
 				if (zone->steps_left-- <= 0) {
 					last_zone = s_current_zone;
 					s_current_zone = index;
@@ -1482,18 +2335,16 @@ update_map_engine(bool is_main_loop)
 			}
 		}
 	}
+	vector_free(zone_hits);
 	
 	// check if there are any delay scripts due to run this frame
-	// and run the ones that are
-	for (i = 0; i < s_num_delay_scripts; ++i) {
-		if (s_delay_scripts[i].frames_left-- <= 0) {
-			script_to_run = s_delay_scripts[i].script;
-			for (j = i; j < s_num_delay_scripts - 1; ++j)
-				s_delay_scripts[j] = s_delay_scripts[j + 1];
-			--s_num_delay_scripts; --i;
-			run_script(script_to_run, false);
-			free_script(script_to_run);
-		}
+	// and run the ones that are.  the heap keeps the next one due at the top, so
+	// we can stop as soon as we find one that isn't.
+	++s_delay_frame;
+	while ((slot = get_due_delay_script()) >= 0) {
+		script_to_run = take_delay_script(slot);
+		run_script(script_to_run, false);
+		free_script(script_to_run);
 	}
 	
 	// now that everything else is in order, we can run the
@@ -1521,6 +2372,7 @@ init_map_engine_api(duk_context* ctx)
 	api_register_method(ctx, NULL, "GetInputPerson", js_GetInputPerson);
 	api_register_method(ctx, NULL, "GetLayerHeight", js_GetLayerHeight);
 	api_register_method(ctx, NULL, "GetLayerMask", js_GetLayerMask);
+	api_register_method(ctx, NULL, "GetLayerTiles", js_GetLayerTiles);
 	api_register_method(ctx, NULL, "GetLayerWidth", js_GetLayerWidth);
 	api_register_method(ctx, NULL, "GetMapEngineFrameRate", js_GetMapEngineFrameRate);
 	api_register_method(ctx, NULL, "GetNextAnimatedTile", js_GetNextAnimatedTile);
@@ -1555,6 +2407,7 @@ init_map_engine_api(duk_context* ctx)
 	api_register_method(ctx, NULL, "SetLayerReflective", js_SetLayerReflective);
 	api_register_method(ctx, NULL, "SetLayerRenderer", js_SetLayerRenderer);
 	api_register_method(ctx, NULL, "SetLayerSize", js_SetLayerSize);
+	api_register_method(ctx, NULL, "SetLayerTiles", js_SetLayerTiles);
 	api_register_method(ctx, NULL, "SetLayerVisible", js_SetLayerVisible);
 	api_register_method(ctx, NULL, "SetLayerWidth", js_SetLayerWidth);
 	api_register_method(ctx, NULL, "SetMapEngineFrameRate", js_SetMapEngineFrameRate);
@@ -1580,6 +2433,7 @@ init_map_engine_api(duk_context* ctx)
 	api_register_method(ctx, NULL, "AttachCamera", js_AttachCamera);
 	api_register_method(ctx, NULL, "AttachInput", js_AttachInput);
 	api_register_method(ctx, NULL, "AttachPlayerInput", js_AttachPlayerInput);
+	api_register_method(ctx, NULL, "CancelDelayScript", js_CancelDelayScript);
 	api_register_method(ctx, NULL, "CallDefaultMapScript", js_CallDefaultMapScript);
 	api_register_method(ctx, NULL, "CallMapScript", js_CallMapScript);
 	api_register_method(ctx, NULL, "ChangeMap", js_ChangeMap);
@@ -1591,6 +2445,7 @@ init_map_engine_api(duk_context* ctx)
 	api_register_method(ctx, NULL, "ExitMapEngine", js_ExitMapEngine);
 	api_register_method(ctx, NULL, "MapToScreenX", js_MapToScreenX);
 	api_register_method(ctx, NULL, "MapToScreenY", js_MapToScreenY);
+	api_register_method(ctx, NULL, "PreloadMap", js_PreloadMap);
 	api_register_method(ctx, NULL, "RemoveTrigger", js_RemoveTrigger);
 	api_register_method(ctx, NULL, "RemoveZone", js_RemoveZone);
 	api_register_method(ctx, NULL, "RenderMap", js_RenderMap);
@@ -1649,6 +2504,7 @@ js_MapEngine(duk_context* ctx)
 	s_color_mask = color_new(0, 0, 0, 0);
 	s_fade_color_to = s_fade_color_from = s_color_mask;
 	s_fade_progress = s_fade_frames = 0;
+	screen_flush(g_screen);
 	al_clear_to_color(al_map_rgba(0, 0, 0, 255));
 	s_framerate = framerate;
 	if (!change_map(filename, true))
@@ -1870,6 +2726,40 @@ js_GetLayerName(duk_context* ctx)
 	return 1;
 }
 
+static duk_ret_t
+js_GetLayerTiles(duk_context* ctx)
+{
+	// returns a Uint16Array holding a rectangle of tile indices in row-major
+	// order; by default the entire layer.  empty tiles are read back as 65535.
+	
+	int n_args = duk_get_top(ctx);
+	int layer = duk_require_map_layer(ctx, 0);
+	int x = n_args >= 5 ? duk_require_int(ctx, 1) : 0;
+	int y = n_args >= 5 ? duk_require_int(ctx, 2) : 0;
+	int width = n_args >= 5 ? duk_require_int(ctx, 3) : 0;
+	int height = n_args >= 5 ? duk_require_int(ctx, 4) : 0;
+
+	size_t    num_bytes;
+	uint16_t* tile_data;
+	
+	if (!is_map_engine_running())
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "GetLayerTiles(): map engine not running");
+	if (n_args < 5) {
+		width = s_map->layers[layer].width;
+		height = s_map->layers[layer].height;
+	}
+	if (x < 0 || y < 0 || width < 0 || height < 0
+		|| x + width > s_map->layers[layer].width || y + height > s_map->layers[layer].height)
+	{
+		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "GetLayerTiles(): area is outside of layer");
+	}
+	num_bytes = (size_t)width * height * sizeof(uint16_t);
+	tile_data = duk_push_fixed_buffer(ctx, num_bytes);
+	tilemap_get_rect(s_map->layers[layer].tilemap, x, y, width, height, tile_data);
+	duk_push_buffer_object(ctx, -1, 0, num_bytes, DUK_BUFOBJ_UINT16ARRAY);
+	return 1;
+}
+
 static duk_ret_t
 js_GetLayerWidth(duk_context* ctx)
 {
@@ -1963,15 +2853,15 @@ js_GetTile(duk_context* ctx)
 	int y = duk_require_int(ctx, 1);
 	int layer = duk_require_map_layer(ctx, 2);
 
-	int              layer_w, layer_h;
-	struct map_tile* tilemap;
+	int layer_w, layer_h;
 
 	if (!is_map_engine_running())
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "GetTile(): map engine not running");
 	layer_w = s_map->layers[layer].width;
 	layer_h = s_map->layers[layer].height;
-	tilemap = s_map->layers[layer].tilemap;
-	duk_push_int(ctx, tilemap[x + y * layer_w].tile_index);
+	if (x < 0 || y < 0 || x >= layer_w || y >= layer_h)
+		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "GetTile(): X/Y out of bounds (%d,%d)", x, y);
+	duk_push_int(ctx, tilemap_get(s_map->layers[layer].tilemap, x, y));
 	return 1;
 }
 
@@ -2270,20 +3160,23 @@ js_SetDelayScript(duk_context* ctx)
 	script_t* script = duk_require_sphere_script(ctx, 1, "[delay script]");
 
 	struct delay_script* delay;
+	int                  slot;
 
-	if (!is_map_engine_running())
+	if (!is_map_engine_running()) {
+		free_script(script);
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetDelayScript(): map engine not running");
-	if (frames < 0)
+	}
+	if (frames < 0) {
+		free_script(script);
 		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetDelayScript(): frames must be positive");
-	if (++s_num_delay_scripts > s_max_delay_scripts) {
-		s_max_delay_scripts = s_num_delay_scripts * 2;
-		if (!(s_delay_scripts = realloc(s_delay_scripts, s_max_delay_scripts * sizeof(struct delay_script))))
-			duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetDelayScript(): unable to enlarge delay script queue");
 	}
-	delay = &s_delay_scripts[s_num_delay_scripts - 1];
-	delay->script = script;
-	delay->frames_left = frames;
-	return 0;
+	if ((slot = add_delay_script(script, frames)) < 0) {
+		free_script(script);
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetDelayScript(): unable to enlarge delay script queue");
+	}
+	delay = vector_get(s_delay_slots, slot);
+	duk_push_uint(ctx, (delay->generation << 16) | (unsigned int)slot);
+	return 1;
 }
 
 static duk_ret_t
@@ -2365,6 +3258,48 @@ js_SetLayerSize(duk_context* ctx)
 	return 0;
 }
 
+static duk_ret_t
+js_SetLayerTiles(duk_context* ctx)
+{
+	// takes any buffer holding width x height tile indices in row-major order,
+	// typically a Uint16Array.  65535 clears a tile.
+	
+	int layer = duk_require_map_layer(ctx, 0);
+	int x = duk_require_int(ctx, 1);
+	int y = duk_require_int(ctx, 2);
+	int width = duk_require_int(ctx, 3);
+	int height = duk_require_int(ctx, 4);
+
+	size_t          num_bytes;
+	int             num_tiles;
+	const uint16_t* tile_data;
+
+	int i;
+	int i_x, i_y;
+
+	tile_data = duk_require_buffer_data(ctx, 5, &num_bytes);
+	if (!is_map_engine_running())
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetLayerTiles(): map engine not running");
+	if (x < 0 || y < 0 || width < 0 || height < 0
+		|| x + width > s_map->layers[layer].width || y + height > s_map->layers[layer].height)
+	{
+		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetLayerTiles(): area is outside of layer");
+	}
+	if (num_bytes != (size_t)width * height * sizeof(uint16_t))
+		duk_error_ni(ctx, -1, DUK_ERR_TYPE_ERROR, "SetLayerTiles(): buffer size doesn't match area (%d bytes)", (int)num_bytes);
+	num_tiles = tileset_len(s_map->tileset);
+	for (i = 0; i < width * height; ++i) {
+		if (tile_data[i] != TILEMAP_NO_TILE && tile_data[i] >= num_tiles)
+			duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetLayerTiles(): invalid tile index (%d)", (int)tile_data[i]);
+	}
+	if (!tilemap_set_rect(s_map->layers[layer].tilemap, x, y, width, height, tile_data))
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetLayerTiles(): unable to allocate tile storage");
+	for (i_y = y - y % MAP_CHUNK_SIZE; i_y < y + height; i_y += MAP_CHUNK_SIZE)
+	for (i_x = x - x % MAP_CHUNK_SIZE; i_x < x + width; i_x += MAP_CHUNK_SIZE)
+		invalidate_chunk(layer, i_x, i_y);
+	return 0;
+}
+
 static duk_ret_t
 js_SetLayerVisible(duk_context* ctx)
 {
@@ -2458,16 +3393,19 @@ js_SetTile(duk_context* ctx)
 	int layer = duk_require_map_layer(ctx, 2);
 	int tile_index = duk_require_int(ctx, 3);
 
-	int              layer_w, layer_h;
-	struct map_tile* tilemap;
+	int layer_w, layer_h;
 
 	if (!is_map_engine_running())
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetTile(): map engine not running");
 	layer_w = s_map->layers[layer].width;
 	layer_h = s_map->layers[layer].height;
-	tilemap = s_map->layers[layer].tilemap;
-	tilemap[x + y * layer_w].tile_index = tile_index;
-	tilemap[x + y * layer_w].frames_left = tileset_get_delay(s_map->tileset, tile_index);
+	if (x < 0 || y < 0 || x >= layer_w || y >= layer_h)
+		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetTile(): X/Y out of bounds (%d,%d)", x, y);
+	if (tile_index < -1 || tile_index >= tileset_len(s_map->tileset))
+		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetTile(): invalid tile index (%d)", tile_index);
+	if (!tilemap_set(s_map->layers[layer].tilemap, x, y, tile_index))
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetTile(): unable to allocate tile storage");
+	invalidate_chunk(layer, x, y);
 	return 0;
 }
 
@@ -2798,6 +3736,28 @@ js_AttachPlayerInput(duk_context* ctx)
 	return 0;
 }
 
+static duk_ret_t
+js_CancelDelayScript(duk_context* ctx)
+{
+	duk_uint_t handle = duk_require_uint(ctx, 0);
+
+	struct delay_script* delay;
+	unsigned int         generation;
+	int                  slot;
+
+	// a stale handle just means the script already ran or was cancelled, so
+	// that's not treated as an error.
+	slot = (int)(handle & 0xFFFF);
+	generation = handle >> 16;
+	if (slot >= (int)vector_len(s_delay_slots))
+		return 0;
+	delay = vector_get(s_delay_slots, slot);
+	if (delay->generation != generation || delay->script == NULL)
+		return 0;
+	free_script(take_delay_script(slot));
+	return 0;
+}
+
 static duk_ret_t
 js_CallDefaultMapScript(duk_context* ctx)
 {
@@ -2940,18 +3900,26 @@ js_ExecuteZones(duk_context* ctx)
 	int              index;
 	int              last_zone;
 	struct map_zone* zone;
+	vector_t*        zone_hits;
 
 	int i;
 
 	if (!is_map_engine_running())
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "ExecuteZones(): map engine not running");
-	i = 0;
-	while (zone = get_zone_at(x, y, layer, i++, &index)) {
+	if (!(zone_hits = vector_new(sizeof(int))))
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "ExecuteZones(): unable to allocate zone list");
+	get_zones_at(x, y, layer, zone_hits);
+	for (i = 0; i < (int)vector_len(zone_hits); ++i) {
+		index = *(int*)vector_get(zone_hits, i);
+		if (index >= (int)vector_len(s_map->zones))
+			continue;
+		zone = vector_get(s_map->zones, index);
 		last_zone = s_current_zone;
 		s_current_zone = index;
 		run_script(zone->script, true);
 		s_current_zone = last_zone;
 	}
+	vector_free(zone_hits);
 	return 0;
 }
 
@@ -2996,6 +3964,17 @@ js_MapToScreenY(duk_context* ctx)
 	return 1;
 }
 
+static duk_ret_t
+js_PreloadMap(duk_context* ctx)
+{
+	const char* filename;
+
+	filename = duk_require_path(ctx, 0, "maps", true);
+	if (!preload_map(filename))
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "PreloadMap(): unable to load map file `%s`", filename);
+	return 0;
+}
+
 static duk_ret_t
 js_RenderMap(duk_context* ctx)
 {
@@ -3012,10 +3991,12 @@ js_ReplaceTilesOnLayer(duk_context* ctx)
 	int old_index = duk_require_int(ctx, 1);
 	int new_index = duk_require_int(ctx, 2);
 
-	int              layer_w, layer_h;
-	struct map_tile* p_tile;
+	iter_t    iter;
+	int       layer_w, layer_h;
+	rect_t*   rect;
+	vector_t* rects;
 
-	int i_x, i_y;
+	int x, y;
 
 	if (!is_map_engine_running())
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "ReplaceTilesOnLayer(): map engine not running");
@@ -3023,12 +4004,27 @@ js_ReplaceTilesOnLayer(duk_context* ctx)
 		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "ReplaceTilesOnLayer(): old invalid tile index (%d)", old_index);
 	if (new_index < 0 || new_index >= tileset_len(s_map->tileset))
 		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "ReplaceTilesOnLayer(): new invalid tile index (%d)", new_index);
-	layer_w = s_map->layers[layer].width;
-	layer_h = s_map->layers[layer].height;
-	for (i_x = 0; i_x < layer_w; ++i_x) for (i_y = 0; i_y < layer_h; ++i_y) {
-		p_tile = &s_map->layers[layer].tilemap[i_x + i_y * layer_w];
-		if (p_tile->tile_index == old_index) p_tile->tile_index = new_index;
+	
+	// only the chunks holding a replaced tile need to be rebuilt.  if there's no
+	// memory to keep track of which ones those are, just rebuild the whole layer.
+	rects = vector_new(sizeof(rect_t));
+	if (tilemap_replace(s_map->layers[layer].tilemap, old_index, new_index, rects) > 0) {
+		if (rects != NULL && vector_len(rects) > 0) {
+			iter = vector_enum(rects);
+			while (rect = vector_next(&iter)) {
+				for (y = rect->y1 - rect->y1 % MAP_CHUNK_SIZE; y < rect->y2; y += MAP_CHUNK_SIZE)
+				for (x = rect->x1 - rect->x1 % MAP_CHUNK_SIZE; x < rect->x2; x += MAP_CHUNK_SIZE)
+					invalidate_chunk(layer, x, y);
+			}
+		}
+		else {
+			layer_w = s_map->layers[layer].width;
+			layer_h = s_map->layers[layer].height;
+			for (y = 0; y < layer_h; y += MAP_CHUNK_SIZE) for (x = 0; x < layer_w; x += MAP_CHUNK_SIZE)
+				invalidate_chunk(layer, x, y);
+		}
 	}
+	vector_free(rects);
 	return 0;
 }
 
@@ -1,28 +1,65 @@
 #include "minisphere.h"
 #include "obsmap.h"
 
+#include "spatial.h"
+#include "vector.h"
+
+// obstruction maps with fewer lines than this are just scanned linearly; for
+// the handful of segments in a typical tile, building a grid isn't worth it.
+#define MIN_GRID_LINES 32
+#define GRID_CELL_SIZE 64
+
 struct obsmap
 {
 	unsigned int id;
+	rect_t       bounds;
+	spatial_t*   grid;
+	vector_t*    grid_hits;
+	bool         is_grid_valid;
 	int          num_lines;
 	int          max_lines;
 	rect_t       *lines;
 };
 
-static unsigned int s_next_obsmap_id = 0;
+static bool build_grid (obsmap_t* obsmap);
+
+static ALLEGRO_MUTEX* s_id_mutex = NULL;
+static unsigned int   s_next_obsmap_id = 0;
+
+void
+initialize_obsmaps(void)
+{
+	// obstruction maps are also created while maps are read in on the preload
+	// thread, so handing out IDs needs a lock.
+
+	console_log(1, "initializing obstruction map manager");
+	s_id_mutex = al_create_mutex();
+}
+
+void
+shutdown_obsmaps(void)
+{
+	console_log(1, "shutting down obstruction map manager");
+	console_log(2, "    objects created: %u", s_next_obsmap_id);
+	if (s_id_mutex != NULL)
+		al_destroy_mutex(s_id_mutex);
+	s_id_mutex = NULL;
+}
 
 obsmap_t*
 obsmap_new(void)
 {
 	obsmap_t* obsmap = NULL;
 
-	console_log(4, "creating new obstruction map #%u", s_next_obsmap_id);
-	
-	obsmap = calloc(1, sizeof(obsmap_t));
+	if (!(obsmap = calloc(1, sizeof(obsmap_t))))
+		return NULL;
 	obsmap->max_lines = 0;
 	obsmap->num_lines = 0;
 
+	al_lock_mutex(s_id_mutex);
 	obsmap->id = s_next_obsmap_id++;
+	al_unlock_mutex(s_id_mutex);
+	console_log(4, "creating new obstruction map #%u", obsmap->id);
 	return obsmap;
 }
 
@@ -32,6 +69,8 @@ obsmap_free(obsmap_t* obsmap)
 	if (obsmap == NULL)
 		return;
 	console_log(4, "disposing obstruction map #%u no longer in use", obsmap->id);
+	spatial_free(obsmap->grid);
+	vector_free(obsmap->grid_hits);
 	free(obsmap->lines);
 	free(obsmap);
 }
@@ -39,6 +78,7 @@ obsmap_free(obsmap_t* obsmap)
 bool
 obsmap_add_line(obsmap_t* obsmap, rect_t line)
 {
+	rect_t extents;
 	int    new_size;
 	rect_t *line_list;
 	
@@ -53,17 +93,55 @@ obsmap_add_line(obsmap_t* obsmap, rect_t line)
 		obsmap->lines = line_list;
 	}
 	obsmap->lines[obsmap->num_lines] = line;
+	extents = line;
+	normalize_rect(&extents);
+	if (obsmap->num_lines > 0) {
+		obsmap->bounds.x1 = fmin(obsmap->bounds.x1, extents.x1);
+		obsmap->bounds.y1 = fmin(obsmap->bounds.y1, extents.y1);
+		obsmap->bounds.x2 = fmax(obsmap->bounds.x2, extents.x2);
+		obsmap->bounds.y2 = fmax(obsmap->bounds.y2, extents.y2);
+	}
+	else {
+		obsmap->bounds = extents;
+	}
 	++obsmap->num_lines;
+	obsmap->is_grid_valid = false;
 	return true;
 }
 
 bool
 obsmap_test_line(const obsmap_t* obsmap, rect_t line)
 {
-	int i;
+	rect_t extents;
+	int*   p_index;
 
-	for (i = 0; i < obsmap->num_lines; ++i) {
-		if (do_lines_intersect(line, obsmap->lines[i]))
+	iter_t iter;
+	int    i;
+
+	extents = line;
+	normalize_rect(&extents);
+	if (obsmap->num_lines == 0
+		|| extents.x2 < obsmap->bounds.x1 || extents.x1 > obsmap->bounds.x2
+		|| extents.y2 < obsmap->bounds.y1 || extents.y1 > obsmap->bounds.y2)
+	{
+		return false;
+	}
+
+	// the grid is built on demand the first time the obstruction map is tested
+	// after a line is added.  it's only a cache, so this doesn't really count
+	// as modifying the obsmap.
+	if (obsmap->num_lines < MIN_GRID_LINES || !build_grid((obsmap_t*)obsmap)) {
+		for (i = 0; i < obsmap->num_lines; ++i) {
+			if (do_lines_intersect(line, obsmap->lines[i]))
+				return true;
+		}
+		return false;
+	}
+	extents = translate_rect(extents, -obsmap->bounds.x1, -obsmap->bounds.y1);
+	spatial_query(obsmap->grid, extents, obsmap->grid_hits);
+	iter = vector_enum(obsmap->grid_hits);
+	while (p_index = vector_next(&iter)) {
+		if (do_lines_intersect(line, obsmap->lines[*p_index]))
 			return true;
 	}
 	return false;
@@ -77,3 +155,42 @@ obsmap_test_rect(const obsmap_t* obsmap, rect_t rect)
 		|| obsmap_test_line(obsmap, new_rect(rect.x1, rect.y2, rect.x2, rect.y2))
 		|| obsmap_test_line(obsmap, new_rect(rect.x1, rect.y1, rect.x1, rect.y2));
 }
+
+static bool
+build_grid(obsmap_t* obsmap)
+{
+	// the grid covers only the area spanned by the line segments, with its
+	// origin at the top left of that area.
+
+	rect_t extents;
+	int    width, height;
+
+	int i;
+
+	if (obsmap->is_grid_valid)
+		return true;
+	console_log(4, "indexing %d line segments in obstruction map #%u",
+		obsmap->num_lines, obsmap->id);
+	spatial_free(obsmap->grid);
+	obsmap->grid = NULL;
+	width = obsmap->bounds.x2 - obsmap->bounds.x1 + 1;
+	height = obsmap->bounds.y2 - obsmap->bounds.y1 + 1;
+	if (obsmap->grid_hits == NULL && !(obsmap->grid_hits = vector_new(sizeof(int))))
+		return false;
+	if (!(obsmap->grid = spatial_new(width, height, GRID_CELL_SIZE)))
+		return false;
+	for (i = 0; i < obsmap->num_lines; ++i) {
+		extents = obsmap->lines[i];
+		normalize_rect(&extents);
+		extents = translate_rect(extents, -obsmap->bounds.x1, -obsmap->bounds.y1);
+		if (!spatial_add(obsmap->grid, i, extents))
+			goto on_error;
+	}
+	obsmap->is_grid_valid = true;
+	return true;
+
+on_error:
+	spatial_free(obsmap->grid);
+	obsmap->grid = NULL;
+	return false;
+}
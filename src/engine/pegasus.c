@@ -289,10 +289,14 @@ static duk_ret_t js_Shape_finalize             (duk_context* ctx);
 static duk_ret_t js_Shape_get_texture          (duk_context* ctx);
 static duk_ret_t js_Shape_set_texture          (duk_context* ctx);
 static duk_ret_t js_Shape_draw                 (duk_context* ctx);
+static duk_ret_t js_Shape_drawInstanced        (duk_context* ctx);
+static duk_ret_t js_Shape_setVertices          (duk_context* ctx);
 static duk_ret_t js_new_ShapeGroup             (duk_context* ctx);
 static duk_ret_t js_ShapeGroup_finalize        (duk_context* ctx);
+static duk_ret_t js_ShapeGroup_get_batched     (duk_context* ctx);
 static duk_ret_t js_ShapeGroup_get_shader      (duk_context* ctx);
 static duk_ret_t js_ShapeGroup_get_transform   (duk_context* ctx);
+static duk_ret_t js_ShapeGroup_set_batched     (duk_context* ctx);
 static duk_ret_t js_ShapeGroup_set_shader      (duk_context* ctx);
 static duk_ret_t js_ShapeGroup_set_transform   (duk_context* ctx);
 static duk_ret_t js_ShapeGroup_draw            (duk_context* ctx);
@@ -345,11 +349,12 @@ static duk_ret_t js_Transform_rotate           (duk_context* ctx);
 static duk_ret_t js_Transform_scale            (duk_context* ctx);
 static duk_ret_t js_Transform_translate        (duk_context* ctx);
 
-static void    duk_pegasus_push_color    (duk_context* ctx, color_t color);
-static void    duk_pegasus_push_require  (duk_context* ctx, const char* module_id);
-static color_t duk_pegasus_require_color (duk_context* ctx, duk_idx_t index);
-static path_t* find_module               (const char* id, const char* origin, const char* sys_origin);
-static path_t* load_package_json         (const char* filename);
+static void     duk_pegasus_push_color     (duk_context* ctx, color_t color);
+static void     duk_pegasus_push_require   (duk_context* ctx, const char* module_id);
+static color_t  duk_pegasus_require_color  (duk_context* ctx, duk_idx_t index);
+static vertex_t duk_pegasus_require_vertex (duk_context* ctx, duk_idx_t index, bool* out_have_uv);
+static path_t*  find_module                (const char* id, const char* origin, const char* sys_origin);
+static path_t*  load_package_json          (const char* filename);
 
 static mixer_t* s_def_mixer;
 static int      s_framerate = 60;
@@ -431,6 +436,7 @@ initialize_pegasus_api(duk_context* ctx)
 	api_register_method(ctx, "RNG", "next", js_RNG_next);
 
 	api_register_ctor(ctx, "ShapeGroup", js_new_ShapeGroup, js_ShapeGroup_finalize);
+	api_register_prop(ctx, "ShapeGroup", "batched", js_ShapeGroup_get_batched, js_ShapeGroup_set_batched);
 	api_register_prop(ctx, "ShapeGroup", "shader", js_ShapeGroup_get_shader, js_ShapeGroup_set_shader);
 	api_register_prop(ctx, "ShapeGroup", "transform", js_ShapeGroup_get_transform, js_ShapeGroup_set_transform);
 	api_register_method(ctx, "ShapeGroup", "draw", js_ShapeGroup_draw);
@@ -456,6 +462,8 @@ initialize_pegasus_api(duk_context* ctx)
 	api_register_ctor(ctx, "Shape", js_new_Shape, js_Shape_finalize);
 	api_register_prop(ctx, "Shape", "texture", js_Shape_get_texture, js_Shape_set_texture);
 	api_register_method(ctx, "Shape", "draw", js_Shape_draw);
+	api_register_method(ctx, "Shape", "drawInstanced", js_Shape_drawInstanced);
+	api_register_method(ctx, "Shape", "setVertices", js_Shape_setVertices);
 
 	api_register_ctor(ctx, "Socket", js_new_Socket, js_Socket_finalize);
 	api_register_prop(ctx, "Socket", "bytesPending", js_Socket_get_bytesPending, NULL);
@@ -650,6 +658,11 @@ initialize_pegasus_api(duk_context* ctx)
 	api_register_const(ctx, "Key", "Multiply", ALLEGRO_KEY_PAD_ASTERISK);
 	api_register_const(ctx, "Key", "Subtract", ALLEGRO_KEY_PAD_MINUS);
 
+	api_register_const(ctx, "InstanceFormat", "Offset", INSTANCE_OFFSET);
+	api_register_const(ctx, "InstanceFormat", "OffsetColor", INSTANCE_OFFSET_COLOR);
+	api_register_const(ctx, "InstanceFormat", "Matrix", INSTANCE_MATRIX);
+	api_register_const(ctx, "InstanceFormat", "MatrixColor", INSTANCE_MATRIX_COLOR);
+
 	api_register_const(ctx, "MouseKey", "Left", MOUSE_KEY_LEFT);
 	api_register_const(ctx, "MouseKey", "Right", MOUSE_KEY_RIGHT);
 	api_register_const(ctx, "MouseKey", "Middle", MOUSE_KEY_MIDDLE);
@@ -861,6 +874,32 @@ duk_pegasus_require_color(duk_context* ctx, duk_idx_t index)
 	return color_new(r, g, b, a);
 }
 
+static vertex_t
+duk_pegasus_require_vertex(duk_context* ctx, duk_idx_t index, bool* out_have_uv)
+{
+	vertex_t vertex;
+
+	index = duk_require_normalize_index(ctx, index);
+	duk_require_object_coercible(ctx, index);
+	*out_have_uv = true;
+	vertex.x = duk_get_prop_string(ctx, index, "x") ? duk_require_number(ctx, -1) : 0.0;
+	vertex.y = duk_get_prop_string(ctx, index, "y") ? duk_require_number(ctx, -1) : 0.0;
+	vertex.z = duk_get_prop_string(ctx, index, "z") ? duk_require_number(ctx, -1) : 0.0;
+	if (duk_get_prop_string(ctx, index, "u"))
+		vertex.u = duk_require_number(ctx, -1);
+	else
+		*out_have_uv = false;
+	if (duk_get_prop_string(ctx, index, "v"))
+		vertex.v = duk_require_number(ctx, -1);
+	else
+		*out_have_uv = false;
+	vertex.color = duk_get_prop_string(ctx, index, "color")
+		? duk_pegasus_require_color(ctx, -1)
+		: color_new(255, 255, 255, 255);
+	duk_pop_n(ctx, 6);
+	return vertex;
+}
+
 static path_t*
 find_module(const char* id, const char* origin, const char* sys_origin)
 {
@@ -2330,7 +2369,7 @@ js_Font_drawText(duk_context* ctx)
 		return 0;
 	else {
 		if (surface != NULL)
-			al_set_target_bitmap(image_bitmap(surface));
+			screen_set_target(g_screen, image_bitmap(surface));
 		if (num_args < 6)
 			font_draw_text(font, color, x, y, TEXT_ALIGN_LEFT, text);
 		else {
@@ -2341,7 +2380,7 @@ js_Font_drawText(duk_context* ctx)
 			wraptext_free(wraptext);
 		}
 		if (surface != NULL)
-			al_set_target_backbuffer(screen_display(g_screen));
+			screen_set_target(g_screen, NULL);
 	}
 	return 0;
 }
@@ -2800,11 +2839,13 @@ js_Shader_finalize(duk_context* ctx)
 static duk_ret_t
 js_new_Shape(duk_context* ctx)
 {
+	bool         have_uv;
+	int          index;
 	bool         is_missing_uv = false;
 	int          num_args;
+	size_t       num_indices;
 	size_t       num_vertices;
 	shape_t*     shape;
-	duk_idx_t    stack_idx;
 	image_t*     texture;
 	shape_type_t type;
 	vertex_t     vertex;
@@ -2825,24 +2866,24 @@ js_new_Shape(duk_context* ctx)
 	num_vertices = duk_get_length(ctx, 0);
 	for (i = 0; i < num_vertices; ++i) {
 		duk_get_prop_index(ctx, 0, i);
-		stack_idx = duk_normalize_index(ctx, -1);
-		vertex.x = duk_get_prop_string(ctx, stack_idx, "x") ? duk_require_number(ctx, -1) : 0.0;
-		vertex.y = duk_get_prop_string(ctx, stack_idx, "y") ? duk_require_number(ctx, -1) : 0.0;
-		vertex.z = duk_get_prop_string(ctx, stack_idx, "z") ? duk_require_number(ctx, -1) : 0.0;
-		if (duk_get_prop_string(ctx, stack_idx, "u"))
-			vertex.u = duk_require_number(ctx, -1);
-		else
-			is_missing_uv = true;
-		if (duk_get_prop_string(ctx, stack_idx, "v"))
-			vertex.v = duk_require_number(ctx, -1);
-		else
-			is_missing_uv = true;
-		vertex.color = duk_get_prop_string(ctx, stack_idx, "color")
-			? duk_pegasus_require_color(ctx, -1)
-			: color_new(255, 255, 255, 255);
-		duk_pop_n(ctx, 7);
+		vertex = duk_pegasus_require_vertex(ctx, -1, &have_uv);
+		is_missing_uv |= !have_uv;
+		duk_pop(ctx);
 		shape_add_vertex(shape, vertex);
 	}
+	if (num_args >= 4 && !duk_is_null_or_undefined(ctx, 3)) {
+		if (!duk_is_array(ctx, 3))
+			duk_error_ni(ctx, -1, DUK_ERR_TYPE_ERROR, "index list must be an array");
+		num_indices = duk_get_length(ctx, 3);
+		for (i = 0; i < num_indices; ++i) {
+			duk_get_prop_index(ctx, 3, i);
+			index = duk_require_int(ctx, -1);
+			duk_pop(ctx);
+			if (index < 0 || index >= (int)num_vertices)
+				duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "vertex index out of range (%d)", index);
+			shape_add_index(shape, index);
+		}
+	}
 	if (is_missing_uv)
 		shape_calculate_uv(shape);
 	shape_upload(shape);
@@ -2908,6 +2949,109 @@ js_Shape_draw(duk_context* ctx)
 	return 0;
 }
 
+static duk_ret_t
+js_Shape_drawInstanced(duk_context* ctx)
+{
+	// Shape:drawInstanced(instances[, surface[, format]]);
+	// Draws many copies of a shape in one pass.
+	// Arguments:
+	//     instances: A Float32Array (or array of numbers) containing the packed
+	//                per-instance records, laid out according to `format`.
+	//     surface:   Optional. The Surface to draw on. If this is null or not
+	//                provided, the shape is drawn to the backbuffer.
+	//     format:    Optional. An InstanceFormat constant describing the layout
+	//                of each record. Defaults to InstanceFormat.Offset.
+
+	duk_size_t        buffer_size;
+	instance_format_t format;
+	float*            instances = NULL;
+	bool              is_float_array;
+	int               num_args;
+	size_t            num_floats;
+	int               num_instances;
+	shape_t*          shape;
+	int               stride;
+	image_t*          surface = NULL;
+
+	duk_uarridx_t i;
+
+	num_args = duk_get_top(ctx);
+	duk_push_this(ctx);
+	shape = duk_require_sphere_obj(ctx, -1, "Shape");
+	if (num_args >= 2 && !duk_is_null_or_undefined(ctx, 1))
+		surface = duk_require_sphere_obj(ctx, 1, "Surface");
+	format = num_args >= 3 ? duk_require_int(ctx, 2) : INSTANCE_OFFSET;
+
+	if (format < 0 || format >= INSTANCE_MAX)
+		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "invalid InstanceFormat constant");
+	
+	// the instance data is read as floats in place, so only a Float32Array will
+	// do; any other view could be misaligned or hold some other element type.
+	duk_get_global_string(ctx, "Float32Array");
+	is_float_array = duk_is_object(ctx, 0) && duk_instanceof(ctx, 0, -1);
+	duk_pop(ctx);
+	if (is_float_array) {
+		instances = duk_get_buffer_data(ctx, 0, &buffer_size);
+		num_floats = buffer_size / sizeof(float);
+	}
+	else if (duk_is_array(ctx, 0)) {
+		num_floats = duk_get_length(ctx, 0);
+		instances = duk_push_fixed_buffer(ctx, num_floats * sizeof(float));
+		for (i = 0; i < num_floats; ++i) {
+			duk_get_prop_index(ctx, 0, i);
+			instances[i] = duk_require_number(ctx, -1);
+			duk_pop(ctx);
+		}
+	}
+	else
+		duk_error_ni(ctx, -1, DUK_ERR_TYPE_ERROR, "instance data must be a Float32Array or array");
+	stride = instance_format_len(format);
+	if (num_floats % stride != 0)
+		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "instance data length must be a multiple of %d", stride);
+	num_instances = (int)(num_floats / stride);
+
+	if (num_instances > 0 && !screen_is_skipframe(g_screen))
+		shape_draw_instanced(shape, instances, num_instances, format, surface);
+	return 0;
+}
+
+static duk_ret_t
+js_Shape_setVertices(duk_context* ctx)
+{
+	bool      have_uv;
+	int       num_vertices;
+	shape_t*  shape;
+	int       start;
+	vertex_t  vertex;
+
+	duk_uarridx_t i;
+
+	duk_push_this(ctx);
+	shape = duk_require_sphere_obj(ctx, -1, "Shape");
+	start = duk_require_int(ctx, 0);
+	duk_require_object_coercible(ctx, 1);
+
+	if (!duk_is_array(ctx, 1))
+		duk_error_ni(ctx, -1, DUK_ERR_TYPE_ERROR, "second argument must be an array");
+	num_vertices = (int)duk_get_length(ctx, 1);
+	if (start < 0 || start + num_vertices > shape_num_vertices(shape))
+		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "vertex range out of bounds");
+	for (i = 0; i < (duk_uarridx_t)num_vertices; ++i) {
+		duk_get_prop_index(ctx, 1, i);
+		vertex = duk_pegasus_require_vertex(ctx, -1, &have_uv);
+		if (!have_uv) {
+			// vertices being updated keep their current texture coordinates unless
+			// new ones are provided.
+			vertex.u = shape_get_vertex(shape, start + i).u;
+			vertex.v = shape_get_vertex(shape, start + i).v;
+		}
+		duk_pop(ctx);
+		shape_set_vertex(shape, start + i, vertex);
+	}
+	shape_upload(shape);
+	return 0;
+}
+
 static duk_ret_t
 js_new_ShapeGroup(duk_context* ctx)
 {
@@ -2949,6 +3093,18 @@ js_ShapeGroup_finalize(duk_context* ctx)
 	return 0;
 }
 
+static duk_ret_t
+js_ShapeGroup_get_batched(duk_context* ctx)
+{
+	group_t* group;
+
+	duk_push_this(ctx);
+	group = duk_require_sphere_obj(ctx, -1, "ShapeGroup");
+
+	duk_push_boolean(ctx, group_get_batched(group));
+	return 1;
+}
+
 static duk_ret_t
 js_ShapeGroup_get_shader(duk_context* ctx)
 {
@@ -2977,6 +3133,20 @@ js_ShapeGroup_get_transform(duk_context* ctx)
 	return 1;
 }
 
+static duk_ret_t
+js_ShapeGroup_set_batched(duk_context* ctx)
+{
+	bool     batched;
+	group_t* group;
+
+	duk_push_this(ctx);
+	group = duk_require_sphere_obj(ctx, -1, "ShapeGroup");
+	batched = duk_require_boolean(ctx, 0);
+
+	group_set_batched(group, batched);
+	return 0;
+}
+
 static duk_ret_t
 js_ShapeGroup_set_shader(duk_context* ctx)
 {
@@ -7,21 +7,50 @@
 #include "obsmap.h"
 #include "spriteset.h"
 #include "vanilla.h"
+#include "vector.h"
+
+// person bases are kept in a spatial hash so that collision checks and proximity
+// queries only need to look at persons in the immediate area.  the hash covers an
+// unbounded plane: cells are hashed by layer and position into a fixed number of
+// buckets, and the few persons spanning too many cells are kept on a side list.
+#define HASH_CELL_SIZE   64
+#define MAX_HASH_CELLS   64
+#define MAX_SEARCH_RINGS 8
+#define NUM_HASH_BUCKETS 1024
+#define NUM_NAME_BUCKETS 256
+
+// a handle identifies a person by slot and generation.  each time a person is
+// freed the generation of its slot is bumped, so checking whether a handle is
+// still good is a single lookup, even if the memory has since been reused.
+struct handle
+{
+	int          slot;
+	unsigned int generation;
+};
 
 struct person
 {
 	unsigned int    id;
 	char*           name;
 	int             anim_frames;
-	char*           direction;
+	double          depth;
+	int             direction;
 	int             follow_distance;
+	vector_t*       followers;
 	int             frame;
+	struct handle   handle;
+	rect_t          hash_cells;
+	int             hash_layer;
 	bool            ignore_all_persons;
 	bool            ignore_all_tiles;
+	bool            is_depth_valid;
+	bool            is_hashed;
+	bool            is_large;
 	bool            is_persistent;
 	bool            is_visible;
 	int             layer;
 	person_t*       leader;
+	int             list_index;
 	color_t         mask;
 	int             mv_x, mv_y;
 	int             revert_delay;
@@ -34,10 +63,14 @@ struct person
 	double          theta;
 	double          x, y;
 	int             x_offset, y_offset;
+	int             first_command;
+	int             first_step;
 	int             max_commands;
 	int             max_history;
+	person_t*       next_by_name;
 	int             num_commands;
 	int             num_ignores;
+	unsigned int    query_stamp;
 	struct command  *commands;
 	char*           *ignores;
 	struct step     *steps;
@@ -55,6 +88,20 @@ struct command
 	script_t* script;
 };
 
+struct person_slot
+{
+	unsigned int generation;
+	person_t*    person;
+};
+
+struct visible_person
+{
+	person_t* person;
+	double    x, y;
+	int       first_copy_x, last_copy_x;
+	int       first_copy_y, last_copy_y;
+};
+
 static duk_ret_t js_CreatePerson                 (duk_context* ctx);
 static duk_ret_t js_DestroyPerson                (duk_context* ctx);
 static duk_ret_t js_IsCommandQueueEmpty          (duk_context* ctx);
@@ -67,6 +114,7 @@ static duk_ret_t js_GetActingPerson              (duk_context* ctx);
 static duk_ret_t js_GetCurrentPerson             (duk_context* ctx);
 static duk_ret_t js_GetObstructingPerson         (duk_context* ctx);
 static duk_ret_t js_GetObstructingTile           (duk_context* ctx);
+static duk_ret_t js_GetNearestPerson             (duk_context* ctx);
 static duk_ret_t js_GetPersonAngle               (duk_context* ctx);
 static duk_ret_t js_GetPersonBase                (duk_context* ctx);
 static duk_ret_t js_GetPersonData                (duk_context* ctx);
@@ -80,6 +128,7 @@ static duk_ret_t js_GetPersonIgnoreList          (duk_context* ctx);
 static duk_ret_t js_GetPersonLayer               (duk_context* ctx);
 static duk_ret_t js_GetPersonLeader              (duk_context* ctx);
 static duk_ret_t js_GetPersonList                (duk_context* ctx);
+static duk_ret_t js_GetPersonListInRect          (duk_context* ctx);
 static duk_ret_t js_GetPersonMask                (duk_context* ctx);
 static duk_ret_t js_GetPersonOffsetX             (duk_context* ctx);
 static duk_ret_t js_GetPersonOffsetY             (duk_context* ctx);
@@ -126,17 +175,33 @@ static duk_ret_t js_IgnoreTileObstructions       (duk_context* ctx);
 static duk_ret_t js_QueuePersonCommand           (duk_context* ctx);
 static duk_ret_t js_QueuePersonScript            (duk_context* ctx);
 
-static bool does_person_exist    (const person_t* person);
-static void set_person_direction (person_t* person, const char* direction);
-static void set_person_name      (person_t* person, const char* name);
-static void command_person       (person_t* person, int command);
-static int  compare_persons      (const void* a, const void* b);
-static bool enlarge_step_history (person_t* person, int new_size);
-static bool follow_person        (person_t* person, person_t* leader, int distance);
-static void free_person          (person_t* person);
-static void record_step          (person_t* person);
-static void sort_persons         (void);
-static void update_person        (person_t* person, bool* out_has_moved);
+static bool      does_person_exist    (struct handle handle);
+static void      set_person_direction (person_t* person, int pose_id);
+static void      set_person_name      (person_t* person, const char* name);
+static void      command_person       (person_t* person, int command);
+static int       compare_list_order   (const void* a, const void* b);
+static int       compare_persons      (const void* a, const void* b);
+static bool      enlarge_step_history (person_t* person, int new_size);
+static bool      enqueue_command      (person_t* person, int type, bool is_immediate, script_t* script);
+static bool      acquire_handle       (person_t* person);
+static person_t* find_nearest_person  (int layer, double x, double y, double max_distance, const person_t* exclude);
+static bool      follow_person        (person_t* person, person_t* leader, int distance);
+static void      free_person          (person_t* person);
+static void      orphan_followers     (person_t* person);
+static void      drop_person          (vector_t* bucket, const person_t* person);
+static vector_t* get_hash_bucket      (int layer, int cell_x, int cell_y);
+static struct step get_step           (const person_t* person, int index);
+static float_rect_t get_sprite_rect    (const person_t* person, bool is_flipped, double x, double y);
+static uint32_t  hash_name            (const char* name);
+static int       query_persons        (int layer, rect_t area, vector_t* out_persons);
+static void      record_step          (person_t* person);
+static void      reindex_person       (person_t* person);
+static void      release_handle       (person_t* person);
+static void      renumber_persons     (int first);
+static void      sort_persons         (void);
+static void      unindex_person       (person_t* person);
+static void      unlink_name          (person_t* person);
+static void      update_person        (person_t* person, bool* out_has_moved);
 
 static const person_t*   s_acting_person;
 static const person_t*   s_current_person = NULL;
@@ -147,13 +212,34 @@ static unsigned int      s_next_person_id = 0;
 static int               s_num_persons = 0;
 static unsigned int      s_queued_id = 0;
 static person_t*         *s_persons = NULL;
+static vector_t*         *s_hash_buckets = NULL;
+static vector_t*         s_hash_hits = NULL;
+static vector_t*         s_large_persons = NULL;
+static vector_t*         s_movers = NULL;
+static person_t*         *s_name_buckets = NULL;
+static vector_t*         s_free_slots = NULL;
+static vector_t*         s_slots = NULL;
+static vector_t*         s_visible_persons = NULL;
+static unsigned int      s_query_stamp = 0;
 
 void
 initialize_persons_manager(void)
 {
+	int i;
+	
 	console_log(1, "initializing persons manager");
 	
 	memset(s_def_scripts, 0, PERSON_SCRIPT_MAX * sizeof(int));
+	s_hash_buckets = calloc(NUM_HASH_BUCKETS, sizeof(vector_t*));
+	for (i = 0; i < NUM_HASH_BUCKETS; ++i)
+		s_hash_buckets[i] = vector_new(sizeof(person_t*));
+	s_hash_hits = vector_new(sizeof(person_t*));
+	s_large_persons = vector_new(sizeof(person_t*));
+	s_movers = vector_new(sizeof(person_t*));
+	s_name_buckets = calloc(NUM_NAME_BUCKETS, sizeof(person_t*));
+	s_slots = vector_new(sizeof(struct person_slot));
+	s_free_slots = vector_new(sizeof(int));
+	s_visible_persons = vector_new(sizeof(struct visible_person));
 	s_num_persons = s_max_persons = 0;
 	s_persons = NULL;
 	s_talk_distance = 8;
@@ -173,6 +259,16 @@ shutdown_persons_manager(void)
 	for (i = 0; i < PERSON_SCRIPT_MAX; ++i)
 		free_script(s_def_scripts[i]);
 	free(s_persons);
+	for (i = 0; i < NUM_HASH_BUCKETS; ++i)
+		vector_free(s_hash_buckets[i]);
+	free(s_hash_buckets);
+	vector_free(s_hash_hits);
+	vector_free(s_large_persons);
+	vector_free(s_movers);
+	free(s_name_buckets);
+	vector_free(s_slots);
+	vector_free(s_free_slots);
+	vector_free(s_visible_persons);
 }
 
 person_t*
@@ -187,9 +283,11 @@ create_person(const char* name, spriteset_t* spriteset, bool is_persistent, scri
 	}
 	person = s_persons[s_num_persons - 1] = calloc(1, sizeof(person_t));
 	person->id = s_next_person_id++;
+	person->list_index = s_num_persons - 1;
+	acquire_handle(person);
 	person->sprite = ref_spriteset(spriteset);
 	set_person_name(person, name);
-	set_person_direction(person, lstr_cstr(person->sprite->poses[0].name));
+	set_person_direction(person, get_pose_id(lstr_cstr(person->sprite->poses[0].name)));
 	person->is_persistent = is_persistent;
 	person->is_visible = true;
 	person->x = map_origin.x;
@@ -201,6 +299,7 @@ create_person(const char* name, spriteset_t* spriteset, bool is_persistent, scri
 	person->mask = color_new(255, 255, 255, 255);
 	person->scale_x = person->scale_y = 1.0;
 	person->scripts[PERSON_SCRIPT_ON_CREATE] = create_script;
+	reindex_person(person);
 	call_person_script(person, PERSON_SCRIPT_ON_CREATE, true);
 	sort_persons();
 	return person;
@@ -215,10 +314,7 @@ destroy_person(person_t* person)
 	// the destroy script may want to reassign followers (they will be orphaned otherwise), so
 	// we want to give it a chance to do so.
 	call_person_script(person, PERSON_SCRIPT_ON_DESTROY, true);
-	for (i = 0; i < s_num_persons; ++i) {
-		if (s_persons[i]->leader == person)
-			s_persons[i]->leader = NULL;
-	}
+	orphan_followers(person);
 
 	// remove the person from the engine
 	detach_person(person);
@@ -227,6 +323,7 @@ destroy_person(person_t* person)
 			for (j = i; j < s_num_persons - 1; ++j)
 				s_persons[j] = s_persons[j + 1];
 			--s_num_persons;
+			renumber_persons(i);
 			--i;
 		}
 	}
@@ -282,7 +379,9 @@ is_person_obstructed_at(const person_t* person, double x, double y, person_t** o
 	double           cur_x, cur_y;
 	bool             is_obstructed = false;
 	int              layer;
+	int              num_hits;
 	const obsmap_t*  obsmap;
+	person_t*        other;
 	int              tile_w, tile_h;
 	const tileset_t* tileset;
 
@@ -298,18 +397,17 @@ is_person_obstructed_at(const person_t* person, double x, double y, person_t** o
 
 	// check for obstructing persons
 	if (!person->ignore_all_persons) {
-		for (i = 0; i < s_num_persons; ++i) {
-			if (s_persons[i] == person)  // these persons aren't going to obstruct themselves!
+		num_hits = query_persons(layer, my_base, s_hash_hits);
+		for (i = 0; i < num_hits; ++i) {
+			other = *(person_t**)vector_get(s_hash_hits, i);
+			if (other == person)  // these persons aren't going to obstruct themselves!
 				continue;
-			if (s_persons[i]->layer != layer)
-				continue;  // ignore persons not on the same layer
-			if (is_person_following(s_persons[i], person))
+			if (is_person_following(other, person))
 				continue;  // ignore own followers
-			base = get_person_base(s_persons[i]);
-			if (do_rects_intersect(my_base, base) && !is_person_ignored(person, s_persons[i])) {
+			if (!is_person_ignored(person, other)) {
 				is_obstructed = true;
 				if (out_obstructing_person)
-					*out_obstructing_person = s_persons[i];
+					*out_obstructing_person = other;
 				break;
 			}
 		}
@@ -332,8 +430,7 @@ is_person_obstructed_at(const person_t* person, double x, double y, person_t** o
 		area.y2 = area.y1 + (my_base.y2 - my_base.y1) / tile_h + 2;
 		for (i_x = area.x1; i_x < area.x2; ++i_x) for (i_y = area.y1; i_y < area.y2; ++i_y) {
 			base = translate_rect(my_base, -(i_x * tile_w), -(i_y * tile_h));
-			obsmap = tileset_obsmap(tileset, get_map_tile(i_x, i_y, layer));
-			if (obsmap != NULL && obsmap_test_rect(obsmap, base)) {
+			if (tileset_test_rect(tileset, get_map_tile(i_x, i_y, layer), base)) {
 				is_obstructed = true;
 				if (out_tile_index)
 					*out_tile_index = get_map_tile(i_x, i_y, layer);
@@ -435,6 +532,7 @@ set_person_scale(person_t* person, double scale_x, double scale_y)
 {
 	person->scale_x = scale_x;
 	person->scale_y = scale_y;
+	reindex_person(person);
 }
 
 void
@@ -461,6 +559,7 @@ set_person_spriteset(person_t* person, spriteset_t* spriteset)
 	person->anim_frames = get_sprite_frame_delay(person->sprite, person->direction, 0);
 	person->frame = 0;
 	free_spriteset(old_spriteset);
+	reindex_person(person);
 }
 
 void
@@ -469,19 +568,22 @@ set_person_xyz(person_t* person, double x, double y, int layer)
 	person->x = x;
 	person->y = y;
 	person->layer = layer;
+	reindex_person(person);
 	sort_persons();
 }
 
 bool
 call_person_script(const person_t* person, int type, bool use_default)
 {
+	struct handle   handle;
 	const person_t* last_person;
 
+	handle = person->handle;
 	last_person = s_current_person;
 	s_current_person = person;
 	if (use_default)
 		run_script(s_def_scripts[type], false);
-	if (does_person_exist(person))
+	if (does_person_exist(handle))
 		run_script(person->scripts[type], false);
 	s_current_person = last_person;
 	return true;
@@ -510,11 +612,15 @@ compile_person_script(person_t* person, int type, const lstring_t* codestring)
 person_t*
 find_person(const char* name)
 {
-	int i;
+	// if more than one person has the same name, the one created first wins.
+	
+	person_t* person;
 
-	for (i = 0; i < s_num_persons; ++i) {
-		if (strcmp(name, s_persons[i]->name) == 0)
-			return s_persons[i];
+	person = s_name_buckets[hash_name(name) % NUM_NAME_BUCKETS];
+	while (person != NULL) {
+		if (strcmp(name, person->name) == 0)
+			return person;
+		person = person->next_by_name;
 	}
 	return NULL;
 }
@@ -536,18 +642,23 @@ follow_person(person_t* person, person_t* leader, int distance)
 	if (leader != NULL) {
 		if (!enlarge_step_history(leader, distance))
 			return false;
-		person->leader = leader;
+		if (leader->followers == NULL && !(leader->followers = vector_new(sizeof(person_t*))))
+			return false;
+		if (person->leader != leader && !vector_push(leader->followers, &person))
+			return false;
 		person->follow_distance = distance;
 	}
+	if (person->leader != NULL && person->leader != leader)
+		drop_person(person->leader->followers, person);
 	person->leader = leader;
+	person->is_depth_valid = false;  // follower ties are broken by leadership
 	return true;
 }
 
 bool
 queue_person_command(person_t* person, int command, bool is_immediate)
 {
-	struct command* commands;
-	bool            is_aok = true;
+	bool is_aok = true;
 	
 	switch (command) {
 	case COMMAND_MOVE_NORTHEAST:
@@ -567,55 +678,81 @@ queue_person_command(person_t* person, int command, bool is_immediate)
 		is_aok &= queue_person_command(person, COMMAND_MOVE_WEST, is_immediate);
 		return is_aok;
 	default:
-		++person->num_commands;
-		if (person->num_commands > person->max_commands) {
-			if (!(commands = realloc(person->commands, person->num_commands * 2 * sizeof(struct command))))
-				return false;
-			person->max_commands = person->num_commands * 2;
-			person->commands = commands;
-		}
-		person->commands[person->num_commands - 1].type = command;
-		person->commands[person->num_commands - 1].is_immediate = is_immediate;
-		person->commands[person->num_commands - 1].script = NULL;
-		return true;
+		return enqueue_command(person, command, is_immediate, NULL);
 	}
 }
 
 bool
 queue_person_script(person_t* person, script_t* script, bool is_immediate)
 {
-	++person->num_commands;
-	if (person->num_commands > person->max_commands) {
-		person->max_commands = person->num_commands * 2;
-		if (!(person->commands = realloc(person->commands, person->max_commands * sizeof(struct command))))
-			return false;
-	}
-	person->commands[person->num_commands - 1].type = COMMAND_RUN_SCRIPT;
-	person->commands[person->num_commands - 1].is_immediate = is_immediate;
-	person->commands[person->num_commands - 1].script = script;
-	return true;
+	return enqueue_command(person, COMMAND_RUN_SCRIPT, is_immediate, script);
 }
 
 void
-render_persons(int layer, bool is_flipped, int cam_x, int cam_y)
-{
-	person_t*    person;
-	spriteset_t* sprite;
-	int          w, h;
-	double       x, y;
-	int          i;
-
+render_persons(int layer, bool is_flipped, int cam_x, int cam_y, int repeat_w, int repeat_h)
+{
+	// persons who are entirely offscreen are culled before anything is drawn.  on
+	// a repeating layer each person is drawn once for every copy of the layer on
+	// the screen, so we work out up front which copies they're visible in; that
+	// way the copies only need to look at persons who are actually onscreen.
+
+	float_rect_t           bounds;
+	struct visible_person* entry;
+	int                    num_copies_x = 1;
+	int                    num_copies_y = 1;
+	person_t*              person;
+	struct visible_person  visible;
+	double                 x, y;
+
+	iter_t iter;
+	int    i;
+	int    copy_x, copy_y;
+
+	if (repeat_w > 0 && repeat_h > 0) {
+		num_copies_x = g_res_x / repeat_w + 2;
+		num_copies_y = g_res_y / repeat_h + 2;
+	}
+	vector_clear(s_visible_persons);
 	for (i = 0; i < s_num_persons; ++i) {
 		person = s_persons[i];
 		if (!person->is_visible || person->layer != layer)
 			continue;
-		sprite = person->sprite;
-		get_sprite_size(sprite, &w, &h);
 		get_person_xy(person, &x, &y, true);
 		x -= cam_x - person->x_offset;
 		y -= cam_y - person->y_offset;
-		draw_sprite(sprite, person->mask, is_flipped, person->theta, person->scale_x, person->scale_y,
-			person->direction, x, y, person->frame);
+		bounds = get_sprite_rect(person, is_flipped, x, y);
+		visible.person = person;
+		visible.x = x;
+		visible.y = y;
+		visible.first_copy_x = visible.last_copy_x = 0;
+		visible.first_copy_y = visible.last_copy_y = 0;
+		if (num_copies_x > 1) {
+			// copy n is shifted right by n layer widths
+			visible.first_copy_x = fmax(floor(-bounds.x2 / repeat_w) + 1, 0);
+			visible.last_copy_x = fmin(ceil((g_res_x - bounds.x1) / repeat_w) - 1, num_copies_x - 1);
+			visible.first_copy_y = fmax(floor(-bounds.y2 / repeat_h) + 1, 0);
+			visible.last_copy_y = fmin(ceil((g_res_y - bounds.y1) / repeat_h) - 1, num_copies_y - 1);
+			if (visible.first_copy_x > visible.last_copy_x || visible.first_copy_y > visible.last_copy_y)
+				continue;
+		}
+		else if (bounds.x2 <= 0 || bounds.x1 >= g_res_x || bounds.y2 <= 0 || bounds.y1 >= g_res_y)
+			continue;
+		vector_push(s_visible_persons, &visible);
+	}
+	if (vector_len(s_visible_persons) == 0)
+		return;
+	for (copy_y = 0; copy_y < num_copies_y; ++copy_y) for (copy_x = 0; copy_x < num_copies_x; ++copy_x) {
+		iter = vector_enum(s_visible_persons);
+		while (entry = vector_next(&iter)) {
+			if (copy_x < entry->first_copy_x || copy_x > entry->last_copy_x
+				|| copy_y < entry->first_copy_y || copy_y > entry->last_copy_y)
+			{
+				continue;
+			}
+			person = entry->person;
+			draw_sprite(person->sprite, person->mask, is_flipped, person->theta, person->scale_x, person->scale_y,
+				person->direction, entry->x + copy_x * repeat_w, entry->y + copy_y * repeat_h, person->frame);
+		}
 	}
 }
 
@@ -644,15 +781,19 @@ reset_persons(bool keep_existing)
 			free_person(person);
 			--s_num_persons;
 			for (j = i; j < s_num_persons; ++j) s_persons[j] = s_persons[j + 1];
+			renumber_persons(i);
 			--i;
 		}
 	}
+	for (i = 0; i < s_num_persons; ++i)
+		reindex_person(s_persons[i]);
 	sort_persons();
 }
 
 void
 talk_person(const person_t* person)
 {
+	const char*     direction;
 	const person_t* last_active;
 	rect_t          map_rect;
 	person_t*       target_person;
@@ -662,10 +803,11 @@ talk_person(const person_t* person)
 	
 	// check if anyone else is within earshot
 	get_person_xy(person, &talk_x, &talk_y, true);
-	if (strstr(person->direction, "north")) talk_y -= s_talk_distance;
-	if (strstr(person->direction, "east")) talk_x += s_talk_distance;
-	if (strstr(person->direction, "south")) talk_y += s_talk_distance;
-	if (strstr(person->direction, "west")) talk_x -= s_talk_distance;
+	direction = get_pose_name(person->direction);
+	if (strstr(direction, "north")) talk_y -= s_talk_distance;
+	if (strstr(direction, "east")) talk_x += s_talk_distance;
+	if (strstr(direction, "south")) talk_y += s_talk_distance;
+	if (strstr(direction, "west")) talk_x -= s_talk_distance;
 	is_person_obstructed_at(person, talk_x, talk_y, &target_person, NULL);
 	
 	// if so, call their talk script
@@ -694,27 +836,37 @@ update_persons(void)
 }
 
 static bool
-does_person_exist(const person_t* person)
+does_person_exist(struct handle handle)
 {
-	int i;
+	struct person_slot* slot;
 
-	for (i = 0; i < s_num_persons; ++i)
-		if (person == s_persons[i]) return true;
-	return false;
+	if (handle.slot < 0 || handle.slot >= (int)vector_len(s_slots))
+		return false;
+	slot = vector_get(s_slots, handle.slot);
+	return slot->person != NULL && slot->generation == handle.generation;
 }
 
 static void
-set_person_direction(person_t* person, const char* direction)
+set_person_direction(person_t* person, int pose_id)
 {
-	person->direction = realloc(person->direction, (strlen(direction) + 1) * sizeof(char));
-	strcpy(person->direction, direction);
+	person->direction = pose_id;
 }
 
 static void
 set_person_name(person_t* person, const char* name)
 {
+	person_t* *p_next;
+
+	unlink_name(person);
 	person->name = realloc(person->name, (strlen(name) + 1) * sizeof(char));
 	strcpy(person->name, name);
+
+	// add the person to the end of its chain in the name table
+	p_next = &s_name_buckets[hash_name(name) % NUM_NAME_BUCKETS];
+	while (*p_next != NULL)
+		p_next = &(*p_next)->next_by_name;
+	*p_next = person;
+	person->next_by_name = NULL;
 }
 
 static void
@@ -735,28 +887,28 @@ command_person(person_t* person, int command)
 		}
 		break;
 	case COMMAND_FACE_NORTH:
-		set_person_direction(person, "north");
+		set_person_direction(person, POSE_NORTH);
 		break;
 	case COMMAND_FACE_NORTHEAST:
-		set_person_direction(person, "northeast");
+		set_person_direction(person, POSE_NORTHEAST);
 		break;
 	case COMMAND_FACE_EAST:
-		set_person_direction(person, "east");
+		set_person_direction(person, POSE_EAST);
 		break;
 	case COMMAND_FACE_SOUTHEAST:
-		set_person_direction(person, "southeast");
+		set_person_direction(person, POSE_SOUTHEAST);
 		break;
 	case COMMAND_FACE_SOUTH:
-		set_person_direction(person, "south");
+		set_person_direction(person, POSE_SOUTH);
 		break;
 	case COMMAND_FACE_SOUTHWEST:
-		set_person_direction(person, "southwest");
+		set_person_direction(person, POSE_SOUTHWEST);
 		break;
 	case COMMAND_FACE_WEST:
-		set_person_direction(person, "west");
+		set_person_direction(person, POSE_WEST);
 		break;
 	case COMMAND_FACE_NORTHWEST:
-		set_person_direction(person, "northwest");
+		set_person_direction(person, POSE_NORTHWEST);
 		break;
 	case COMMAND_MOVE_NORTH:
 		new_y = person->y - person->speed_y;
@@ -779,6 +931,7 @@ command_person(person_t* person, int command)
 			if (new_y != person->y)
 				person->mv_y = new_y > person->y ? 1 : -1;
 			person->x = new_x; person->y = new_y;
+			reindex_person(person);
 		}
 		else {
 			// if not, and we collided with a person, call that person's touch script
@@ -791,18 +944,27 @@ command_person(person_t* person, int command)
 	}
 }
 
+static int
+compare_list_order(const void* a, const void* b)
+{
+	person_t* p1 = *(person_t**)a;
+	person_t* p2 = *(person_t**)b;
+
+	return p1->list_index - p2->list_index;
+}
+
 static int
 compare_persons(const void* a, const void* b)
 {
+	// note: this relies on each person's depth having been updated beforehand;
+	//       see sort_persons().
+	
 	person_t* p1 = *(person_t**)a;
 	person_t* p2 = *(person_t**)b;
 
-	double x, y_p1, y_p2;
-	int    y_delta;
+	int y_delta;
 
-	get_person_xy(p1, &x, &y_p1, true);
-	get_person_xy(p2, &x, &y_p2, true);
-	y_delta = (y_p1 + p1->y_offset) - (y_p2 + p2->y_offset);
+	y_delta = p1->depth - p2->depth;
 	if (y_delta != 0)
 		return y_delta;
 	else if (is_person_following(p1, p2))
@@ -818,25 +980,295 @@ free_person(person_t* person)
 {
 	int i;
 
+	unindex_person(person);
+	unlink_name(person);
+	release_handle(person);
+	orphan_followers(person);
+	if (person->leader != NULL)
+		drop_person(person->leader->followers, person);
+	vector_free(person->followers);
 	free(person->steps);
 	for (i = 0; i < PERSON_SCRIPT_MAX; ++i)
 		free_script(person->scripts[i]);
 	free_spriteset(person->sprite);
 	free(person->commands);
 	free(person->name);
-	free(person->direction);
 	free(person);
 }
 
+static bool
+acquire_handle(person_t* person)
+{
+	struct person_slot  new_slot;
+	struct person_slot* slot;
+	int                 slot_index;
+
+	person->handle.slot = -1;
+	if (vector_len(s_free_slots) > 0) {
+		slot_index = *(int*)vector_get(s_free_slots, vector_len(s_free_slots) - 1);
+		vector_remove(s_free_slots, vector_len(s_free_slots) - 1);
+	}
+	else {
+		new_slot.generation = 0;
+		new_slot.person = NULL;
+		if (!vector_push(s_slots, &new_slot))
+			return false;
+		slot_index = (int)vector_len(s_slots) - 1;
+	}
+	slot = vector_get(s_slots, slot_index);
+	slot->person = person;
+	person->handle.slot = slot_index;
+	person->handle.generation = slot->generation;
+	return true;
+}
+
+static void
+drop_person(vector_t* bucket, const person_t* person)
+{
+	iter_t     iter;
+	person_t** p_person;
+
+	iter = vector_enum(bucket);
+	while (p_person = vector_next(&iter)) {
+		if (*p_person == person) {
+			iter_remove(&iter);
+			return;
+		}
+	}
+}
+
+static person_t*
+find_nearest_person(int layer, double x, double y, double max_distance, const person_t* exclude)
+{
+	// searches outward from the point one ring of hash cells at a time.  anyone
+	// not found by the end of ring `r` lies entirely outside of it, and so must be
+	// at least (r * HASH_CELL_SIZE) away; once the best match is closer than that,
+	// there's no need to look any further.
+
+	person_t*  candidate;
+	int        cell_x, cell_y;
+	double     distance;
+	double     min_distance;
+	person_t*  nearest = NULL;
+	person_t** p_person;
+	double     person_x, person_y;
+	vector_t*  search_list;
+
+	iter_t iter;
+	int    i, ring;
+	int    x1, y1, x2, y2;
+	int    cx, cy;
+
+	min_distance = max_distance >= 0.0 ? max_distance : HUGE_VAL;
+	cell_x = floor(x / HASH_CELL_SIZE);
+	cell_y = floor(y / HASH_CELL_SIZE);
+	++s_query_stamp;
+	for (ring = -1; ring <= MAX_SEARCH_RINGS; ++ring) {
+		vector_clear(s_hash_hits);
+		if (ring < 0) {
+			// check the large persons first, since they aren't in the hash
+			iter = vector_enum(s_large_persons);
+			while (p_person = vector_next(&iter))
+				vector_push(s_hash_hits, p_person);
+		}
+		else {
+			x1 = cell_x - ring; x2 = cell_x + ring;
+			y1 = cell_y - ring; y2 = cell_y + ring;
+			for (cy = y1; cy <= y2; ++cy) for (cx = x1; cx <= x2; ++cx) {
+				if (cx != x1 && cx != x2 && cy != y1 && cy != y2)
+					continue;  // inner cells were searched on an earlier ring
+				search_list = get_hash_bucket(layer, cx, cy);
+				iter = vector_enum(search_list);
+				while (p_person = vector_next(&iter))
+					vector_push(s_hash_hits, p_person);
+			}
+		}
+		for (i = 0; i < (int)vector_len(s_hash_hits); ++i) {
+			candidate = *(person_t**)vector_get(s_hash_hits, i);
+			if (candidate->query_stamp == s_query_stamp || candidate == exclude)
+				continue;
+			candidate->query_stamp = s_query_stamp;
+			if (candidate->layer != layer)
+				continue;
+			get_person_xy(candidate, &person_x, &person_y, true);
+			distance = hypot(person_x - x, person_y - y);
+			if (distance <= min_distance) {
+				min_distance = distance;
+				nearest = candidate;
+			}
+		}
+
+		// bases are rounded to whole pixels, so allow a pixel of slop
+		if (ring >= 0 && min_distance < ring * HASH_CELL_SIZE - 1)
+			return nearest;
+	}
+
+	// nobody close by; fall back on checking everyone
+	for (i = 0; i < s_num_persons; ++i) {
+		candidate = s_persons[i];
+		if (candidate->query_stamp == s_query_stamp || candidate == exclude)
+			continue;
+		if (candidate->layer != layer)
+			continue;
+		get_person_xy(candidate, &person_x, &person_y, true);
+		distance = hypot(person_x - x, person_y - y);
+		if (distance <= min_distance) {
+			min_distance = distance;
+			nearest = candidate;
+		}
+	}
+	return nearest;
+}
+
+static vector_t*
+get_hash_bucket(int layer, int cell_x, int cell_y)
+{
+	unsigned int hash;
+
+	hash = ((unsigned int)cell_x * 73856093u)
+		^ ((unsigned int)cell_y * 19349663u)
+		^ ((unsigned int)layer * 83492791u);
+	return s_hash_buckets[hash % NUM_HASH_BUCKETS];
+}
+
+static float_rect_t
+get_sprite_rect(const person_t* person, bool is_flipped, double x, double y)
+{
+	// returns the screen area covered by a person's sprite when drawn at (x, y).
+	// this follows the placement logic of draw_sprite(); for rotated sprites, a
+	// square enclosing every possible rotation is used instead.
+
+	rect_t       base;
+	float_rect_t bounds;
+	double       center_x, center_y;
+	double       radius;
+	int          w, h;
+
+	get_sprite_size(person->sprite, &w, &h);
+	base = zoom_rect(person->sprite->base, person->scale_x, person->scale_y);
+	bounds.x1 = x - (base.x1 + base.x2) / 2;
+	bounds.y1 = is_flipped ? y : y - (base.y1 + base.y2) / 2;
+	bounds.x2 = bounds.x1 + w * person->scale_x;
+	bounds.y2 = bounds.y1 + h * person->scale_y;
+	if (person->theta != 0.0 || bounds.x2 < bounds.x1 || bounds.y2 < bounds.y1) {
+		center_x = (bounds.x1 + bounds.x2) / 2;
+		center_y = (bounds.y1 + bounds.y2) / 2;
+		radius = hypot(w * person->scale_x, h * person->scale_y) / 2;
+		bounds = new_float_rect(center_x - radius, center_y - radius,
+			center_x + radius, center_y + radius);
+	}
+	return bounds;
+}
+
+static uint32_t
+hash_name(const char* name)
+{
+	// 32-bit FNV-1a
+	uint32_t hash = 2166136261u;
+
+	while (*name != '\0') {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int
+query_persons(int layer, rect_t area, vector_t* out_persons)
+{
+	// finds everyone on a layer whose base intersects the area.  a person spanning
+	// several cells can turn up more than once, so each is stamped as it's found
+	// to avoid reporting anyone twice.
+
+	int        cell_x1, cell_y1;
+	int        cell_x2, cell_y2;
+	person_t*  candidate;
+	double     num_cells;
+	person_t** p_person;
+	vector_t*  search_list;
+
+	iter_t iter;
+	int    i;
+	int    cx, cy;
+
+	vector_clear(out_persons);
+	normalize_rect(&area);
+	cell_x1 = floor((double)area.x1 / HASH_CELL_SIZE);
+	cell_y1 = floor((double)area.y1 / HASH_CELL_SIZE);
+	cell_x2 = floor((double)area.x2 / HASH_CELL_SIZE);
+	cell_y2 = floor((double)area.y2 / HASH_CELL_SIZE);
+	num_cells = ((double)cell_x2 - cell_x1 + 1) * ((double)cell_y2 - cell_y1 + 1);
+	if (num_cells > NUM_HASH_BUCKETS) {
+		// the area is huge; it's faster to just check everyone
+		for (i = 0; i < s_num_persons; ++i)
+			vector_push(out_persons, &s_persons[i]);
+	}
+	else {
+		for (cy = cell_y1; cy <= cell_y2; ++cy) for (cx = cell_x1; cx <= cell_x2; ++cx) {
+			search_list = get_hash_bucket(layer, cx, cy);
+			iter = vector_enum(search_list);
+			while (p_person = vector_next(&iter))
+				vector_push(out_persons, p_person);
+		}
+		iter = vector_enum(s_large_persons);
+		while (p_person = vector_next(&iter))
+			vector_push(out_persons, p_person);
+	}
+
+	// weed out persons which don't actually intersect the area, as well as any
+	// duplicates
+	++s_query_stamp;
+	iter = vector_enum(out_persons);
+	while (p_person = vector_next(&iter)) {
+		candidate = *p_person;
+		if (candidate->query_stamp == s_query_stamp || candidate->layer != layer
+			|| !do_rects_intersect(area, get_person_base(candidate)))
+		{
+			iter_remove(&iter);
+			continue;
+		}
+		candidate->query_stamp = s_query_stamp;
+	}
+
+	// the buckets are visited in no particular order, so put the hits back in
+	// person list order.  that way the first hit is the same person a straight
+	// scan of the list would have found first.
+	if (vector_len(out_persons) > 1) {
+		qsort(vector_get(out_persons, 0), vector_len(out_persons), sizeof(person_t*),
+			compare_list_order);
+	}
+	return (int)vector_len(out_persons);
+}
+
+static void
+orphan_followers(person_t* person)
+{
+	person_t** p_follower;
+
+	iter_t iter;
+
+	if (person->followers == NULL)
+		return;
+	iter = vector_enum(person->followers);
+	while (p_follower = vector_next(&iter)) {
+		(*p_follower)->leader = NULL;
+		(*p_follower)->is_depth_valid = false;
+	}
+	vector_clear(person->followers);
+}
+
 static void
 record_step(person_t* person)
 {
+	// the step history is a ring buffer with the most recent step at `first_step`,
+	// so recording a step just overwrites the oldest one.
+
 	struct step* p_step;
 
 	if (person->max_history <= 0)
 		return;
-	memmove(&person->steps[1], &person->steps[0], (person->max_history - 1) * sizeof(struct step));
-	p_step = &person->steps[0];
+	person->first_step = (person->first_step + person->max_history - 1) % person->max_history;
+	p_step = &person->steps[person->first_step];
 	p_step->x = person->x;
 	p_step->y = person->y;
 }
@@ -845,36 +1277,243 @@ static bool
 enlarge_step_history(person_t* person, int new_size)
 {
 	struct step *new_steps;
-	size_t      pastmost;
-	double      last_x;
-	double      last_y;
+	struct step pastmost;
 
 	int i;
 	
 	if (new_size > person->max_history) {
-		if (!(new_steps = realloc(person->steps, new_size * sizeof(struct step))))
+		if (!(new_steps = malloc(new_size * sizeof(struct step))))
 			return false;
 
-		// when enlarging the history buffer, fill new slots with pastmost values
-		// (kind of like sign extension)
-		pastmost = person->max_history - 1;
-		last_x = person->steps != NULL ? person->steps[pastmost].x : person->x;
-		last_y = person->steps != NULL ? person->steps[pastmost].y : person->y;
-		for (i = person->max_history; i < new_size; ++i) {
-			new_steps[i].x = last_x;
-			new_steps[i].y = last_y;
+		// unwrap the ring buffer while copying, then fill new slots with pastmost
+		// values (kind of like sign extension)
+		for (i = 0; i < person->max_history; ++i)
+			new_steps[i] = get_step(person, i);
+		if (person->steps != NULL)
+			pastmost = get_step(person, person->max_history - 1);
+		else {
+			pastmost.x = person->x;
+			pastmost.y = person->y;
 		}
+		for (i = person->max_history; i < new_size; ++i)
+			new_steps[i] = pastmost;
+		free(person->steps);
 		person->steps = new_steps;
+		person->first_step = 0;
 		person->max_history = new_size;
 	}
 	
 	return true;
 }
 
+static bool
+enqueue_command(person_t* person, int type, bool is_immediate, script_t* script)
+{
+	// the command queue is a ring buffer starting at `first_command`.  it grows
+	// geometrically, so long runs of queued commands cause only a few reallocations.
+
+	struct command* commands;
+	struct command* p_command;
+	int             new_max;
+
+	int i;
+
+	if (person->num_commands >= person->max_commands) {
+		new_max = person->max_commands > 0 ? person->max_commands * 2 : 16;
+		if (!(commands = malloc(new_max * sizeof(struct command))))
+			return false;
+		for (i = 0; i < person->num_commands; ++i)
+			commands[i] = person->commands[(person->first_command + i) % person->max_commands];
+		free(person->commands);
+		person->commands = commands;
+		person->first_command = 0;
+		person->max_commands = new_max;
+	}
+	p_command = &person->commands[(person->first_command + person->num_commands) % person->max_commands];
+	p_command->type = type;
+	p_command->is_immediate = is_immediate;
+	p_command->script = script;
+	++person->num_commands;
+	return true;
+}
+
+static struct step
+get_step(const person_t* person, int index)
+{
+	// index 0 is the most recent step
+	return person->steps[(person->first_step + index) % person->max_history];
+}
+
+static void
+reindex_person(person_t* person)
+{
+	// called whenever a person's base may have moved.  most steps don't leave the
+	// cells the person already occupies, in which case nothing needs to change.
+
+	rect_t base;
+	rect_t cells;
+	int    num_cells;
+
+	int x, y;
+
+	base = get_person_base(person);
+	normalize_rect(&base);
+	cells.x1 = floor((double)base.x1 / HASH_CELL_SIZE);
+	cells.y1 = floor((double)base.y1 / HASH_CELL_SIZE);
+	cells.x2 = floor((double)base.x2 / HASH_CELL_SIZE);
+	cells.y2 = floor((double)base.y2 / HASH_CELL_SIZE);
+	if (person->is_hashed && person->hash_layer == person->layer
+		&& memcmp(&cells, &person->hash_cells, sizeof(rect_t)) == 0)
+	{
+		return;
+	}
+	unindex_person(person);
+	person->hash_cells = cells;
+	person->hash_layer = person->layer;
+	num_cells = (cells.x2 - cells.x1 + 1) * (cells.y2 - cells.y1 + 1);
+	person->is_large = num_cells > MAX_HASH_CELLS;
+	if (person->is_large)
+		vector_push(s_large_persons, &person);
+	else {
+		for (y = cells.y1; y <= cells.y2; ++y) for (x = cells.x1; x <= cells.x2; ++x)
+			vector_push(get_hash_bucket(person->layer, x, y), &person);
+	}
+	person->is_hashed = true;
+}
+
+static void
+release_handle(person_t* person)
+{
+	struct person_slot* slot;
+
+	if (!does_person_exist(person->handle))
+		return;
+	slot = vector_get(s_slots, person->handle.slot);
+	slot->person = NULL;
+	++slot->generation;
+	vector_push(s_free_slots, &person->handle.slot);
+}
+
+static void
+renumber_persons(int first)
+{
+	// each person knows its own place in the person list, so that the results of
+	// a query can be put in list order without searching the list.  this needs to
+	// be redone whenever persons are moved around in the list.
+
+	int i;
+
+	for (i = first; i < s_num_persons; ++i)
+		s_persons[i]->list_index = i;
+}
+
 static void
 sort_persons(void)
 {
-	qsort(s_persons, s_num_persons, sizeof(person_t*), compare_persons);
+	// the person list is kept in depth order at all times.  as only a few persons
+	// tend to move in any given frame, those whose depth changed are pulled out
+	// and put back in with a binary search; everyone else is still in order.  when
+	// many persons have moved, the list will still be nearly sorted, so a straight
+	// insertion sort handles that case in close to linear time.
+
+	double    depth;
+	person_t* mover;
+	int       num_movers = 0;
+	int       num_sorted;
+	person_t* person;
+	double    x, y;
+
+	int i, j;
+	int lo, hi, mid;
+
+	for (i = 0; i < s_num_persons; ++i) {
+		person = s_persons[i];
+		get_person_xy(person, &x, &y, true);
+		depth = y + person->y_offset;
+		if (person->is_depth_valid && depth == person->depth)
+			continue;
+		person->depth = depth;
+		person->is_depth_valid = false;
+		++num_movers;
+	}
+	if (num_movers == 0)
+		return;
+	if (num_movers > 8 && num_movers > s_num_persons / 8) {
+		for (i = 1; i < s_num_persons; ++i) {
+			person = s_persons[i];
+			for (j = i; j > 0 && compare_persons(&s_persons[j - 1], &person) > 0; --j)
+				s_persons[j] = s_persons[j - 1];
+			s_persons[j] = person;
+		}
+		for (i = 0; i < s_num_persons; ++i)
+			s_persons[i]->is_depth_valid = true;
+		renumber_persons(0);
+		return;
+	}
+
+	// pull out the movers, keeping everyone else in order...
+	vector_clear(s_movers);
+	for (i = 0, num_sorted = 0; i < s_num_persons; ++i) {
+		if (s_persons[i]->is_depth_valid)
+			s_persons[num_sorted++] = s_persons[i];
+		else
+			vector_push(s_movers, &s_persons[i]);
+	}
+
+	// ...and put them back where they belong.
+	for (i = 0; i < num_movers; ++i) {
+		mover = *(person_t**)vector_get(s_movers, i);
+		lo = 0; hi = num_sorted;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (compare_persons(&s_persons[mid], &mover) <= 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		memmove(&s_persons[lo + 1], &s_persons[lo], (num_sorted - lo) * sizeof(person_t*));
+		s_persons[lo] = mover;
+		mover->is_depth_valid = true;
+		++num_sorted;
+	}
+	renumber_persons(0);
+}
+
+static void
+unindex_person(person_t* person)
+{
+	rect_t cells;
+
+	int x, y;
+
+	if (!person->is_hashed)
+		return;
+	cells = person->hash_cells;
+	if (person->is_large)
+		drop_person(s_large_persons, person);
+	else {
+		for (y = cells.y1; y <= cells.y2; ++y) for (x = cells.x1; x <= cells.x2; ++x)
+			drop_person(get_hash_bucket(person->hash_layer, x, y), person);
+	}
+	person->is_hashed = false;
+}
+
+static void
+unlink_name(person_t* person)
+{
+	person_t* *p_next;
+
+	if (person->name == NULL)
+		return;
+	p_next = &s_name_buckets[hash_name(person->name) % NUM_NAME_BUCKETS];
+	while (*p_next != NULL) {
+		if (*p_next == person) {
+			*p_next = person->next_by_name;
+			break;
+		}
+		p_next = &(*p_next)->next_by_name;
+	}
+	person->next_by_name = NULL;
 }
 
 static void
@@ -883,6 +1522,7 @@ update_person(person_t* person, bool* out_has_moved)
 	struct command  command;
 	double          delta_x, delta_y;
 	int             facing;
+	struct handle   handle;
 	bool            has_moved;
 	bool            is_finished;
 	const person_t* last_person;
@@ -891,6 +1531,7 @@ update_person(person_t* person, bool* out_has_moved)
 
 	int i;
 
+	handle = person->handle;
 	person->mv_x = 0; person->mv_y = 0;
 	if (person->revert_frames > 0 && --person->revert_frames <= 0)
 		person->frame = 0;
@@ -900,12 +1541,11 @@ update_person(person_t* person, bool* out_has_moved)
 			call_person_script(person, PERSON_SCRIPT_GENERATOR, true);
 
 		// run through the queue, stopping after the first non-immediate command
-		is_finished = !does_person_exist(person) || person->num_commands == 0;
+		is_finished = !does_person_exist(handle) || person->num_commands == 0;
 		while (!is_finished) {
-			command = person->commands[0];
+			command = person->commands[person->first_command];
+			person->first_command = (person->first_command + 1) % person->max_commands;
 			--person->num_commands;
-			for (i = 0; i < person->num_commands; ++i)
-				person->commands[i] = person->commands[i + 1];
 			last_person = s_current_person;
 			s_current_person = person;
 			if (command.type != COMMAND_RUN_SCRIPT)
@@ -914,20 +1554,20 @@ update_person(person_t* person, bool* out_has_moved)
 				run_script(command.script, false);
 			s_current_person = last_person;
 			free_script(command.script);
-			is_finished = !does_person_exist(person)  // stop if person was destroyed
+			is_finished = !does_person_exist(handle)  // stop if person was destroyed
 				|| !command.is_immediate || person->num_commands == 0;
 		}
 	}
 	else {  // leader set; follow the leader!
-		step = person->leader->steps[person->follow_distance - 1];
+		step = get_step(person->leader, person->follow_distance - 1);
 		delta_x = step.x - person->x;
 		delta_y = step.y - person->y;
 		if (fabs(delta_x) > person->speed_x)
 			command_person(person, delta_x > 0 ? COMMAND_MOVE_EAST : COMMAND_MOVE_WEST);
-		if (!does_person_exist(person)) return;
+		if (!does_person_exist(handle)) return;
 		if (fabs(delta_y) > person->speed_y)
 			command_person(person, delta_y > 0 ? COMMAND_MOVE_SOUTH : COMMAND_MOVE_NORTH);
-		if (!does_person_exist(person)) return;
+		if (!does_person_exist(handle)) return;
 		vector = person->mv_x + person->mv_y * 3;
 		facing = vector == -3 ? COMMAND_FACE_NORTH
 			: vector == -2 ? COMMAND_FACE_NORTHEAST
@@ -940,12 +1580,12 @@ update_person(person_t* person, bool* out_has_moved)
 			: COMMAND_WAIT;
 		if (facing != COMMAND_WAIT)
 			command_person(person, COMMAND_ANIMATE);
-		if (!does_person_exist(person)) return;
+		if (!does_person_exist(handle)) return;
 		command_person(person, facing);
 	}
 
 	// check that the person didn't mysteriously disappear...
-	if (!does_person_exist(person))
+	if (!does_person_exist(handle))
 		return;  // they probably got eaten by a hunger-pig or something.
 
 	// if the person's position changed, record it in their step history
@@ -953,12 +1593,13 @@ update_person(person_t* person, bool* out_has_moved)
 	if (*out_has_moved)
 		record_step(person);
 
-	// recursively update the follower chain
-	for (i = 0; i < s_num_persons; ++i) {
-		if (s_persons[i]->leader != person)
-			continue;
-		update_person(s_persons[i], &has_moved);
+	// recursively update the follower chain.  a follower's update may run
+	// scripts which change the list, so don't hold on to an iterator.
+	for (i = 0; person->followers != NULL && i < (int)vector_len(person->followers); ++i) {
+		update_person(*(person_t**)vector_get(person->followers, i), &has_moved);
 		*out_has_moved |= has_moved;
+		if (!does_person_exist(handle))
+			return;
 	}
 }
 
@@ -981,6 +1622,7 @@ init_persons_api(void)
 	api_register_method(g_duk, NULL, "GetCurrentPerson", js_GetCurrentPerson);
 	api_register_method(g_duk, NULL, "GetObstructingPerson", js_GetObstructingPerson);
 	api_register_method(g_duk, NULL, "GetObstructingTile", js_GetObstructingTile);
+	api_register_method(g_duk, NULL, "GetNearestPerson", js_GetNearestPerson);
 	api_register_method(g_duk, NULL, "GetPersonAngle", js_GetPersonAngle);
 	api_register_method(g_duk, NULL, "GetPersonBase", js_GetPersonBase);
 	api_register_method(g_duk, NULL, "GetPersonData", js_GetPersonData);
@@ -994,6 +1636,7 @@ init_persons_api(void)
 	api_register_method(g_duk, NULL, "GetPersonLayer", js_GetPersonLayer);
 	api_register_method(g_duk, NULL, "GetPersonLeader", js_GetPersonLeader);
 	api_register_method(g_duk, NULL, "GetPersonList", js_GetPersonList);
+	api_register_method(g_duk, NULL, "GetPersonListInRect", js_GetPersonListInRect);
 	api_register_method(g_duk, NULL, "GetPersonMask", js_GetPersonMask);
 	api_register_method(g_duk, NULL, "GetPersonOffsetX", js_GetPersonOffsetX);
 	api_register_method(g_duk, NULL, "GetPersonOffsetY", js_GetPersonOffsetY);
@@ -1243,6 +1886,29 @@ js_GetObstructingTile(duk_context* ctx)
 	return 1;
 }
 
+static duk_ret_t
+js_GetNearestPerson(duk_context* ctx)
+{
+	int n_args = duk_get_top(ctx);
+	const char* name = duk_require_string(ctx, 0);
+	double max_distance = n_args >= 2 ? duk_require_number(ctx, 1) : -1.0;
+
+	person_t* nearest;
+	person_t* person;
+	double    x, y;
+
+	if (!is_map_engine_running())
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "GetNearestPerson(): map engine must be running");
+	if ((person = find_person(name)) == NULL)
+		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "GetNearestPerson(): no such person `%s`", name);
+	get_person_xy(person, &x, &y, true);
+	if (nearest = find_nearest_person(person->layer, x, y, max_distance, person))
+		duk_push_string(ctx, nearest->name);
+	else
+		duk_push_null(ctx);
+	return 1;
+}
+
 static duk_ret_t
 js_GetPersonAngle(duk_context* ctx)
 {
@@ -1313,7 +1979,7 @@ js_GetPersonDirection(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "GetPersonDirection(): no such person `%s`", name);
-	duk_push_string(ctx, person->direction);
+	duk_push_string(ctx, get_pose_name(person->direction));
 	return 1;
 }
 
@@ -1337,19 +2003,18 @@ js_GetPersonFollowers(duk_context* ctx)
 {
 	const char* name = duk_require_string(ctx, 0);
 
-	duk_uarridx_t index = 0;
-	person_t*     person;
+	person_t* follower;
+	person_t* person;
 
 	int i;
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "GetPersonFollowers(): no such person `%s`", name);
 	duk_push_array(ctx);
-	for (i = 0; i < s_num_persons; ++i) {
-		if (s_persons[i]->leader == person) {
-			duk_push_string(ctx, s_persons[i]->name);
-			duk_put_prop_index(ctx, -2, index++);
-		}
+	for (i = 0; person->followers != NULL && i < (int)vector_len(person->followers); ++i) {
+		follower = *(person_t**)vector_get(person->followers, i);
+		duk_push_string(ctx, follower->name);
+		duk_put_prop_index(ctx, -2, i);
 	}
 	return 1;
 }
@@ -1492,6 +2157,34 @@ js_GetPersonList(duk_context* ctx)
 	return 1;
 }
 
+static duk_ret_t
+js_GetPersonListInRect(duk_context* ctx)
+{
+	int x = duk_require_int(ctx, 0);
+	int y = duk_require_int(ctx, 1);
+	int width = duk_require_int(ctx, 2);
+	int height = duk_require_int(ctx, 3);
+	int layer = duk_require_map_layer(ctx, 4);
+
+	int       num_persons;
+	person_t* person;
+
+	int i;
+
+	if (!is_map_engine_running())
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "GetPersonListInRect(): map engine must be running");
+	if (width <= 0 || height <= 0)
+		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "GetPersonListInRect(): width and height must be positive (got W: %d, H: %d)", width, height);
+	num_persons = query_persons(layer, new_rect(x, y, x + width - 1, y + height - 1), s_hash_hits);
+	duk_push_array(ctx);
+	for (i = 0; i < num_persons; ++i) {
+		person = *(person_t**)vector_get(s_hash_hits, i);
+		duk_push_string(ctx, person->name);
+		duk_put_prop_index(ctx, -2, i);
+	}
+	return 1;
+}
+
 static duk_ret_t
 js_GetPersonSpriteset(duk_context* ctx)
 {
@@ -1686,10 +2379,13 @@ js_SetPersonDirection(duk_context* ctx)
 	const char* new_dir = duk_require_string(ctx, 1);
 
 	person_t*   person;
+	int         pose_id;
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonDirection(): no such person `%s`", name);
-	set_person_direction(person, new_dir);
+	if ((pose_id = get_pose_id(new_dir)) < 0)
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetPersonDirection(): unable to register direction `%s`", new_dir);
+	set_person_direction(person, pose_id);
 	return 0;
 }
 
@@ -1807,6 +2503,7 @@ js_SetPersonLayer(duk_context* ctx)
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonLayer(): no such person `%s`", name);
 	person->layer = layer;
+	reindex_person(person);
 	return 0;
 }
 
@@ -2011,6 +2708,7 @@ js_SetPersonX(duk_context* ctx)
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonX(): no such person `%s`", name);
 	person->x = x;
+	reindex_person(person);
 	return 0;
 }
 
@@ -2026,6 +2724,7 @@ js_SetPersonXYFloat(duk_context* ctx)
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonXYFloat(): no such person `%s`", name);
 	person->x = x; person->y = y;
+	reindex_person(person);
 	return 0;
 }
 
@@ -2040,6 +2739,7 @@ js_SetPersonY(duk_context* ctx)
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonY(): no such person `%s`", name);
 	person->y = y;
+	reindex_person(person);
 	return 0;
 }
 
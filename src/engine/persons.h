@@ -75,7 +75,7 @@ person_t*    find_person                (const char* name);
 bool         queue_person_command       (person_t* person, int command, bool is_immediate);
 bool         queue_person_script        (person_t* person, script_t* script, bool is_immediate);
 void         reset_persons              (bool keep_existing);
-void         render_persons             (int layer, bool is_flipped, int cam_x, int cam_y);
+void         render_persons             (int layer, bool is_flipped, int cam_x, int cam_y, int repeat_w, int repeat_h);
 void         talk_person                (const person_t* person);
 void         update_persons             (void);
 
@@ -17,16 +17,25 @@ struct screen
 	int              fps_flips;
 	int              fps_frames;
 	double           fps_poll_time;
+	render_stats_t   fps_stats;
 	bool             fullscreen;
 	bool             have_shaders;
 	double           last_flip_time;
+	int              max_prim_verts;
 	int              max_skips;
 	double           next_frame_time;
 	int              num_flips;
 	int              num_frames;
+	int              num_prim_verts;
 	int              num_skips;
+	ALLEGRO_VERTEX*  prim_vbuf;
+#ifdef MINISPHERE_USE_SHADERS
+	ALLEGRO_SHADER*  shader;
+	ALLEGRO_BITMAP*  shader_target;
+#endif
 	bool             show_fps;
 	bool             skip_frame;
+	render_stats_t   stats;
 	bool             take_screenshot;
 	bool             use_shaders;
 	int              x_offset;
@@ -37,6 +46,8 @@ struct screen
 	int              y_size;
 };
 
+static void flush_prims     (screen_t* obj);
+static void flush_sprites   (screen_t* obj);
 static void refresh_display (screen_t* obj);
 
 screen_t*
@@ -116,6 +127,7 @@ screen_free(screen_t* obj)
 	
 	console_log(1, "shutting down render context");
 	al_destroy_display(obj->display);
+	free(obj->prim_vbuf);
 	free(obj);
 }
 
@@ -159,9 +171,22 @@ screen_get_mouse_xy(const screen_t* obj, int* o_x, int* o_y)
 	*o_y = (mouse_state.y - obj->y_offset) / obj->y_scale;
 }
 
+render_stats_t
+screen_get_stats(const screen_t* obj)
+{
+	return obj->fps_stats;
+}
+
+void
+screen_set_blender(screen_t* obj, int op, int src, int dest)
+{
+	screen_set_separate_blender(obj, op, src, dest, op, src, dest);
+}
+
 void
 screen_set_clipping(screen_t* obj, rect_t clip_rect)
 {
+	screen_flush(obj);
 	obj->clip_rect = clip_rect;
 	clip_rect.x1 = clip_rect.x1 * obj->x_scale + obj->x_offset;
 	clip_rect.y1 = clip_rect.y1 * obj->y_scale + obj->y_offset;
@@ -185,6 +210,69 @@ screen_set_mouse_xy(screen_t* obj, int x, int y)
 	al_set_mouse_xy(obj->display, x, y);
 }
 
+void
+screen_set_separate_blender(screen_t* obj, int op, int src, int dest, int alpha_op, int alpha_src, int alpha_dest)
+{
+	int old_op, old_src, old_dest;
+	int old_alpha_op, old_alpha_src, old_alpha_dest;
+
+	// the blender is thread state and not tied to the target, so querying Allegro
+	// is enough to tell whether the switch would be a no-op.
+	al_get_separate_blender(&old_op, &old_src, &old_dest,
+		&old_alpha_op, &old_alpha_src, &old_alpha_dest);
+	if (op == old_op && src == old_src && dest == old_dest
+		&& alpha_op == old_alpha_op && alpha_src == old_alpha_src && alpha_dest == old_alpha_dest)
+	{
+		++obj->stats.num_blenders_elided;
+		return;
+	}
+	screen_flush(obj);
+	al_set_separate_blender(op, src, dest, alpha_op, alpha_src, alpha_dest);
+	++obj->stats.num_blenders;
+}
+
+void
+screen_set_target(screen_t* obj, ALLEGRO_BITMAP* bitmap)
+{
+	// note: al_set_target_bitmap() rebinds the framebuffer and reuploads the
+	//       transformation even when the target doesn't change, so it pays to
+	//       catch that here.
+	if (bitmap == NULL)
+		bitmap = al_get_backbuffer(obj->display);
+	if (bitmap == al_get_target_bitmap()) {
+		++obj->stats.num_targets_elided;
+		return;
+	}
+	screen_flush(obj);
+	al_set_target_bitmap(bitmap);
+#ifdef MINISPHERE_USE_SHADERS
+	// the new target may have a different shader bound, or be a new bitmap that
+	// happens to live at the address of an old one, so the next shader switch
+	// must always go through.
+	obj->shader_target = NULL;
+#endif
+	++obj->stats.num_targets;
+}
+
+void
+screen_batch_sprites(screen_t* obj)
+{
+	// sprites are deferred using Allegro's held drawing, which merges consecutive
+	// bitmap draws sharing a texture into a single draw call.  any state change
+	// or non-bitmap draw must call screen_flush() first.
+	flush_prims(obj);
+	if (!al_is_bitmap_drawing_held())
+		al_hold_bitmap_drawing(true);
+	++obj->stats.num_sprites;
+}
+
+void
+screen_flush(screen_t* obj)
+{
+	flush_prims(obj);
+	flush_sprites(obj);
+}
+
 void
 screen_draw_status(screen_t* obj, const char* text, color_t color)
 {
@@ -203,6 +291,7 @@ screen_draw_status(screen_t* obj, const char* text, color_t color)
 	bounds.y1 = screen_cy - obj->y_offset - height - 8;
 	bounds.x2 = bounds.x1 + width;
 	bounds.y2 = bounds.y1 + height;
+	screen_flush(obj);
 	al_identity_transform(&trans);
 	al_use_transform(&trans);
 	al_draw_filled_rounded_rectangle(bounds.x1, bounds.y1, bounds.x2, bounds.y2, 4, 4,
@@ -211,6 +300,7 @@ screen_draw_status(screen_t* obj, const char* text, color_t color)
 		bounds.y1 + 6, TEXT_ALIGN_CENTER, text);
 	font_draw_text(g_sys_font, color, (bounds.x2 + bounds.x1) / 2,
 		bounds.y1 + 5, TEXT_ALIGN_CENTER, text);
+	screen_flush(obj);
 	screen_transform(obj, NULL);
 }
 
@@ -241,11 +331,22 @@ screen_flip(screen_t* obj, int framerate)
 	if (al_get_time() >= obj->fps_poll_time) {
 		obj->fps_flips = obj->num_flips;
 		obj->fps_frames = obj->num_frames;
+		obj->fps_stats = obj->stats;
 		obj->num_frames = obj->num_flips = 0;
+		memset(&obj->stats, 0, sizeof(render_stats_t));
+		console_log(4, "render state elided: %u/%u targets, %u/%u shaders, %u/%u blenders, %u/%u transforms",
+			obj->fps_stats.num_targets_elided, obj->fps_stats.num_targets_elided + obj->fps_stats.num_targets,
+			obj->fps_stats.num_shaders_elided, obj->fps_stats.num_shaders_elided + obj->fps_stats.num_shaders,
+			obj->fps_stats.num_blenders_elided, obj->fps_stats.num_blenders_elided + obj->fps_stats.num_blenders,
+			obj->fps_stats.num_transforms_elided, obj->fps_stats.num_transforms_elided + obj->fps_stats.num_transforms);
+		console_log(4, "batching: %u sprites in %u batches, %u primitives in %u batches",
+			obj->fps_stats.num_sprites, obj->fps_stats.num_sprite_batches,
+			obj->fps_stats.num_prims, obj->fps_stats.num_prim_batches);
 		obj->fps_poll_time = al_get_time() + 1.0;
 	}
 
 	// flip the backbuffer, unless the preceeding frame was skipped
+	screen_flush(obj);
 	is_backbuffer_valid = !obj->skip_frame;
 	screen_cx = al_get_display_width(obj->display);
 	screen_cy = al_get_display_height(obj->display);
@@ -291,6 +392,7 @@ screen_flip(screen_t* obj, int framerate)
 			al_draw_filled_rounded_rectangle(x, y, x + 100, y + 16, 4, 4, al_map_rgba(16, 16, 16, 192));
 			font_draw_text(g_sys_font, color_new(0, 0, 0, 255), x + 51, y + 3, TEXT_ALIGN_CENTER, fps_text);
 			font_draw_text(g_sys_font, color_new(255, 255, 255, 255), x + 50, y + 2, TEXT_ALIGN_CENTER, fps_text);
+			screen_flush(obj);
 			screen_transform(g_screen, NULL);
 		}
 		al_flip_display();
@@ -351,9 +453,9 @@ screen_grab(screen_t* obj, int x, int y, int width, int height)
 	if (!(image = image_new(scale_width, scale_height)))
 		goto on_error;
 	backbuffer = al_get_backbuffer(obj->display);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(obj, image_bitmap(image));
 	al_draw_bitmap_region(backbuffer, x, y, scale_width, scale_height, 0, 0, 0x0);
-	al_set_target_backbuffer(obj->display);
+	screen_set_target(obj, NULL);
 	if (!image_rescale(image, width, height))
 		goto on_error;
 	return image;
@@ -363,6 +465,35 @@ on_error:
 	return NULL;
 }
 
+ALLEGRO_VERTEX*
+screen_queue_prims(screen_t* obj, int num_vertices)
+{
+	// untextured primitives are queued as a triangle list and drawn in one go
+	// when the queue is flushed.  the caller fills in the vertices returned.
+	
+	ALLEGRO_VERTEX* new_vbuf;
+	int             new_max;
+	ALLEGRO_VERTEX* vertices;
+
+	flush_sprites(obj);
+	if (obj->num_prim_verts + num_vertices > obj->max_prim_verts) {
+		flush_prims(obj);
+		new_max = obj->max_prim_verts > 0 ? obj->max_prim_verts : 1024;
+		while (new_max < num_vertices)
+			new_max *= 2;
+		if (new_max > obj->max_prim_verts) {
+			if (!(new_vbuf = realloc(obj->prim_vbuf, new_max * sizeof(ALLEGRO_VERTEX))))
+				return NULL;
+			obj->prim_vbuf = new_vbuf;
+			obj->max_prim_verts = new_max;
+		}
+	}
+	vertices = obj->prim_vbuf + obj->num_prim_verts;
+	obj->num_prim_verts += num_vertices;
+	++obj->stats.num_prims;
+	return vertices;
+}
+
 void
 screen_queue_screenshot(screen_t* obj)
 {
@@ -412,16 +543,68 @@ screen_transform(screen_t* obj, const matrix_t* matrix)
 		al_scale_transform(&transform, obj->x_scale, obj->y_scale);
 		al_translate_transform(&transform, obj->x_offset, obj->y_offset);
 	}
+	
+	// each bitmap keeps its own transformation, so compare against whatever the
+	// current target has active rather than caching the last one we set.
+	if (memcmp(&transform, al_get_current_transform(), sizeof(ALLEGRO_TRANSFORM)) == 0) {
+		++obj->stats.num_transforms_elided;
+		return;
+	}
+	flush_prims(obj);
 	al_use_transform(&transform);
+	++obj->stats.num_transforms;
 }
 
 void
 screen_unskip_frame(screen_t* obj)
 {
 	obj->skip_frame = false;
+	screen_flush(obj);
 	al_clear_to_color(al_map_rgba(0, 0, 0, 255));
 }
 
+#ifdef MINISPHERE_USE_SHADERS
+bool
+screen_use_shader(screen_t* obj, ALLEGRO_SHADER* shader)
+{
+	ALLEGRO_BITMAP* target;
+
+	// shaders are also per-bitmap in Allegro, so the cached program is only valid
+	// while the same target is bound.  screen_set_target() invalidates it.
+	target = al_get_target_bitmap();
+	if (target != NULL && target == obj->shader_target && shader == obj->shader) {
+		++obj->stats.num_shaders_elided;
+		return true;
+	}
+	screen_flush(obj);
+	if (!al_use_shader(shader))
+		return false;
+	obj->shader = shader;
+	obj->shader_target = target;
+	++obj->stats.num_shaders;
+	return true;
+}
+#endif
+
+static void
+flush_prims(screen_t* obj)
+{
+	if (obj->num_prim_verts == 0)
+		return;
+	al_draw_prim(obj->prim_vbuf, NULL, NULL, 0, obj->num_prim_verts, ALLEGRO_PRIM_TRIANGLE_LIST);
+	obj->num_prim_verts = 0;
+	++obj->stats.num_prim_batches;
+}
+
+static void
+flush_sprites(screen_t* obj)
+{
+	if (!al_is_bitmap_drawing_held())
+		return;
+	al_hold_bitmap_drawing(false);
+	++obj->stats.num_sprite_batches;
+}
+
 static void
 refresh_display(screen_t* obj)
 {
@@ -6,26 +6,53 @@
 
 typedef struct screen screen_t;
 
-screen_t*        screen_new               (const char* title, image_t* icon, int x_size, int y_size, int frameskip, bool avoid_sleep);
-void             screen_free              (screen_t* obj);
-ALLEGRO_DISPLAY* screen_display           (const screen_t* obj);
-bool             screen_have_shaders      (const screen_t* screen);
-bool             screen_is_skipframe      (const screen_t* obj);
-rect_t           screen_get_clipping      (screen_t* obj);
-int              screen_get_frameskip     (const screen_t* obj);
-void             screen_get_mouse_xy      (const screen_t* obj, int* o_x, int* o_y);
-void             screen_set_clipping      (screen_t* obj, rect_t clip_rect);
-void             screen_set_frameskip     (screen_t* obj, int max_skips);
-void             screen_set_mouse_xy      (screen_t* obj, int x, int y);
-void             screen_draw_status       (screen_t* obj, const char* text, color_t color);
-void             screen_flip              (screen_t* obj, int framerate);
-image_t*         screen_grab              (screen_t* obj, int x, int y, int width, int height);
-void             screen_queue_screenshot  (screen_t* obj);
-void             screen_resize            (screen_t* obj, int x_size, int y_size);
-void             screen_show_mouse        (screen_t* obj, bool visible);
-void             screen_toggle_fps        (screen_t* obj);
-void             screen_toggle_fullscreen (screen_t* obj);
-void             screen_transform         (screen_t* obj, const matrix_t* matrix);
-void             screen_unskip_frame      (screen_t* obj);
+typedef
+struct render_stats
+{
+	unsigned int num_blenders;
+	unsigned int num_blenders_elided;
+	unsigned int num_prim_batches;
+	unsigned int num_prims;
+	unsigned int num_shaders;
+	unsigned int num_shaders_elided;
+	unsigned int num_sprite_batches;
+	unsigned int num_sprites;
+	unsigned int num_targets;
+	unsigned int num_targets_elided;
+	unsigned int num_transforms;
+	unsigned int num_transforms_elided;
+} render_stats_t;
+
+screen_t*        screen_new                  (const char* title, image_t* icon, int x_size, int y_size, int frameskip, bool avoid_sleep);
+void             screen_free                 (screen_t* obj);
+ALLEGRO_DISPLAY* screen_display              (const screen_t* obj);
+bool             screen_have_shaders         (const screen_t* screen);
+bool             screen_is_skipframe         (const screen_t* obj);
+rect_t           screen_get_clipping         (screen_t* obj);
+int              screen_get_frameskip        (const screen_t* obj);
+void             screen_get_mouse_xy         (const screen_t* obj, int* o_x, int* o_y);
+render_stats_t   screen_get_stats            (const screen_t* obj);
+void             screen_set_blender          (screen_t* obj, int op, int src, int dest);
+void             screen_set_clipping         (screen_t* obj, rect_t clip_rect);
+void             screen_set_frameskip        (screen_t* obj, int max_skips);
+void             screen_set_mouse_xy         (screen_t* obj, int x, int y);
+void             screen_set_separate_blender (screen_t* obj, int op, int src, int dest, int alpha_op, int alpha_src, int alpha_dest);
+void             screen_set_target           (screen_t* obj, ALLEGRO_BITMAP* bitmap);
+void             screen_batch_sprites        (screen_t* obj);
+void             screen_flush                (screen_t* obj);
+void             screen_draw_status          (screen_t* obj, const char* text, color_t color);
+void             screen_flip                 (screen_t* obj, int framerate);
+image_t*         screen_grab                 (screen_t* obj, int x, int y, int width, int height);
+ALLEGRO_VERTEX*  screen_queue_prims          (screen_t* obj, int num_vertices);
+void             screen_queue_screenshot     (screen_t* obj);
+void             screen_resize               (screen_t* obj, int x_size, int y_size);
+void             screen_show_mouse           (screen_t* obj, bool visible);
+void             screen_toggle_fps           (screen_t* obj);
+void             screen_toggle_fullscreen    (screen_t* obj);
+void             screen_transform            (screen_t* obj, const matrix_t* matrix);
+void             screen_unskip_frame         (screen_t* obj);
+#ifdef MINISPHERE_USE_SHADERS
+bool             screen_use_shader           (screen_t* obj, ALLEGRO_SHADER* shader);
+#endif
 
 #endif // MINISPHERE__DISPLAY_H__INCLUDED
@@ -120,7 +120,7 @@ shader_use(shader_t* shader)
 		console_log(4, "activating null shader");
 	if (s_have_shaders) {
 		al_shader = shader != NULL ? shader->program : NULL;
-		if (!al_use_shader(al_shader))
+		if (!screen_use_shader(g_screen, al_shader))
 			return false;
 		return true;
 	}
@@ -0,0 +1,239 @@
+#include "minisphere.h"
+#include "spatial.h"
+
+#include "vector.h"
+
+// items spanning more than this many cells are kept on a separate list which is
+// checked on every query.  this keeps huge zones from bloating the grid.
+#define MAX_ITEM_CELLS 64
+
+struct spatial
+{
+	int        cell_size;
+	vector_t** cells;
+	vector_t*  large_items;
+	int        num_cols;
+	int        num_rows;
+};
+
+static int  compare_values (const void* in_a, const void* in_b);
+static bool find_cells     (const spatial_t* index, rect_t bounds, int* out_col1, int* out_row1, int* out_col2, int* out_row2);
+static void remove_value   (vector_t* list, int value);
+static void shift_values   (vector_t* list, int value);
+
+spatial_t*
+spatial_new(int width, int height, int cell_size)
+{
+	// a spatial index is a uniform grid of buckets, each listing the items which
+	// overlap that cell.  items outside the grid area are clamped to the edge
+	// cells, so nothing is ever lost; they just become slower to find.  buckets
+	// are only allocated once something is put in them, as most cells of a big
+	// map never hold anything.
+
+	spatial_t* index;
+	int        num_cells;
+
+	if (!(index = calloc(1, sizeof(spatial_t))))
+		return NULL;
+	index->cell_size = cell_size;
+	index->num_cols = fmax(ceil((double)width / cell_size), 1);
+	index->num_rows = fmax(ceil((double)height / cell_size), 1);
+	num_cells = index->num_cols * index->num_rows;
+	if (!(index->cells = calloc(num_cells, sizeof(vector_t*))))
+		goto on_error;
+	if (!(index->large_items = vector_new(sizeof(int))))
+		goto on_error;
+	return index;
+
+on_error:
+	spatial_free(index);
+	return NULL;
+}
+
+void
+spatial_free(spatial_t* index)
+{
+	int i;
+
+	if (index == NULL)
+		return;
+	if (index->cells != NULL) {
+		for (i = 0; i < index->num_cols * index->num_rows; ++i)
+			vector_free(index->cells[i]);
+	}
+	free(index->cells);
+	vector_free(index->large_items);
+	free(index);
+}
+
+void
+spatial_clear(spatial_t* index)
+{
+	int i;
+
+	for (i = 0; i < index->num_cols * index->num_rows; ++i) {
+		if (index->cells[i] != NULL)
+			vector_clear(index->cells[i]);
+	}
+	vector_clear(index->large_items);
+}
+
+bool
+spatial_add(spatial_t* index, int value, rect_t bounds)
+{
+	// if the item can't be bucketed for lack of memory, it goes on the large item
+	// list instead.  it will be checked on every query, but it won't go missing.
+
+	vector_t** p_list;
+	int        col1, row1;
+	int        col2, row2;
+
+	int x, y;
+
+	if (!find_cells(index, bounds, &col1, &row1, &col2, &row2))
+		return vector_push(index->large_items, &value);
+	for (y = row1; y <= row2; ++y) for (x = col1; x <= col2; ++x) {
+		p_list = &index->cells[x + y * index->num_cols];
+		if (*p_list == NULL && !(*p_list = vector_new(sizeof(int))))
+			goto on_error;
+		if (!vector_push(*p_list, &value))
+			goto on_error;
+	}
+	return true;
+
+on_error:
+	spatial_remove(index, value, bounds);
+	return vector_push(index->large_items, &value);
+}
+
+int
+spatial_query(const spatial_t* index, rect_t area, vector_t* out_values)
+{
+	// returns every item which might overlap the area, in ascending order and
+	// without duplicates.  the caller is still expected to do an exact test
+	// since the grid only knows which cells an item touches.
+
+	int       col1, row1;
+	int       col2, row2;
+	vector_t* list;
+	int       num_values;
+	int*      p_value;
+	int*      values;
+
+	int i, x, y;
+
+	vector_clear(out_values);
+	if (!find_cells(index, area, &col1, &row1, &col2, &row2)) {
+		col1 = row1 = 0;
+		col2 = index->num_cols - 1;
+		row2 = index->num_rows - 1;
+	}
+	for (y = row1; y <= row2; ++y) for (x = col1; x <= col2; ++x) {
+		if (!(list = index->cells[x + y * index->num_cols]))
+			continue;
+		for (i = 0; i < (int)vector_len(list); ++i)
+			vector_push(out_values, vector_get(list, i));
+	}
+	for (i = 0; i < (int)vector_len(index->large_items); ++i)
+		vector_push(out_values, vector_get(index->large_items, i));
+	if ((num_values = (int)vector_len(out_values)) == 0)
+		return 0;
+
+	// an item spanning several cells will have been picked up more than once
+	vector_sort(out_values, compare_values);
+	values = vector_get(out_values, 0);
+	p_value = values;
+	for (i = 1; i < num_values; ++i) {
+		if (values[i] != *p_value)
+			*++p_value = values[i];
+	}
+	while ((int)vector_len(out_values) > p_value - values + 1)
+		vector_remove(out_values, vector_len(out_values) - 1);
+	return (int)vector_len(out_values);
+}
+
+void
+spatial_erase(spatial_t* index, int value, rect_t bounds)
+{
+	// for items keyed by their position in an array: removes the item and then
+	// renumbers everything after it to match the array once the item is deleted
+	// from it.  only cells which hold something need to be visited.
+
+	int i;
+
+	spatial_remove(index, value, bounds);
+	for (i = 0; i < index->num_cols * index->num_rows; ++i)
+		shift_values(index->cells[i], value);
+	shift_values(index->large_items, value);
+}
+
+void
+spatial_remove(spatial_t* index, int value, rect_t bounds)
+{
+	int col1, row1;
+	int col2, row2;
+
+	int x, y;
+
+	// the item may have ended up on the large item list even if it's small enough
+	// to be bucketed; see spatial_add().
+	remove_value(index->large_items, value);
+	if (!find_cells(index, bounds, &col1, &row1, &col2, &row2))
+		return;
+	for (y = row1; y <= row2; ++y) for (x = col1; x <= col2; ++x)
+		remove_value(index->cells[x + y * index->num_cols], value);
+}
+
+static int
+compare_values(const void* in_a, const void* in_b)
+{
+	int a = *(const int*)in_a;
+	int b = *(const int*)in_b;
+
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static bool
+find_cells(const spatial_t* index, rect_t bounds, int* out_col1, int* out_row1, int* out_col2, int* out_row2)
+{
+	// returns false if the rectangle spans too many cells to be worth bucketing
+
+	normalize_rect(&bounds);
+	*out_col1 = fmin(fmax(floor((double)bounds.x1 / index->cell_size), 0), index->num_cols - 1);
+	*out_row1 = fmin(fmax(floor((double)bounds.y1 / index->cell_size), 0), index->num_rows - 1);
+	*out_col2 = fmin(fmax(floor((double)bounds.x2 / index->cell_size), 0), index->num_cols - 1);
+	*out_row2 = fmin(fmax(floor((double)bounds.y2 / index->cell_size), 0), index->num_rows - 1);
+	return (*out_col2 - *out_col1 + 1) * (*out_row2 - *out_row1 + 1) <= MAX_ITEM_CELLS;
+}
+
+static void
+remove_value(vector_t* list, int value)
+{
+	iter_t iter;
+	int*   p_value;
+
+	if (list == NULL)
+		return;
+	iter = vector_enum(list);
+	while (p_value = vector_next(&iter)) {
+		if (*p_value == value) {
+			iter_remove(&iter);
+			return;
+		}
+	}
+}
+
+static void
+shift_values(vector_t* list, int value)
+{
+	iter_t iter;
+	int*   p_value;
+
+	if (list == NULL)
+		return;
+	iter = vector_enum(list);
+	while (p_value = vector_next(&iter)) {
+		if (*p_value > value)
+			--*p_value;
+	}
+}
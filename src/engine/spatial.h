@@ -0,0 +1,16 @@
+#ifndef MINISPHERE__SPATIAL_H__INCLUDED
+#define MINISPHERE__SPATIAL_H__INCLUDED
+
+#include "vector.h"
+
+typedef struct spatial spatial_t;
+
+spatial_t* spatial_new    (int width, int height, int cell_size);
+void       spatial_free   (spatial_t* index);
+void       spatial_clear  (spatial_t* index);
+bool       spatial_add    (spatial_t* index, int value, rect_t bounds);
+void       spatial_erase  (spatial_t* index, int value, rect_t bounds);
+int        spatial_query  (const spatial_t* index, rect_t area, vector_t* out_values);
+void       spatial_remove (spatial_t* index, int value, rect_t bounds);
+
+#endif // MINISPHERE__SPATIAL_H__INCLUDED
@@ -5,11 +5,12 @@
 
 struct spk
 {
-	unsigned int  refcount;
-	unsigned int  id;
-	path_t*       path;
-	ALLEGRO_FILE* file;
-	vector_t*     index;
+	unsigned int   refcount;
+	unsigned int   id;
+	path_t*        path;
+	ALLEGRO_FILE*  file;
+	vector_t*      index;
+	ALLEGRO_MUTEX* mutex;
 };
 
 struct spk_entry
@@ -64,6 +65,9 @@ open_spk(const char* path)
 	
 	spk = calloc(1, sizeof(spk_t));
 
+	// files may be unpacked from a background thread, e.g. when preloading a map,
+	// so access to the package file and the refcount is serialized.
+	if (!(spk->mutex = al_create_mutex())) goto on_error;
 	if (!(spk->file = al_fopen(path, "rb"))) goto on_error;
 	if (al_fread(spk->file, &spk_hdr, sizeof(struct spk_header)) != sizeof(struct spk_header))
 		goto on_error;
@@ -97,6 +101,8 @@ on_error:
 		path_free(spk->path);
 		if (spk->file != NULL)
 			al_fclose(spk->file);
+		if (spk->mutex != NULL)
+			al_destroy_mutex(spk->mutex);
 		vector_free(spk->index);
 		free(spk);
 	}
@@ -106,19 +112,29 @@ on_error:
 spk_t*
 ref_spk(spk_t* spk)
 {
+	al_lock_mutex(spk->mutex);
 	++spk->refcount;
+	al_unlock_mutex(spk->mutex);
 	return spk;
 }
 
 void
 free_spk(spk_t* spk)
 {
-	if (spk == NULL || --spk->refcount > 0)
+	unsigned int refcount;
+
+	if (spk == NULL)
+		return;
+	al_lock_mutex(spk->mutex);
+	refcount = --spk->refcount;
+	al_unlock_mutex(spk->mutex);
+	if (refcount > 0)
 		return;
 	
 	console_log(4, "disposing SPK #%u no longer in use", spk->id);
 	vector_free(spk->index);
 	al_fclose(spk->file);
+	al_destroy_mutex(spk->mutex);
 	free(spk);
 }
 
@@ -252,6 +268,7 @@ spk_fslurp(spk_t* spk, const char* path, size_t *out_size)
 {
 	struct spk_entry* fileinfo;
 	void*             packdata = NULL;
+	size_t            read_size;
 	void*             unpacked = NULL;
 	uLong             unpack_size;
 
@@ -267,8 +284,11 @@ spk_fslurp(spk_t* spk, const char* path, size_t *out_size)
 	if (fileinfo == NULL) goto on_error;
 	if (!(packdata = malloc(fileinfo->pack_size)))
 		goto on_error;
+	al_lock_mutex(spk->mutex);
 	al_fseek(spk->file, fileinfo->offset, ALLEGRO_SEEK_SET);
-	if (al_fread(spk->file, packdata, fileinfo->pack_size) < fileinfo->pack_size)
+	read_size = al_fread(spk->file, packdata, fileinfo->pack_size);
+	al_unlock_mutex(spk->mutex);
+	if (read_size < fileinfo->pack_size)
 		goto on_error;
 	if (!(unpacked = malloc(fileinfo->file_size + 1)))
 		goto on_error;
@@ -51,22 +51,36 @@ struct rss_frame_v3
 
 
 static const spriteset_pose_t* find_sprite_pose (const spriteset_t* spriteset, const char* pose_name);
+static const spriteset_pose_t* get_pose         (const spriteset_t* spriteset, int pose_id);
+static void                    map_pose_ids     (spriteset_t* spriteset);
 
 static vector_t*    s_load_cache;
+static vector_t*    s_pose_names = NULL;
 static unsigned int s_next_spriteset_id = 0;
 static unsigned int s_num_cache_hits = 0;
 
 void
 initialize_spritesets(void)
 {
+	const char* const def_dir_names[8] = {
+		"north", "northeast", "east", "southeast",
+		"south", "southwest", "west", "northwest"
+	};
+
+	int i;
+	
 	console_log(1, "initializing spriteset manager");
 	s_load_cache = vector_new(sizeof(spriteset_t*));
+	s_pose_names = vector_new(sizeof(char*));
+	for (i = 0; i < 8; ++i)
+		get_pose_id(def_dir_names[i]);
 }
 
 void
 shutdown_spritesets(void)
 {
 	iter_t        iter;
+	char*         *p_name;
 	spriteset_t** p_spriteset;
 	
 	console_log(1, "shutting down spriteset manager");
@@ -78,6 +92,12 @@ shutdown_spritesets(void)
 			free_spriteset(*p_spriteset);
 		vector_free(s_load_cache);
 	}
+	if (s_pose_names != NULL) {
+		iter = vector_enum(s_pose_names);
+		while (p_name = vector_next(&iter))
+			free(*p_name);
+		vector_free(s_pose_names);
+	}
 }
 
 spriteset_t*
@@ -109,6 +129,7 @@ clone_spriteset(const spriteset_t* spriteset)
 		for (j = 0; j < spriteset->poses[i].num_frames; ++j)
 			clone->poses[i].frames[j] = spriteset->poses[i].frames[j];
 	}
+	map_pose_ids(clone);
 	clone->id = s_next_spriteset_id++;
 	
 	return ref_spriteset(clone);
@@ -195,7 +216,7 @@ load_spriteset(const char* filename)
 			spriteset->poses[i].name = lstr_newf("%s", def_dir_names[i]);
 		if ((spriteset->images = calloc(spriteset->num_images, sizeof(image_t*))) == NULL)
 			goto on_error;
-		if (!(atlas = atlas_new(spriteset->num_images, rss.frame_width, rss.frame_height)))
+		if (!(atlas = atlas_new_shared(spriteset->num_images, rss.frame_width, rss.frame_height)))
 			goto on_error;
 		atlas_lock(atlas);
 		for (i = 0; i < spriteset->num_images; ++i) {
@@ -245,7 +266,7 @@ load_spriteset(const char* filename)
 			goto on_error;
 
 		// pass 2 - read images and frame data
-		if (!(atlas = atlas_new(spriteset->num_images, max_width, max_height)))
+		if (!(atlas = atlas_new_shared(spriteset->num_images, max_width, max_height)))
 			goto on_error;
 		sfs_fseek(file, v2_data_offset, SFS_SEEK_SET);
 		image_index = 0;
@@ -274,7 +295,7 @@ load_spriteset(const char* filename)
 			goto on_error;
 		if ((spriteset->poses = calloc(spriteset->num_poses, sizeof(spriteset_pose_t))) == NULL)
 			goto on_error;
-		if (!(atlas = atlas_new(spriteset->num_images, rss.frame_width, rss.frame_height)))
+		if (!(atlas = atlas_new_shared(spriteset->num_images, rss.frame_width, rss.frame_height)))
 			goto on_error;
 		atlas_lock(atlas);
 		for (i = 0; i < rss.num_images; ++i) {
@@ -302,6 +323,7 @@ load_spriteset(const char* filename)
 		goto on_error;
 	}
 	sfs_fclose(file);
+	map_pose_ids(spriteset);
 	
 	if (s_load_cache != NULL) {
 		while (vector_len(s_load_cache) >= 10) {
@@ -359,10 +381,45 @@ free_spriteset(spriteset_t* spriteset)
 		lstr_free(spriteset->poses[i].name);
 	}
 	free(spriteset->poses);
+	free(spriteset->pose_table);
 	free(spriteset->filename);
 	free(spriteset);
 }
 
+int
+get_pose_id(const char* pose_name)
+{
+	// pose names are compared case-sensitively here so that the original name can
+	// be handed back to script code.  case-insensitive matching against the
+	// spriteset's poses happens when an ID is first looked up in a spriteset.
+	
+	char*  name;
+	char** p_name;
+
+	iter_t iter;
+
+	iter = vector_enum(s_pose_names);
+	while (p_name = vector_next(&iter)) {
+		if (strcmp(pose_name, *p_name) == 0)
+			return (int)iter.index;
+	}
+	if (!(name = strdup(pose_name)))
+		return -1;
+	if (!vector_push(s_pose_names, &name)) {
+		free(name);
+		return -1;
+	}
+	return (int)vector_len(s_pose_names) - 1;
+}
+
+const char*
+get_pose_name(int pose_id)
+{
+	if (pose_id < 0 || pose_id >= (int)vector_len(s_pose_names))
+		return "";
+	return *(char**)vector_get(s_pose_names, pose_id);
+}
+
 rect_t
 get_sprite_base(const spriteset_t* spriteset)
 {
@@ -370,11 +427,11 @@ get_sprite_base(const spriteset_t* spriteset)
 }
 
 int
-get_sprite_frame_delay(const spriteset_t* spriteset, const char* pose_name, int frame_index)
+get_sprite_frame_delay(const spriteset_t* spriteset, int pose_id, int frame_index)
 {
 	const spriteset_pose_t* pose;
 	
-	if ((pose = find_sprite_pose(spriteset, pose_name)) == NULL)
+	if ((pose = get_pose(spriteset, pose_id)) == NULL)
 		return 0;
 	frame_index %= pose->num_frames;
 	return pose->frames[frame_index].delay;
@@ -404,11 +461,11 @@ get_spriteset_image(const spriteset_t* spriteset, int image_index)
 }
 
 bool
-get_spriteset_pose_info(const spriteset_t* spriteset, const char* pose_name, int* out_num_frames)
+get_spriteset_pose_info(const spriteset_t* spriteset, int pose_id, int* out_num_frames)
 {
 	const spriteset_pose_t* pose;
 
-	if ((pose = find_sprite_pose(spriteset, pose_name)) == NULL)
+	if ((pose = get_pose(spriteset, pose_id)) == NULL)
 		return false;
 	*out_num_frames = pose->num_frames;
 	return true;
@@ -425,7 +482,7 @@ set_spriteset_image(spriteset_t* spriteset, int image_index, image_t* image)
 }
 
 void
-draw_sprite(const spriteset_t* spriteset, color_t mask, bool is_flipped, double theta, double scale_x, double scale_y, const char* pose_name, float x, float y, int frame_index)
+draw_sprite(const spriteset_t* spriteset, color_t mask, bool is_flipped, double theta, double scale_x, double scale_y, int pose_id, float x, float y, int frame_index)
 {
 	rect_t                   base;
 	image_t*                 image;
@@ -434,7 +491,7 @@ draw_sprite(const spriteset_t* spriteset, color_t mask, bool is_flipped, double
 	const spriteset_pose_t*  pose;
 	float                    scale_w, scale_h;
 	
-	if ((pose = find_sprite_pose(spriteset, pose_name)) == NULL)
+	if ((pose = get_pose(spriteset, pose_id)) == NULL)
 		return;
 	frame_index = frame_index % pose->num_frames;
 	image_index = pose->frames[frame_index].image_idx;
@@ -449,6 +506,7 @@ draw_sprite(const spriteset_t* spriteset, color_t mask, bool is_flipped, double
 	scale_h = image_h * scale_y;
 	if (x + scale_w <= 0 || x >= g_res_x || y + scale_h <= 0 || y >= g_res_y)
 		return;
+	screen_batch_sprites(g_screen);
 	al_draw_tinted_scaled_rotated_bitmap(image_bitmap(image), al_map_rgba(mask.r, mask.g, mask.b, mask.a),
 		(float)image_w / 2, (float)image_h / 2, x + scale_w / 2, y + scale_h / 2,
 		scale_x, scale_y, theta, is_flipped ? ALLEGRO_FLIP_VERTICAL : 0x0);
@@ -483,3 +541,51 @@ find_sprite_pose(const spriteset_t* spriteset, const char* pose_name)
 	}
 	return pose != NULL ? pose : &spriteset->poses[0];
 }
+
+static const spriteset_pose_t*
+get_pose(const spriteset_t* spriteset, int pose_id)
+{
+	// each spriteset caches which of its poses every pose ID maps to.  IDs may be
+	// interned long after the spriteset was loaded, so the table is extended
+	// as needed.  it's only a cache, so it's updated even through a const pointer.
+
+	spriteset_t* cache;
+	int          index;
+	int          new_size;
+	int*         new_table;
+
+	int i;
+
+	if (pose_id < 0)
+		return &spriteset->poses[0];
+	cache = (spriteset_t*)spriteset;
+	if (pose_id >= spriteset->num_pose_ids) {
+		new_size = fmax(pose_id + 1, vector_len(s_pose_names));
+		if (!(new_table = realloc(cache->pose_table, new_size * sizeof(int))))
+			return find_sprite_pose(spriteset, get_pose_name(pose_id));
+		for (i = spriteset->num_pose_ids; i < new_size; ++i)
+			new_table[i] = -1;
+		cache->pose_table = new_table;
+		cache->num_pose_ids = new_size;
+	}
+	if ((index = spriteset->pose_table[pose_id]) < 0) {
+		index = (int)(find_sprite_pose(spriteset, get_pose_name(pose_id)) - spriteset->poses);
+		cache->pose_table[pose_id] = index;
+	}
+	return &spriteset->poses[index];
+}
+
+static void
+map_pose_ids(spriteset_t* spriteset)
+{
+	// intern the spriteset's pose names up front, so persons switching between
+	// them never need to search the pose list.
+
+	int i;
+
+	for (i = 0; i < spriteset->num_poses; ++i)
+		get_pose(spriteset, get_pose_id(lstr_cstr(spriteset->poses[i].name)));
+	for (i = POSE_NORTH; i <= POSE_NORTHWEST; ++i)
+		get_pose(spriteset, i);
+}
+
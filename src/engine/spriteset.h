@@ -8,6 +8,21 @@ typedef struct spriteset_base  spriteset_base_t;
 typedef struct spriteset_pose  spriteset_pose_t;
 typedef struct spriteset_frame spriteset_frame_t;
 
+// pose names are interned to small integer IDs, so that the map engine can track
+// and look up poses without doing any string work.  the standard directions are
+// always interned first and therefore have fixed IDs.
+enum pose_id
+{
+	POSE_NORTH,
+	POSE_NORTHEAST,
+	POSE_EAST,
+	POSE_SOUTHEAST,
+	POSE_SOUTH,
+	POSE_SOUTHWEST,
+	POSE_WEST,
+	POSE_NORTHWEST
+};
+
 struct spriteset_frame
 {
 	int image_idx;
@@ -29,7 +44,9 @@ struct spriteset
 	char*            filename;
 	int              num_images;
 	int              num_poses;
+	int              num_pose_ids;
 	image_t*         *images;
+	int*             pose_table;
 	spriteset_pose_t *poses;
 };
 
@@ -39,13 +56,15 @@ spriteset_t* clone_spriteset         (const spriteset_t* spriteset);
 spriteset_t* load_spriteset          (const char* filename);
 spriteset_t* ref_spriteset           (spriteset_t* spriteset);
 void         free_spriteset          (spriteset_t* spriteset);
+int          get_pose_id             (const char* pose_name);
+const char*  get_pose_name           (int pose_id);
 rect_t       get_sprite_base         (const spriteset_t* spriteset);
-int          get_sprite_frame_delay  (const spriteset_t* spriteset, const char* pose_name, int frame_index);
+int          get_sprite_frame_delay  (const spriteset_t* spriteset, int pose_id, int frame_index);
 void         get_sprite_size         (const spriteset_t* spriteset, int* out_width, int* out_height);
 image_t*     get_spriteset_image     (const spriteset_t* spriteset, int index);
 void         get_spriteset_info      (const spriteset_t* spriteset, int* out_num_images, int* out_num_poses);
-bool         get_spriteset_pose_info (const spriteset_t* spriteset, const char* pose_name, int* out_num_frames);
+bool         get_spriteset_pose_info (const spriteset_t* spriteset, int pose_id, int* out_num_frames);
 void         set_spriteset_image     (spriteset_t* spriteset, int index, image_t* image);
-void         draw_sprite             (const spriteset_t* spriteset, color_t mask, bool is_flipped, double theta, double scale_x, double scale_y, const char* pose_name, float x, float y, int frame_index);
+void         draw_sprite             (const spriteset_t* spriteset, color_t mask, bool is_flipped, double theta, double scale_x, double scale_y, int pose_id, float x, float y, int frame_index);
 
 #endif // MINISPHERE__SPRITESET_H__INCLUDED
@@ -0,0 +1,345 @@
+#include "minisphere.h"
+#include "tilemap.h"
+
+// tiles are stored in square chunks of 16-bit indices.  a chunk in which every
+// tile is the same doesn't store any tiles at all, only that one index, and gets
+// its own storage the first time a different tile is written to it.  large maps
+// tend to be mostly empty or filled with a single tile, so most chunks end up
+// costing next to nothing.
+#define CHUNK_SIZE 32
+
+struct tilemap
+{
+	int           width;
+	int           height;
+	int           num_cols;
+	int           num_rows;
+	struct chunk* chunks;
+};
+
+struct chunk
+{
+	uint16_t  fill_index;
+	uint16_t* tiles;
+};
+
+static struct chunk* get_chunk        (const tilemap_t* tilemap, int x, int y);
+static void          get_chunk_extent (const tilemap_t* tilemap, int col, int row, int* out_width, int* out_height);
+static void          merge_chunk      (const tilemap_t* tilemap, int col, int row);
+static bool          split_chunk      (struct chunk* chunk);
+
+tilemap_t*
+tilemap_new(int width, int height, int fill_index)
+{
+	tilemap_t* tilemap;
+	int        num_chunks;
+
+	int i;
+
+	if (width <= 0 || height <= 0)
+		return NULL;
+	if (fill_index < -1 || fill_index >= TILEMAP_NO_TILE)
+		return NULL;
+	if (!(tilemap = calloc(1, sizeof(tilemap_t))))
+		return NULL;
+	tilemap->width = width;
+	tilemap->height = height;
+	tilemap->num_cols = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	tilemap->num_rows = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	num_chunks = tilemap->num_cols * tilemap->num_rows;
+	if (!(tilemap->chunks = calloc(num_chunks, sizeof(struct chunk)))) {
+		free(tilemap);
+		return NULL;
+	}
+	for (i = 0; i < num_chunks; ++i)
+		tilemap->chunks[i].fill_index = (uint16_t)fill_index;
+	return tilemap;
+}
+
+void
+tilemap_free(tilemap_t* tilemap)
+{
+	int num_chunks;
+
+	int i;
+
+	if (tilemap == NULL)
+		return;
+	num_chunks = tilemap->num_cols * tilemap->num_rows;
+	for (i = 0; i < num_chunks; ++i)
+		free(tilemap->chunks[i].tiles);
+	free(tilemap->chunks);
+	free(tilemap);
+}
+
+void
+tilemap_compact(tilemap_t* tilemap)
+{
+	// gives back the storage for any chunks which have since become uniform.
+	// this is worth doing after filling in a tilemap wholesale, e.g. when loading
+	// a map, as every chunk touched will have been split along the way.
+
+	int col, row;
+
+	for (row = 0; row < tilemap->num_rows; ++row) for (col = 0; col < tilemap->num_cols; ++col)
+		merge_chunk(tilemap, col, row);
+}
+
+int
+tilemap_get(const tilemap_t* tilemap, int x, int y)
+{
+	const struct chunk* chunk;
+	uint16_t            tile_index;
+
+	if (x < 0 || y < 0 || x >= tilemap->width || y >= tilemap->height)
+		return -1;
+	chunk = get_chunk(tilemap, x, y);
+	tile_index = chunk->tiles != NULL
+		? chunk->tiles[x % CHUNK_SIZE + y % CHUNK_SIZE * CHUNK_SIZE]
+		: chunk->fill_index;
+	return tile_index != TILEMAP_NO_TILE ? tile_index : -1;
+}
+
+bool
+tilemap_get_rect(const tilemap_t* tilemap, int x, int y, int width, int height, uint16_t* out_indices)
+{
+	// note: unlike tilemap_get(), this returns raw indices; empty tiles are
+	//       reported as TILEMAP_NO_TILE.
+
+	const struct chunk* chunk;
+
+	int i_x, i_y;
+
+	if (x < 0 || y < 0 || width < 0 || height < 0
+		|| x + width > tilemap->width || y + height > tilemap->height)
+	{
+		return false;
+	}
+	for (i_y = y; i_y < y + height; ++i_y) for (i_x = x; i_x < x + width; ++i_x) {
+		chunk = get_chunk(tilemap, i_x, i_y);
+		*out_indices++ = chunk->tiles != NULL
+			? chunk->tiles[i_x % CHUNK_SIZE + i_y % CHUNK_SIZE * CHUNK_SIZE]
+			: chunk->fill_index;
+	}
+	return true;
+}
+
+int
+tilemap_replace(tilemap_t* tilemap, int old_index, int new_index, vector_t* out_rects)
+{
+	// replaces every instance of one tile with another and returns the number of
+	// tiles changed.  a uniform chunk can be changed in one go, so replacing the
+	// tile a layer is filled with costs almost nothing.  if out_rects isn't NULL,
+	// the bounds of the changes in each chunk touched are pushed to it, so the
+	// caller can refresh only those parts of the map.
+	// note: if a rect can't be recorded, out_rects is left empty even though
+	//       tiles were replaced; the caller should then assume the whole map
+	//       changed.
+
+	struct chunk* chunk;
+	rect_t        bounds;
+	bool          is_tracking;
+	int           num_changed;
+	int           num_replaced = 0;
+	uint16_t*     p_tile;
+	int           width, height;
+
+	int col, row;
+	int x, y;
+
+	if (old_index < -1 || old_index >= TILEMAP_NO_TILE || new_index < -1 || new_index >= TILEMAP_NO_TILE)
+		return 0;
+	if (old_index == new_index)
+		return 0;
+	is_tracking = out_rects != NULL;
+	for (row = 0; row < tilemap->num_rows; ++row) for (col = 0; col < tilemap->num_cols; ++col) {
+		chunk = &tilemap->chunks[col + row * tilemap->num_cols];
+		get_chunk_extent(tilemap, col, row, &width, &height);
+		num_changed = 0;
+		if (chunk->tiles == NULL) {
+			if (chunk->fill_index != (uint16_t)old_index)
+				continue;
+			chunk->fill_index = (uint16_t)new_index;
+			bounds = new_rect(0, 0, width, height);
+			num_changed = width * height;
+		}
+		else {
+			bounds = new_rect(width, height, 0, 0);
+			for (y = 0; y < height; ++y) for (x = 0; x < width; ++x) {
+				p_tile = &chunk->tiles[x + y * CHUNK_SIZE];
+				if (*p_tile == (uint16_t)old_index) {
+					*p_tile = (uint16_t)new_index;
+					bounds.x1 = x < bounds.x1 ? x : bounds.x1;
+					bounds.y1 = y < bounds.y1 ? y : bounds.y1;
+					bounds.x2 = x + 1 > bounds.x2 ? x + 1 : bounds.x2;
+					bounds.y2 = y + 1 > bounds.y2 ? y + 1 : bounds.y2;
+					++num_changed;
+				}
+			}
+		}
+		if (num_changed > 0 && is_tracking) {
+			bounds = new_rect(
+				bounds.x1 + col * CHUNK_SIZE, bounds.y1 + row * CHUNK_SIZE,
+				bounds.x2 + col * CHUNK_SIZE, bounds.y2 + row * CHUNK_SIZE);
+			if (!vector_push(out_rects, &bounds)) {
+				vector_clear(out_rects);
+				is_tracking = false;
+			}
+		}
+		num_replaced += num_changed;
+	}
+	return num_replaced;
+}
+
+bool
+tilemap_resize(tilemap_t* tilemap, int width, int height, int fill_index)
+{
+	// chunks lying entirely within both the old and new bounds are carried over
+	// as-is.  anything along the edges is copied tile by tile.
+
+	struct chunk* chunk;
+	int           copy_w, copy_h;
+	int           num_chunks;
+	struct chunk* old_chunk;
+	tilemap_t*    resized;
+
+	int col, row;
+	int i;
+	int x, y;
+
+	if (!(resized = tilemap_new(width, height, fill_index)))
+		return false;
+	copy_w = fmin(width, tilemap->width);
+	copy_h = fmin(height, tilemap->height);
+	for (row = 0; row < resized->num_rows && row < tilemap->num_rows; ++row)
+	for (col = 0; col < resized->num_cols && col < tilemap->num_cols; ++col)
+	{
+		chunk = &resized->chunks[col + row * resized->num_cols];
+		old_chunk = &tilemap->chunks[col + row * tilemap->num_cols];
+		if ((col + 1) * CHUNK_SIZE <= copy_w && (row + 1) * CHUNK_SIZE <= copy_h) {
+			*chunk = *old_chunk;
+			old_chunk->tiles = NULL;
+			continue;
+		}
+		for (y = row * CHUNK_SIZE; y < (row + 1) * CHUNK_SIZE && y < copy_h; ++y)
+		for (x = col * CHUNK_SIZE; x < (col + 1) * CHUNK_SIZE && x < copy_w; ++x)
+		{
+			if (!tilemap_set(resized, x, y, tilemap_get(tilemap, x, y))) {
+				tilemap_free(resized);
+				return false;
+			}
+		}
+	}
+
+	// swap in the new chunks and free the old ones.  any chunks that were carried
+	// over have already been detached from the old tilemap.
+	num_chunks = tilemap->num_cols * tilemap->num_rows;
+	for (i = 0; i < num_chunks; ++i)
+		free(tilemap->chunks[i].tiles);
+	free(tilemap->chunks);
+	*tilemap = *resized;
+	free(resized);
+	return true;
+}
+
+bool
+tilemap_set(tilemap_t* tilemap, int x, int y, int tile_index)
+{
+	struct chunk* chunk;
+
+	if (x < 0 || y < 0 || x >= tilemap->width || y >= tilemap->height)
+		return false;
+	if (tile_index < -1 || tile_index >= TILEMAP_NO_TILE)
+		return false;
+	chunk = get_chunk(tilemap, x, y);
+	if (chunk->tiles == NULL) {
+		if (chunk->fill_index == (uint16_t)tile_index)
+			return true;
+		if (!split_chunk(chunk))
+			return false;
+	}
+	chunk->tiles[x % CHUNK_SIZE + y % CHUNK_SIZE * CHUNK_SIZE] = (uint16_t)tile_index;
+	return true;
+}
+
+bool
+tilemap_set_rect(tilemap_t* tilemap, int x, int y, int width, int height, const uint16_t* indices)
+{
+	// note: indices are raw, i.e. TILEMAP_NO_TILE clears a tile.
+
+	struct chunk* chunk;
+	uint16_t      tile_index;
+
+	int i_x, i_y;
+
+	if (x < 0 || y < 0 || width < 0 || height < 0
+		|| x + width > tilemap->width || y + height > tilemap->height)
+	{
+		return false;
+	}
+	for (i_y = y; i_y < y + height; ++i_y) for (i_x = x; i_x < x + width; ++i_x) {
+		tile_index = *indices++;
+		chunk = get_chunk(tilemap, i_x, i_y);
+		if (chunk->tiles == NULL) {
+			if (chunk->fill_index == tile_index)
+				continue;
+			if (!split_chunk(chunk))
+				return false;
+		}
+		chunk->tiles[i_x % CHUNK_SIZE + i_y % CHUNK_SIZE * CHUNK_SIZE] = tile_index;
+	}
+	return true;
+}
+
+static struct chunk*
+get_chunk(const tilemap_t* tilemap, int x, int y)
+{
+	return &tilemap->chunks[x / CHUNK_SIZE + y / CHUNK_SIZE * tilemap->num_cols];
+}
+
+static void
+get_chunk_extent(const tilemap_t* tilemap, int col, int row, int* out_width, int* out_height)
+{
+	// chunks along the right and bottom edges of the map may be only partially
+	// used; tiles outside the map are never looked at.
+	*out_width = fmin(CHUNK_SIZE, tilemap->width - col * CHUNK_SIZE);
+	*out_height = fmin(CHUNK_SIZE, tilemap->height - row * CHUNK_SIZE);
+}
+
+static void
+merge_chunk(const tilemap_t* tilemap, int col, int row)
+{
+	struct chunk* chunk;
+	uint16_t      tile_index;
+	int           width, height;
+
+	int x, y;
+
+	chunk = &tilemap->chunks[col + row * tilemap->num_cols];
+	if (chunk->tiles == NULL)
+		return;
+	get_chunk_extent(tilemap, col, row, &width, &height);
+	tile_index = chunk->tiles[0];
+	for (y = 0; y < height; ++y) for (x = 0; x < width; ++x) {
+		if (chunk->tiles[x + y * CHUNK_SIZE] != tile_index)
+			return;
+	}
+	free(chunk->tiles);
+	chunk->tiles = NULL;
+	chunk->fill_index = tile_index;
+}
+
+static bool
+split_chunk(struct chunk* chunk)
+{
+	// gives a uniform chunk its own tile storage so that individual tiles can be
+	// changed.
+
+	int i;
+
+	if (!(chunk->tiles = malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(uint16_t))))
+		return false;
+	for (i = 0; i < CHUNK_SIZE * CHUNK_SIZE; ++i)
+		chunk->tiles[i] = chunk->fill_index;
+	return true;
+}
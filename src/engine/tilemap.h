@@ -0,0 +1,20 @@
+#ifndef MINISPHERE__TILEMAP_H__INCLUDED
+#define MINISPHERE__TILEMAP_H__INCLUDED
+
+// tile indices are stored in 16 bits.  the highest index is reserved to mean
+// "no tile" and reads back as -1 from tilemap_get().
+#define TILEMAP_NO_TILE 0xFFFF
+
+typedef struct tilemap tilemap_t;
+
+tilemap_t* tilemap_new      (int width, int height, int fill_index);
+void       tilemap_free     (tilemap_t* tilemap);
+void       tilemap_compact  (tilemap_t* tilemap);
+int        tilemap_get      (const tilemap_t* tilemap, int x, int y);
+bool       tilemap_get_rect (const tilemap_t* tilemap, int x, int y, int width, int height, uint16_t* out_indices);
+int        tilemap_replace  (tilemap_t* tilemap, int old_index, int new_index, vector_t* out_rects);
+bool       tilemap_resize   (tilemap_t* tilemap, int width, int height, int fill_index);
+bool       tilemap_set      (tilemap_t* tilemap, int x, int y, int tile_index);
+bool       tilemap_set_rect (tilemap_t* tilemap, int x, int y, int width, int height, const uint16_t* indices);
+
+#endif // MINISPHERE__TILEMAP_H__INCLUDED
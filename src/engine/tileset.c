@@ -4,31 +4,44 @@
 #include "atlas.h"
 #include "image.h"
 #include "obsmap.h"
+#include "vector.h"
+
+#define WHEEL_SIZE 64
 
 struct tileset
 {
 	unsigned int id;
 	atlas_t*     atlas;
-	int          atlas_pitch;
+	vector_t*    changed;
+	unsigned int frame;
 	int          height;
-	image_t*     texture;
+	int          mask_pitch;
 	int          num_tiles;
+	color_t*     pixels;
 	struct tile* tiles;
+	vector_t**   wheel;
 	int          width;
 };
 
 struct tile
 {
 	int        delay;
-	int        frames_left;
 	image_t*   image;
 	int        image_index;
+	bool       is_animating;
 	lstring_t* name;
 	int        next_index;
 	int        num_obs_lines;
+	uint32_t*  obs_mask;
 	obsmap_t*  obsmap;
 };
 
+struct tile_event
+{
+	unsigned int frame;
+	int          tile_index;
+};
+
 #pragma pack(push, 1)
 struct rts_header
 {
@@ -58,6 +71,9 @@ struct rts_tile_header
 };
 #pragma pack(pop)
 
+static bool rasterize_line (uint32_t* mask, int pitch, int width, int height, rect_t line);
+static bool schedule_tile  (tileset_t* tileset, int tile_index, int delay);
+
 static unsigned int s_next_tileset_id = 0;
 
 tileset_t*
@@ -82,8 +98,28 @@ on_error:
 tileset_t*
 tileset_read(sfs_file_t* file)
 {
-	atlas_t*               atlas = NULL;
+	tileset_t* tileset;
+
+	if (!(tileset = tileset_decode(file)))
+		return NULL;
+	if (!tileset_upload(tileset)) {
+		tileset_free(tileset);
+		return NULL;
+	}
+	return tileset;
+}
+
+tileset_t*
+tileset_decode(sfs_file_t* file)
+{
+	// reads in a tileset without touching the GPU: the tile images are decoded
+	// into memory and only turned into textures by tileset_upload().  this makes
+	// it safe to call from a background thread.
+
 	long                   file_pos;
+	int                    mask_pitch;
+	size_t                 num_pixels;
+	color_t*               pixels = NULL;
 	struct rts_header      rts;
 	rect_t                 segment;
 	struct rts_tile_header tilehdr;
@@ -94,7 +130,7 @@ tileset_read(sfs_file_t* file)
 
 	memset(&rts, 0, sizeof(struct rts_header));
 	
-	console_log(2, "reading tileset #%u from open file", s_next_tileset_id);
+	console_log(2, "reading tileset from open file");
 
 	if (file == NULL) goto on_error;
 	file_pos = sfs_ftell(file);
@@ -106,17 +142,19 @@ tileset_read(sfs_file_t* file)
 	if (rts.tile_bpp != 32) goto on_error;
 	if (!(tiles = calloc(rts.num_tiles, sizeof(struct tile)))) goto on_error;
 	
-	// read in all the tile bitmaps (use atlasing)
-	if (!(atlas = atlas_new(rts.num_tiles, rts.tile_width, rts.tile_height)))
+	// read in all the tile bitmaps.  the tiles are stored back to back, so they
+	// can be read in one go.
+	num_pixels = (size_t)rts.num_tiles * rts.tile_width * rts.tile_height;
+	if (num_pixels > 0 && !(pixels = malloc(num_pixels * sizeof(color_t))))
 		goto on_error;
-	atlas_lock(atlas);
-	for (i = 0; i < rts.num_tiles; ++i)
-		if (!(tiles[i].image = atlas_load(atlas, file, i, rts.tile_width, rts.tile_height)))
-			goto on_error;
-	atlas_unlock(atlas);
-	tileset->atlas = atlas;
+	if (num_pixels > 0 && sfs_fread(pixels, sizeof(color_t), num_pixels, file) != num_pixels)
+		goto on_error;
+	tileset->pixels = pixels;
 
-	// read in tile headers and obstruction maps
+	// read in tile headers and obstruction maps.  each tile's obstruction lines
+	// are also rasterized into a bitmask covering the tile, one bit per pixel
+	// with rows padded to a whole number of 32-bit words.
+	mask_pitch = (rts.tile_width + 1 + 31) / 32;
 	for (i = 0; i < rts.num_tiles; ++i) {
 		if (sfs_fread(&tilehdr, sizeof(struct rts_tile_header), 1, file) != 1)
 			goto on_error;
@@ -124,7 +162,6 @@ tileset_read(sfs_file_t* file)
 		tiles[i].next_index = tilehdr.animated ? tilehdr.next_tile : i;
 		tiles[i].delay = tilehdr.animated ? tilehdr.delay : 0;
 		tiles[i].image_index = i;
-		tiles[i].frames_left = tiles[i].delay;
 		if (rts.has_obstructions) {
 			switch (tilehdr.obsmap_type) {
 			case 1:  // pixel-perfect obstruction (no longer supported)
@@ -133,10 +170,18 @@ tileset_read(sfs_file_t* file)
 			case 2:  // line segment-based obstruction
 				tiles[i].num_obs_lines = tilehdr.num_segments;
 				if ((tiles[i].obsmap = obsmap_new()) == NULL) goto on_error;
+				tiles[i].obs_mask = calloc(mask_pitch * (rts.tile_height + 1), sizeof(uint32_t));
 				for (j = 0; j < tilehdr.num_segments; ++j) {
 					if (!fread_rect_16(file, &segment))
 						goto on_error;
 					obsmap_add_line(tiles[i].obsmap, segment);
+					if (tiles[i].obs_mask != NULL && !rasterize_line(tiles[i].obs_mask, mask_pitch,
+						rts.tile_width, rts.tile_height, segment))
+					{
+						// segment strays outside the tile, the mask can't represent it
+						free(tiles[i].obs_mask);
+						tiles[i].obs_mask = NULL;
+					}
 				}
 				break;
 			default:
@@ -146,43 +191,120 @@ tileset_read(sfs_file_t* file)
 	}
 
 	// wrap things up
-	tileset->id = s_next_tileset_id++;
 	tileset->width = rts.tile_width;
 	tileset->height = rts.tile_height;
+	tileset->mask_pitch = mask_pitch;
 	tileset->num_tiles = rts.num_tiles;
 	tileset->tiles = tiles;
+	if (!(tileset->changed = vector_new(sizeof(int))))
+		goto on_error;
+	for (i = 0; i < rts.num_tiles; ++i) {
+		if (tiles[i].delay > 0 && !schedule_tile(tileset, i, tiles[i].delay))
+			goto on_error;
+	}
 	return tileset;
 
 on_error:  // oh no!
-	console_log(2, "failed to read tileset #%u", s_next_tileset_id);
+	console_log(2, "failed to read tileset");
 	if (file != NULL)
 		sfs_fseek(file, file_pos, SFS_SEEK_SET);
 	if (tiles != NULL) {
 		for (i = 0; i < rts.num_tiles; ++i) {
 			lstr_free(tiles[i].name);
 			obsmap_free(tiles[i].obsmap);
-			image_free(tiles[i].image);
+			free(tiles[i].obs_mask);
 		}
-		free(tileset->tiles);
+		free(tiles);
 	}
-	atlas_free(atlas);
+	if (tileset != NULL && tileset->wheel != NULL) {
+		for (i = 0; i < WHEEL_SIZE; ++i)
+			vector_free(tileset->wheel[i]);
+		free(tileset->wheel);
+	}
+	if (tileset != NULL)
+		vector_free(tileset->changed);
+	free(pixels);
 	free(tileset);
 	return NULL;
 }
 
+bool
+tileset_upload(tileset_t* tileset)
+{
+	// creates the textures for a tileset read by tileset_decode().  this has to
+	// happen on the main thread, which is also why the tileset gets its ID here
+	// rather than when it's read in.
+
+	atlas_t*      atlas;
+	image_lock_t* lock;
+	color_t*      p_dest;
+	color_t*      p_src;
+	rect_t        xy;
+
+	int i, y;
+
+	if (tileset->pixels == NULL)
+		return true;
+	tileset->id = s_next_tileset_id++;
+	console_log(3, "creating textures for tileset #%u", tileset->id);
+	if (!(atlas = atlas_new(tileset->num_tiles, tileset->width, tileset->height)))
+		return false;
+	atlas_lock(atlas);
+	p_src = tileset->pixels;
+	for (i = 0; i < tileset->num_tiles; ++i) {
+		if (!(tileset->tiles[i].image = atlas_add(atlas, i, tileset->width, tileset->height)))
+			goto on_error;
+		if (!(lock = image_lock(atlas_image(atlas, i))))
+			goto on_error;
+		xy = atlas_xy(atlas, i);
+		p_dest = lock->pixels + xy.x1 + xy.y1 * lock->pitch;
+		for (y = 0; y < tileset->height; ++y) {
+			memcpy(p_dest, p_src, tileset->width * sizeof(color_t));
+			p_dest += lock->pitch;
+			p_src += tileset->width;
+		}
+		image_unlock(atlas_image(atlas, i), lock);
+	}
+	atlas_unlock(atlas);
+	tileset->atlas = atlas;
+	free(tileset->pixels);
+	tileset->pixels = NULL;
+	return true;
+
+on_error:
+	atlas_unlock(atlas);
+	for (i = 0; i < tileset->num_tiles; ++i) {
+		image_free(tileset->tiles[i].image);
+		tileset->tiles[i].image = NULL;
+	}
+	atlas_free(atlas);
+	return false;
+}
+
 void
 tileset_free(tileset_t* tileset)
 {
 	int i;
 
+	if (tileset == NULL)
+		return;
+
 	console_log(3, "disposing tileset #%u as it is no longer in use", tileset->id);
 
 	for (i = 0; i < tileset->num_tiles; ++i) {
 		lstr_free(tileset->tiles[i].name);
 		image_free(tileset->tiles[i].image);
 		obsmap_free(tileset->tiles[i].obsmap);
+		free(tileset->tiles[i].obs_mask);
+	}
+	if (tileset->wheel != NULL) {
+		for (i = 0; i < WHEEL_SIZE; ++i)
+			vector_free(tileset->wheel[i]);
+		free(tileset->wheel);
 	}
+	vector_free(tileset->changed);
 	atlas_free(tileset->atlas);
+	free(tileset->pixels);
 	free(tileset->tiles);
 	free(tileset);
 }
@@ -237,6 +359,23 @@ tileset_get_size(const tileset_t* tileset, int* out_w, int* out_h)
 	*out_h = tileset->height;
 }
 
+image_t*
+tileset_get_texture(const tileset_t* tileset, int tile_index, rect_t* out_xy)
+{
+	// returns the atlas page holding the tile's current animation frame, along with
+	// the frame's location on that page.  used to build static tile geometry.
+
+	tile_index = tileset->tiles[tile_index].image_index;
+	*out_xy = atlas_xy(tileset->atlas, tile_index);
+	return atlas_image(tileset->atlas, tile_index);
+}
+
+bool
+tileset_is_animated(const tileset_t* tileset, int tile_index)
+{
+	return tileset->tiles[tile_index].is_animating;
+}
+
 void
 tileset_set_next(tileset_t* tileset, int tile_index, int next_index)
 {
@@ -259,7 +398,7 @@ tileset_set_image(tileset_t* tileset, int tile_index, image_t* image)
 	rect_t xy;
 	
 	xy = atlas_xy(tileset->atlas, tile_index);
-	image_blit(image, tileset->texture, xy.x1, xy.y1);
+	image_blit(image, atlas_image(tileset->atlas, tile_index), xy.x1, xy.y1);
 }
 
 bool
@@ -274,20 +413,86 @@ tileset_set_name(tileset_t* tileset, int tile_index, const lstring_t* name)
 	return true;
 }
 
-void
-tileset_update(tileset_t* tileset)
+int
+tileset_update(tileset_t* tileset, const int** out_changed)
+{
+	// tile animations are kept on a timing wheel keyed by the frame each tile next
+	// changes on, so only tiles due this frame are touched.  the indices of tiles
+	// which changed are passed back so the caller can invalidate any geometry
+	// built from them.
+
+	struct tile_event* event;
+	vector_t*          slot;
+	struct tile*       tile;
+
+	iter_t iter;
+	int    i;
+
+	vector_clear(tileset->changed);
+	*out_changed = NULL;
+	++tileset->frame;
+	if (tileset->wheel == NULL)
+		return 0;
+	slot = tileset->wheel[tileset->frame % WHEEL_SIZE];
+	iter = vector_enum(slot);
+	while (event = vector_next(&iter)) {
+		if (event->frame != tileset->frame)
+			continue;  // not due until a later turn of the wheel
+		vector_push(tileset->changed, &event->tile_index);
+		iter_remove(&iter);
+	}
+	for (i = 0; i < (int)vector_len(tileset->changed); ++i) {
+		tile = &tileset->tiles[*(int*)vector_get(tileset->changed, i)];
+		tile->image_index = tileset_get_next(tileset, tile->image_index);
+		tile->is_animating = false;
+		schedule_tile(tileset, *(int*)vector_get(tileset->changed, i),
+			tileset_get_delay(tileset, tile->image_index));
+	}
+	if (vector_len(tileset->changed) > 0)
+		*out_changed = vector_get(tileset->changed, 0);
+	return (int)vector_len(tileset->changed);
+}
+
+bool
+tileset_test_rect(const tileset_t* tileset, int tile_index, rect_t rect)
 {
+	// the collision mask is conservative: every pixel a segment passes through or
+	// next to is set.  if no bits under the rectangle are set, nothing can touch
+	// it; otherwise the segment test is used to get the exact legacy result.
+
+	uint32_t     bits;
+	uint32_t*    row;
 	struct tile* tile;
-	
-	int i;
+	int          x1, y1;
+	int          x2, y2;
 
-	for (i = 0; i < tileset->num_tiles; ++i) {
-		tile = &tileset->tiles[i];
-		if (tile->frames_left > 0 && --tile->frames_left == 0) {
-			tile->image_index = tileset_get_next(tileset, tile->image_index);
-			tile->frames_left = tileset_get_delay(tileset, tile->image_index);
+	int x, y;
+
+	if (tile_index < 0 || tile_index >= tileset->num_tiles || tileset->tiles[tile_index].obsmap == NULL)
+		return false;
+	tile = &tileset->tiles[tile_index];
+	if (tile->obs_mask == NULL)
+		return obsmap_test_rect(tile->obsmap, rect);
+	normalize_rect(&rect);
+	x1 = fmax(rect.x1, 0);
+	y1 = fmax(rect.y1, 0);
+	x2 = fmin(rect.x2, tileset->width);
+	y2 = fmin(rect.y2, tileset->height);
+	if (x1 > x2 || y1 > y2)
+		return false;
+	for (y = y1; y <= y2; ++y) {
+		row = tile->obs_mask + y * tileset->mask_pitch;
+		for (x = x1 / 32; x <= x2 / 32; ++x) {
+			bits = row[x];
+			if (x == x1 / 32)
+				bits &= 0xFFFFFFFFu << (x1 % 32);
+			if (x == x2 / 32)
+				bits &= 0xFFFFFFFFu >> (31 - x2 % 32);
+			if (bits != 0)
+				return obsmap_test_rect(tile->obsmap, rect);
 		}
 	}
+	return false;
 }
 
 void
@@ -296,6 +501,65 @@ tileset_draw(const tileset_t* tileset, color_t mask, float x, float y, int tile_
 	if (tile_index < 0)
 		return;
 	tile_index = tileset->tiles[tile_index].image_index;
+	screen_batch_sprites(g_screen);
 	al_draw_tinted_bitmap(image_bitmap(tileset->tiles[tile_index].image),
 		al_map_rgba(mask.r, mask.g, mask.b, mask.a), x, y, 0x0);
 }
+
+static bool
+rasterize_line(uint32_t* mask, int pitch, int width, int height, rect_t line)
+{
+	// samples are taken less than half a pixel apart and each one marks its 3x3
+	// neighborhood, so the pixel containing any point on the line is always set.
+	// the mask is (width + 1) x (height + 1) since segments may lie on the far
+	// edges of the tile.
+
+	int    dx, dy;
+	int    num_steps;
+	double x, y;
+
+	int i, mx, my;
+
+	if (line.x1 < 0 || line.x1 > width || line.x2 < 0 || line.x2 > width
+		|| line.y1 < 0 || line.y1 > height || line.y2 < 0 || line.y2 > height)
+	{
+		return false;
+	}
+	dx = line.x2 - line.x1;
+	dy = line.y2 - line.y1;
+	num_steps = 2 * fmax(abs(dx), abs(dy)) + 1;
+	for (i = 0; i <= num_steps; ++i) {
+		x = floor(line.x1 + (double)dx * i / num_steps);
+		y = floor(line.y1 + (double)dy * i / num_steps);
+		for (my = y - 1; my <= y + 1; ++my) for (mx = x - 1; mx <= x + 1; ++mx) {
+			if (mx >= 0 && mx <= width && my >= 0 && my <= height)
+				mask[mx / 32 + my * pitch] |= 1u << (mx % 32);
+		}
+	}
+	return true;
+}
+
+static bool
+schedule_tile(tileset_t* tileset, int tile_index, int delay)
+{
+	struct tile_event event;
+
+	int i;
+
+	if (delay <= 0)
+		return true;
+	if (tileset->wheel == NULL) {
+		if (!(tileset->wheel = calloc(WHEEL_SIZE, sizeof(vector_t*))))
+			return false;
+		for (i = 0; i < WHEEL_SIZE; ++i) {
+			if (!(tileset->wheel[i] = vector_new(sizeof(struct tile_event))))
+				return false;
+		}
+	}
+	event.frame = tileset->frame + delay;
+	event.tile_index = tile_index;
+	if (!vector_push(tileset->wheel[event.frame % WHEEL_SIZE], &event))
+		return false;
+	tileset->tiles[tile_index].is_animating = true;
+	return true;
+}
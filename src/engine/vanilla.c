@@ -3,6 +3,7 @@
 
 #include "animation.h"
 #include "api.h"
+#include "atlas.h"
 #include "async.h"
 #include "audio.h"
 #include "bytearray.h"
@@ -18,6 +19,8 @@
 #define API_VERSION        2.0
 #define API_VERSION_STRING "v2.0"
 
+#define CIRCLE_SEGMENTS    128
+
 static duk_ret_t js_AreKeysLeft                (duk_context* ctx);
 static duk_ret_t js_IsAnyKeyPressed            (duk_context* ctx);
 static duk_ret_t js_IsJoystickButtonPressed    (duk_context* ctx);
@@ -272,6 +275,8 @@ enum line_series_type
 	LINE_LOOP
 };
 
+static float          s_circle_cos[CIRCLE_SEGMENTS + 1];
+static float          s_circle_sin[CIRCLE_SEGMENTS + 1];
 static unsigned int   s_next_async_id = 1;
 static mixer_t*       s_sound_mixer;
 static image_t*       s_sys_arrow = NULL;
@@ -284,18 +289,27 @@ initialize_vanilla_api(duk_context* ctx)
 {
 	const char* filename;
 	
+	int i;
+	
 	console_log(1, "initializing Sphere v1 API (%s)", API_VERSION_STRING);
 
 	s_sound_mixer = mixer_new(44100, 16, 2);
 	
+	// precompute the unit circle used for drawing circles.  the extra entry at the
+	// end wraps around to the start so segments can be drawn without a modulo.
+	for (i = 0; i <= CIRCLE_SEGMENTS; ++i) {
+		s_circle_cos[i] = cos(2 * M_PI * i / CIRCLE_SEGMENTS);
+		s_circle_sin[i] = sin(2 * M_PI * i / CIRCLE_SEGMENTS);
+	}
+	
 	// load system-provided images
 	if (g_sys_conf != NULL) {
 		filename = kev_read_string(g_sys_conf, "Arrow", "pointer.png");
-		s_sys_arrow = image_load(systempath(filename));
+		s_sys_arrow = atlas_share(image_load(systempath(filename)));
 		filename = kev_read_string(g_sys_conf, "UpArrow", "up_arrow.png");
-		s_sys_up_arrow = image_load(systempath(filename));
+		s_sys_up_arrow = atlas_share(image_load(systempath(filename)));
 		filename = kev_read_string(g_sys_conf, "DownArrow", "down_arrow.png");
-		s_sys_dn_arrow = image_load(systempath(filename));
+		s_sys_dn_arrow = atlas_share(image_load(systempath(filename)));
 	}
 
 	// load system window style
@@ -876,33 +890,66 @@ apply_blend_mode(int blend_mode)
 {
 	switch (blend_mode) {
 	case BLEND_BLEND:
-		al_set_separate_blender(ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA,
+		screen_set_separate_blender(g_screen, ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA,
 			ALLEGRO_ADD, ALLEGRO_INVERSE_DEST_COLOR, ALLEGRO_ONE);
 		break;
 	case BLEND_REPLACE:
-		al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+		screen_set_blender(g_screen, ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
 		break;
 	case BLEND_ADD:
-		al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ONE);
+		screen_set_blender(g_screen, ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ONE);
 		break;
 	case BLEND_SUBTRACT:
-		al_set_blender(ALLEGRO_DEST_MINUS_SRC, ALLEGRO_ONE, ALLEGRO_ONE);
+		screen_set_blender(g_screen, ALLEGRO_DEST_MINUS_SRC, ALLEGRO_ONE, ALLEGRO_ONE);
 		break;
 	case BLEND_MULTIPLY:
-		al_set_separate_blender(ALLEGRO_ADD, ALLEGRO_DEST_COLOR, ALLEGRO_ZERO,
+		screen_set_separate_blender(g_screen, ALLEGRO_ADD, ALLEGRO_DEST_COLOR, ALLEGRO_ZERO,
 			ALLEGRO_ADD, ALLEGRO_ZERO, ALLEGRO_ONE);
 		break;
 	case BLEND_INVERT:
-		al_set_separate_blender(ALLEGRO_ADD, ALLEGRO_ZERO, ALLEGRO_INVERSE_SRC_COLOR,
+		screen_set_separate_blender(g_screen, ALLEGRO_ADD, ALLEGRO_ZERO, ALLEGRO_INVERSE_SRC_COLOR,
 			ALLEGRO_ADD, ALLEGRO_ZERO, ALLEGRO_ONE);
 		break;
 	}
 }
 
+static int
+circle_stride(float radius)
+{
+	// small circles don't need every segment of the unit circle, so use about
+	// one segment per pixel of radius, rounded up to a power of two.
+	int num_segments = 8;
+
+	while (num_segments < radius && num_segments < CIRCLE_SEGMENTS)
+		num_segments *= 2;
+	return CIRCLE_SEGMENTS / num_segments;
+}
+
+static ALLEGRO_VERTEX*
+put_vertex(ALLEGRO_VERTEX* vertex, float x, float y, ALLEGRO_COLOR color)
+{
+	vertex->x = x; vertex->y = y; vertex->z = 0;
+	vertex->u = 0; vertex->v = 0;
+	vertex->color = color;
+	return vertex + 1;
+}
+
+static ALLEGRO_VERTEX*
+put_quad(ALLEGRO_VERTEX* v, float x1, float y1, float x2, float y2, ALLEGRO_COLOR color)
+{
+	v = put_vertex(v, x1, y1, color);
+	v = put_vertex(v, x2, y1, color);
+	v = put_vertex(v, x1, y2, color);
+	v = put_vertex(v, x2, y1, color);
+	v = put_vertex(v, x1, y2, color);
+	v = put_vertex(v, x2, y2, color);
+	return v;
+}
+
 static void
 reset_blender(void)
 {
-	al_set_blender(ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA);
+	screen_set_blender(g_screen, ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA);
 }
 
 static duk_ret_t
@@ -1402,12 +1449,15 @@ js_Abort(duk_context* ctx)
 static duk_ret_t
 js_ApplyColorMask(duk_context* ctx)
 {
-	color_t color;
+	color_t         color;
+	ALLEGRO_VERTEX* v;
 
 	color = duk_require_sphere_color(ctx, 0);
 
-	if (!screen_is_skipframe(g_screen))
-		al_draw_filled_rectangle(0, 0, g_res_x, g_res_y, nativecolor(color));
+	if (screen_is_skipframe(g_screen))
+		return 0;
+	if ((v = screen_queue_prims(g_screen, 6)) != NULL)
+		put_quad(v, 0, 0, g_res_x, g_res_y, nativecolor(color));
 	return 0;
 }
 
@@ -1768,36 +1818,31 @@ js_GrabSurface(duk_context* ctx)
 static duk_ret_t
 js_GradientCircle(duk_context* ctx)
 {
-	static ALLEGRO_VERTEX s_vbuf[128];
-
 	int x = duk_require_number(ctx, 0);
 	int y = duk_require_number(ctx, 1);
 	int radius = duk_require_number(ctx, 2);
 	color_t in_color = duk_require_sphere_color(ctx, 3);
 	color_t out_color = duk_require_sphere_color(ctx, 4);
 
-	double phi;
-	int    vcount;
+	ALLEGRO_COLOR   inner;
+	ALLEGRO_COLOR   outer;
+	int             stride;
+	ALLEGRO_VERTEX* v;
 
 	int i;
 
 	if (screen_is_skipframe(g_screen))
 		return 0;
-	vcount = fmin(radius, 126);
-	s_vbuf[0].x = x; s_vbuf[0].y = y; s_vbuf[0].z = 0;
-	s_vbuf[0].color = nativecolor(in_color);
-	for (i = 0; i < vcount; ++i) {
-		phi = 2 * M_PI * i / vcount;
-		s_vbuf[i + 1].x = x + cos(phi) * radius;
-		s_vbuf[i + 1].y = y - sin(phi) * radius;
-		s_vbuf[i + 1].z = 0;
-		s_vbuf[i + 1].color = nativecolor(out_color);
+	stride = circle_stride(radius);
+	if (!(v = screen_queue_prims(g_screen, CIRCLE_SEGMENTS / stride * 3)))
+		return 0;
+	inner = nativecolor(in_color);
+	outer = nativecolor(out_color);
+	for (i = 0; i < CIRCLE_SEGMENTS; i += stride) {
+		v = put_vertex(v, x, y, inner);
+		v = put_vertex(v, x + s_circle_cos[i] * radius, y - s_circle_sin[i] * radius, outer);
+		v = put_vertex(v, x + s_circle_cos[i + stride] * radius, y - s_circle_sin[i + stride] * radius, outer);
 	}
-	s_vbuf[i + 1].x = x + cos(0) * radius;
-	s_vbuf[i + 1].y = y - sin(0) * radius;
-	s_vbuf[i + 1].z = 0;
-	s_vbuf[i + 1].color = nativecolor(out_color);
-	al_draw_prim(s_vbuf, NULL, NULL, 0, vcount + 2, ALLEGRO_PRIM_TRIANGLE_FAN);
 	return 0;
 }
 
@@ -1813,15 +1858,18 @@ js_GradientRectangle(duk_context* ctx)
 	color_t color_lr = duk_require_sphere_color(ctx, 6);
 	color_t color_ll = duk_require_sphere_color(ctx, 7);
 
-	if (!screen_is_skipframe(g_screen)) {
-		ALLEGRO_VERTEX verts[] = {
-			{ x1, y1, 0, 0, 0, nativecolor(color_ul) },
-			{ x2, y1, 0, 0, 0, nativecolor(color_ur) },
-			{ x1, y2, 0, 0, 0, nativecolor(color_ll) },
-			{ x2, y2, 0, 0, 0, nativecolor(color_lr) }
-		};
-		al_draw_prim(verts, NULL, NULL, 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
-	}
+	ALLEGRO_VERTEX* v;
+
+	if (screen_is_skipframe(g_screen))
+		return 0;
+	if (!(v = screen_queue_prims(g_screen, 6)))
+		return 0;
+	v = put_vertex(v, x1, y1, nativecolor(color_ul));
+	v = put_vertex(v, x2, y1, nativecolor(color_ur));
+	v = put_vertex(v, x1, y2, nativecolor(color_ll));
+	v = put_vertex(v, x2, y1, nativecolor(color_ur));
+	v = put_vertex(v, x1, y2, nativecolor(color_ll));
+	v = put_vertex(v, x2, y2, nativecolor(color_lr));
 	return 0;
 }
 
@@ -1875,8 +1923,27 @@ js_Line(duk_context* ctx)
 	float y2 = duk_require_int(ctx, 3) + 0.5;
 	color_t color = duk_require_sphere_color(ctx, 4);
 
-	if (!screen_is_skipframe(g_screen))
-		al_draw_line(x1, y1, x2, y2, nativecolor(color), 1);
+	ALLEGRO_COLOR   fill;
+	float           length;
+	float           tx, ty;
+	ALLEGRO_VERTEX* v;
+
+	// lines are 1 pixel thick and drawn as a quad, the same as al_draw_line() does
+	if (screen_is_skipframe(g_screen))
+		return 0;
+	if ((length = hypotf(x2 - x1, y2 - y1)) == 0.0)
+		return 0;
+	if (!(v = screen_queue_prims(g_screen, 6)))
+		return 0;
+	fill = nativecolor(color);
+	tx = 0.5 * (y2 - y1) / length;
+	ty = 0.5 * -(x2 - x1) / length;
+	v = put_vertex(v, x1 + tx, y1 + ty, fill);
+	v = put_vertex(v, x1 - tx, y1 - ty, fill);
+	v = put_vertex(v, x2 + tx, y2 + ty, fill);
+	v = put_vertex(v, x1 - tx, y1 - ty, fill);
+	v = put_vertex(v, x2 + tx, y2 + ty, fill);
+	v = put_vertex(v, x2 - tx, y2 - ty, fill);
 	return 0;
 }
 
@@ -1912,6 +1979,7 @@ js_LineSeries(duk_context* ctx)
 		vertices[i].x = x + 0.5; vertices[i].y = y + 0.5;
 		vertices[i].color = vtx_color;
 	}
+	screen_flush(g_screen);
 	al_draw_prim(vertices, NULL, NULL, 0, (int)num_points,
 		type == LINE_STRIP ? ALLEGRO_PRIM_LINE_STRIP
 		: type == LINE_LOOP ? ALLEGRO_PRIM_LINE_LOOP
@@ -1970,7 +2038,7 @@ js_LoadImage(duk_context* ctx)
 	image_t*    image;
 
 	filename = duk_require_path(ctx, 0, "images", true);
-	if (!(image = image_load(filename)))
+	if (!(image = atlas_share(image_load(filename))))
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "Image(): unable to load image file `%s`", filename);
 	duk_push_sphere_obj(ctx, "ssImage", image);
 	return 1;
@@ -2105,8 +2173,29 @@ js_OutlinedCircle(duk_context* ctx)
 	float radius = duk_require_int(ctx, 2);
 	color_t color = duk_require_sphere_color(ctx, 3);
 
-	if (!screen_is_skipframe(g_screen))
-		al_draw_circle(x, y, radius, nativecolor(color), 1);
+	ALLEGRO_COLOR   fill;
+	float           r_in, r_out;
+	int             stride;
+	ALLEGRO_VERTEX* v;
+
+	int i;
+
+	if (screen_is_skipframe(g_screen))
+		return 0;
+	stride = circle_stride(radius);
+	if (!(v = screen_queue_prims(g_screen, CIRCLE_SEGMENTS / stride * 6)))
+		return 0;
+	fill = nativecolor(color);
+	r_in = radius - 0.5;
+	r_out = radius + 0.5;
+	for (i = 0; i < CIRCLE_SEGMENTS; i += stride) {
+		v = put_vertex(v, x + s_circle_cos[i] * r_in, y - s_circle_sin[i] * r_in, fill);
+		v = put_vertex(v, x + s_circle_cos[i] * r_out, y - s_circle_sin[i] * r_out, fill);
+		v = put_vertex(v, x + s_circle_cos[i + stride] * r_in, y - s_circle_sin[i + stride] * r_in, fill);
+		v = put_vertex(v, x + s_circle_cos[i] * r_out, y - s_circle_sin[i] * r_out, fill);
+		v = put_vertex(v, x + s_circle_cos[i + stride] * r_in, y - s_circle_sin[i + stride] * r_in, fill);
+		v = put_vertex(v, x + s_circle_cos[i + stride] * r_out, y - s_circle_sin[i + stride] * r_out, fill);
+	}
 	return 0;
 }
 
@@ -2121,8 +2210,26 @@ js_OutlinedRectangle(duk_context* ctx)
 	color_t color = duk_require_sphere_color(ctx, 4);
 	int thickness = n_args >= 6 ? duk_require_int(ctx, 5) : 1;
 
-	if (!screen_is_skipframe(g_screen))
+	ALLEGRO_COLOR   fill;
+	float           half;
+	ALLEGRO_VERTEX* v;
+
+	if (screen_is_skipframe(g_screen))
+		return 0;
+	if (thickness <= 0) {
+		// hairline, let Allegro handle it
+		screen_flush(g_screen);
 		al_draw_rectangle(x1, y1, x2, y2, nativecolor(color), thickness);
+		return 0;
+	}
+	if (!(v = screen_queue_prims(g_screen, 24)))
+		return 0;
+	fill = nativecolor(color);
+	half = thickness / 2.0;
+	v = put_quad(v, x1 - half, y1 - half, x2 + half, y1 + half, fill);
+	v = put_quad(v, x1 - half, y2 - half, x2 + half, y2 + half, fill);
+	v = put_quad(v, x1 - half, y1 + half, x1 + half, y2 - half, fill);
+	v = put_quad(v, x2 - half, y1 + half, x2 + half, y2 - half, fill);
 	return 0;
 }
 
@@ -2138,6 +2245,7 @@ js_OutlinedRoundRectangle(duk_context* ctx)
 	color_t color = duk_require_sphere_color(ctx, 5);
 	int thickness = n_args >= 7 ? duk_require_int(ctx, 6) : 1;
 
+	screen_flush(g_screen);
 	if (!screen_is_skipframe(g_screen))
 		al_draw_rounded_rectangle(x, y, x + w - 1, y + h - 1, radius, radius, nativecolor(color), thickness);
 	return 0;
@@ -2150,8 +2258,12 @@ js_Point(duk_context* ctx)
 	float y = duk_require_int(ctx, 1) + 0.5;
 	color_t color = duk_require_sphere_color(ctx, 2);
 
-	if (!screen_is_skipframe(g_screen))
-		al_draw_pixel(x, y, nativecolor(color));
+	ALLEGRO_VERTEX* v;
+
+	if (screen_is_skipframe(g_screen))
+		return 0;
+	if ((v = screen_queue_prims(g_screen, 6)) != NULL)
+		put_quad(v, x - 0.5, y - 0.5, x + 0.5, y + 0.5, nativecolor(color));
 	return 0;
 }
 
@@ -2185,6 +2297,7 @@ js_PointSeries(duk_context* ctx)
 		vertices[i].x = x + 0.5; vertices[i].y = y + 0.5;
 		vertices[i].color = vtx_color;
 	}
+	screen_flush(g_screen);
 	al_draw_prim(vertices, NULL, NULL, 0, (int)num_points, ALLEGRO_PRIM_POINT_LIST);
 	free(vertices);
 	return 0;
@@ -2218,8 +2331,12 @@ js_Rectangle(duk_context* ctx)
 	int h = duk_require_int(ctx, 3);
 	color_t color = duk_require_sphere_color(ctx, 4);
 
-	if (!screen_is_skipframe(g_screen))
-		al_draw_filled_rectangle(x, y, x + w, y + h, nativecolor(color));
+	ALLEGRO_VERTEX* v;
+
+	if (screen_is_skipframe(g_screen))
+		return 0;
+	if ((v = screen_queue_prims(g_screen, 6)) != NULL)
+		put_quad(v, x, y, x + w, y + h, nativecolor(color));
 	return 0;
 }
 
@@ -2327,6 +2444,7 @@ js_RoundRectangle(duk_context* ctx)
 	float radius = duk_require_number(ctx, 4);
 	color_t color = duk_require_sphere_color(ctx, 5);
 
+	screen_flush(g_screen);
 	if (!screen_is_skipframe(g_screen))
 		al_draw_filled_rounded_rectangle(x, y, x + w, y + h, radius, radius, nativecolor(color));
 	return 0;
@@ -2343,8 +2461,17 @@ js_Triangle(duk_context* ctx)
 	int y3 = duk_require_int(ctx, 5);
 	color_t color = duk_require_sphere_color(ctx, 6);
 
-	if (!screen_is_skipframe(g_screen))
-		al_draw_filled_triangle(x1, y1, x2, y2, x3, y3, nativecolor(color));
+	ALLEGRO_COLOR   fill;
+	ALLEGRO_VERTEX* v;
+
+	if (screen_is_skipframe(g_screen))
+		return 0;
+	if (!(v = screen_queue_prims(g_screen, 3)))
+		return 0;
+	fill = nativecolor(color);
+	v = put_vertex(v, x1, y1, fill);
+	v = put_vertex(v, x2, y2, fill);
+	v = put_vertex(v, x3, y3, fill);
 	return 0;
 }
 
@@ -2862,9 +2989,9 @@ js_Font_drawZoomedText(duk_context* ctx)
 		text_w = font_get_width(font, text);
 		text_h = font_height(font);
 		bitmap = al_create_bitmap(text_w, text_h);
-		al_set_target_bitmap(bitmap);
+		screen_set_target(g_screen, bitmap);
 		font_draw_text(font, mask, 0, 0, TEXT_ALIGN_LEFT, text);
-		al_set_target_backbuffer(screen_display(g_screen));
+		screen_set_target(g_screen, NULL);
 		al_draw_scaled_bitmap(bitmap, 0, 0, text_w, text_h, x, y, text_w * scale, text_h * scale, 0x0);
 		al_destroy_bitmap(bitmap);
 	}
@@ -3048,7 +3175,7 @@ js_Image_blit(duk_context* ctx)
 	duk_push_this(ctx);
 	image = duk_require_sphere_obj(ctx, -1, "ssImage");
 	duk_pop(ctx);
-	if (!screen_is_skipframe(g_screen)) al_draw_bitmap(image_bitmap(image), x, y, 0x0);
+	if (!screen_is_skipframe(g_screen)) image_draw(image, x, y);
 	return 0;
 }
 
@@ -3064,7 +3191,7 @@ js_Image_blitMask(duk_context* ctx)
 	duk_push_this(ctx);
 	image = duk_require_sphere_obj(ctx, -1, "ssImage");
 	duk_pop(ctx);
-	if (!screen_is_skipframe(g_screen)) al_draw_tinted_bitmap(image_bitmap(image), al_map_rgba(mask.r, mask.g, mask.b, mask.a), x, y, 0x0);
+	if (!screen_is_skipframe(g_screen)) image_draw_masked(image, mask, x, y);
 	return 0;
 }
 
@@ -3102,6 +3229,7 @@ js_Image_rotateBlit(duk_context* ctx)
 	if (!screen_is_skipframe(g_screen)) {
 		width = image_width(image);
 		height = image_height(image);
+		screen_batch_sprites(g_screen);
 		al_draw_rotated_bitmap(image_bitmap(image), width / 2, height / 2,
 			x + width / 2, y + height / 2, angle, 0x0);
 	}
@@ -3129,6 +3257,7 @@ js_Image_rotateBlitMask(duk_context* ctx)
 	if (!screen_is_skipframe(g_screen)) {
 		width = image_width(image);
 		height = image_height(image);
+		screen_batch_sprites(g_screen);
 		al_draw_tinted_rotated_bitmap(image_bitmap(image), al_map_rgba(mask.r, mask.g, mask.b, mask.a),
 			width / 2, height / 2, x + width / 2, y + height / 2, angle, 0x0);
 	}
@@ -3174,6 +3303,7 @@ js_Image_transformBlit(duk_context* ctx)
 		{ x4 + 0.5, y4 + 0.5, 0, 0, height, mask },
 		{ x3 + 0.5, y3 + 0.5, 0, width, height, mask }
 	};
+	screen_flush(g_screen);
 	if (!screen_is_skipframe(g_screen))
 		al_draw_prim(v, NULL, image_bitmap(image), 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
 	return 0;
@@ -3211,6 +3341,7 @@ js_Image_transformBlitMask(duk_context* ctx)
 		{ x4 + 0.5, y4 + 0.5, 0, 0, height, nativecolor(mask) },
 		{ x3 + 0.5, y3 + 0.5, 0, width, height, nativecolor(mask) }
 	};
+	screen_flush(g_screen);
 	if (!screen_is_skipframe(g_screen))
 		al_draw_prim(v, NULL, image_bitmap(image), 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
 	return 0;
@@ -3235,6 +3366,7 @@ js_Image_zoomBlit(duk_context* ctx)
 	if (!screen_is_skipframe(g_screen)) {
 		width = image_width(image);
 		height = image_height(image);
+		screen_batch_sprites(g_screen);
 		al_draw_scaled_bitmap(image_bitmap(image), 0, 0, width, height, 
 			x, y, width * scale, height * scale, 0x0);
 	}
@@ -3262,6 +3394,7 @@ js_Image_zoomBlitMask(duk_context* ctx)
 	if (!screen_is_skipframe(g_screen)) {
 		width = image_width(image);
 		height = image_height(image);
+		screen_batch_sprites(g_screen);
 		al_draw_tinted_scaled_bitmap(image_bitmap(image), nativecolor(mask),
 			0, 0, width, height, x, y, width * scale, height * scale, 0x0);
 	}
@@ -4024,7 +4157,7 @@ js_Surface_blit(duk_context* ctx)
 	y = duk_require_int(ctx, 1);
 
 	if (!screen_is_skipframe(g_screen))
-		al_draw_bitmap(image_bitmap(image), x, y, 0x0);
+		image_draw(image, x, y);
 	return 0;
 }
 
@@ -4045,9 +4178,9 @@ js_Surface_blitMaskSurface(duk_context* ctx)
 	blend_mode = duk_get_int(ctx, -1); duk_pop(ctx);
 
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(g_screen, image_bitmap(image));
 	al_draw_tinted_bitmap(image_bitmap(src_image), nativecolor(mask), x, y, 0x0);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	return 0;
 }
@@ -4068,9 +4201,9 @@ js_Surface_blitSurface(duk_context* ctx)
 	blend_mode = duk_get_int(ctx, -1); duk_pop(ctx);
 
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(g_screen, image_bitmap(image));
 	al_draw_bitmap(image_bitmap(src_image), x, y, 0x0);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	return 0;
 }
@@ -4109,9 +4242,9 @@ js_Surface_cloneSection(duk_context* ctx)
 
 	if ((new_image = image_new(width, height)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "Surface:cloneSection(): unable to create surface");
-	al_set_target_bitmap(image_bitmap(new_image));
+	screen_set_target(g_screen, image_bitmap(new_image));
 	al_draw_bitmap_region(image_bitmap(image), x, y, width, height, 0, 0, 0x0);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	duk_push_sphere_obj(ctx, "ssSurface", new_image);
 	return 1;
 }
@@ -4150,9 +4283,9 @@ js_Surface_drawText(duk_context* ctx)
 
 	duk_get_prop_string(ctx, 0, "\xFF" "color_mask"); color = duk_require_sphere_color(ctx, -1); duk_pop(ctx);
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(g_screen, image_bitmap(image));
 	font_draw_text(font, color, x, y, TEXT_ALIGN_LEFT, text);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	return 0;
 }
@@ -4174,9 +4307,9 @@ js_Surface_filledCircle(duk_context* ctx)
 	blend_mode = duk_get_int(ctx, -1); duk_pop(ctx);
 	duk_pop(ctx);
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(g_screen, image_bitmap(image));
 	al_draw_filled_circle(x, y, radius, nativecolor(color));
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	return 0;
 }
@@ -4232,18 +4365,18 @@ js_Surface_getPixel(duk_context* ctx)
 static duk_ret_t
 js_Surface_gradientCircle(duk_context* ctx)
 {
-	static ALLEGRO_VERTEX s_vbuf[128];
-
 	int x = duk_require_number(ctx, 0);
 	int y = duk_require_number(ctx, 1);
 	int radius = duk_require_number(ctx, 2);
 	color_t in_color = duk_require_sphere_color(ctx, 3);
 	color_t out_color = duk_require_sphere_color(ctx, 4);
 
-	int      blend_mode;
-	image_t* image;
-	double   phi;
-	int      vcount;
+	int             blend_mode;
+	image_t*        image;
+	ALLEGRO_COLOR   inner;
+	ALLEGRO_COLOR   outer;
+	int             stride;
+	ALLEGRO_VERTEX* v;
 
 	int i;
 
@@ -4253,23 +4386,18 @@ js_Surface_gradientCircle(duk_context* ctx)
 	blend_mode = duk_get_int(ctx, -1); duk_pop(ctx);
 	duk_pop(ctx);
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
-	vcount = fmin(radius, 126);
-	s_vbuf[0].x = x; s_vbuf[0].y = y; s_vbuf[0].z = 0;
-	s_vbuf[0].color = nativecolor(in_color);
-	for (i = 0; i < vcount; ++i) {
-		phi = 2 * M_PI * i / vcount;
-		s_vbuf[i + 1].x = x + cos(phi) * radius;
-		s_vbuf[i + 1].y = y - sin(phi) * radius;
-		s_vbuf[i + 1].z = 0;
-		s_vbuf[i + 1].color = nativecolor(out_color);
+	screen_set_target(g_screen, image_bitmap(image));
+	stride = circle_stride(radius);
+	if ((v = screen_queue_prims(g_screen, CIRCLE_SEGMENTS / stride * 3)) != NULL) {
+		inner = nativecolor(in_color);
+		outer = nativecolor(out_color);
+		for (i = 0; i < CIRCLE_SEGMENTS; i += stride) {
+			v = put_vertex(v, x, y, inner);
+			v = put_vertex(v, x + s_circle_cos[i] * radius, y - s_circle_sin[i] * radius, outer);
+			v = put_vertex(v, x + s_circle_cos[i + stride] * radius, y - s_circle_sin[i + stride] * radius, outer);
+		}
 	}
-	s_vbuf[i + 1].x = x + cos(0) * radius;
-	s_vbuf[i + 1].y = y - sin(0) * radius;
-	s_vbuf[i + 1].z = 0;
-	s_vbuf[i + 1].color = nativecolor(out_color);
-	al_draw_prim(s_vbuf, NULL, NULL, 0, vcount + 2, ALLEGRO_PRIM_TRIANGLE_FAN);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	return 0;
 }
@@ -4295,7 +4423,7 @@ js_Surface_gradientRectangle(duk_context* ctx)
 	blend_mode = duk_get_int(ctx, -1); duk_pop(ctx);
 	duk_pop(ctx);
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(g_screen, image_bitmap(image));
 
 	ALLEGRO_VERTEX verts[] = {
 		{ x1, y1, 0, 0, 0, nativecolor(color_ul) },
@@ -4304,7 +4432,7 @@ js_Surface_gradientRectangle(duk_context* ctx)
 		{ x2, y2, 0, 0, 0, nativecolor(color_lr) }
 	};
 	al_draw_prim(verts, NULL, NULL, 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	return 0;
 }
@@ -4327,9 +4455,9 @@ js_Surface_line(duk_context* ctx)
 	blend_mode = duk_get_int(ctx, -1); duk_pop(ctx);
 	duk_pop(ctx);
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(g_screen, image_bitmap(image));
 	al_draw_line(x1, y1, x2, y2, nativecolor(color), 1);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	return 0;
 }
@@ -4351,9 +4479,9 @@ js_Surface_outlinedCircle(duk_context* ctx)
 	blend_mode = duk_get_int(ctx, -1); duk_pop(ctx);
 	duk_pop(ctx);
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(g_screen, image_bitmap(image));
 	al_draw_circle(x, y, radius, nativecolor(color), 1);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	return 0;
 }
@@ -4393,9 +4521,9 @@ js_Surface_pointSeries(duk_context* ctx)
 		vertices[i].color = vtx_color;
 	}
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(g_screen, image_bitmap(image));
 	al_draw_prim(vertices, NULL, NULL, 0, (int)num_points, ALLEGRO_PRIM_POINT_LIST);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	free(vertices);
 	return 0;
@@ -4421,9 +4549,9 @@ js_Surface_outlinedRectangle(duk_context* ctx)
 	blend_mode = duk_get_int(ctx, -1); duk_pop(ctx);
 	duk_pop(ctx);
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(g_screen, image_bitmap(image));
 	al_draw_rectangle(x1, y1, x2, y2, nativecolor(color), thickness);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	return 0;
 }
@@ -4483,9 +4611,9 @@ js_Surface_rotate(duk_context* ctx)
 	}
 	if ((new_image = image_new(new_w, new_h)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "failed to create new surface bitmap");
-	al_set_target_bitmap(image_bitmap(new_image));
+	screen_set_target(g_screen, image_bitmap(new_image));
 	al_draw_rotated_bitmap(image_bitmap(image), (float)w / 2, (float)h / 2, (float)new_w / 2, (float)new_h / 2, angle, 0x0);
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 
 	// free old image and replace internal image pointer
 	// at one time this was an acceptable thing to do; now it's just a hack
@@ -4514,9 +4642,9 @@ js_Surface_rectangle(duk_context* ctx)
 	blend_mode = duk_get_int(ctx, -1); duk_pop(ctx);
 	duk_pop(ctx);
 	apply_blend_mode(blend_mode);
-	al_set_target_bitmap(image_bitmap(image));
+	screen_set_target(g_screen, image_bitmap(image));
 	al_draw_filled_rectangle(x, y, x + w, y + h, nativecolor(color));
-	al_set_target_backbuffer(screen_display(g_screen));
+	screen_set_target(g_screen, NULL);
 	reset_blender();
 	return 0;
 }
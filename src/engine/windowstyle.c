@@ -1,6 +1,7 @@
 #include "minisphere.h"
 #include "windowstyle.h"
 
+#include "atlas.h"
 #include "color.h"
 #include "image.h"
 
@@ -61,7 +62,7 @@ load_windowstyle(const char* filename)
 		for (i = 0; i < 9; ++i) {
 			if (!(image = image_read(file, rws.edge_w_h, rws.edge_w_h)))
 				goto on_error;
-			winstyle->images[i] = image;
+			winstyle->images[i] = atlas_share(image);
 		}
 		break;
 	case 2:
@@ -69,7 +70,7 @@ load_windowstyle(const char* filename)
 			if (sfs_fread(&w, 2, 1, file) != 1 || sfs_fread(&h, 2, 1, file) != 1)
 				goto on_error;
 			if (!(image = image_read(file, w, h))) goto on_error;
-			winstyle->images[i] = image;
+			winstyle->images[i] = atlas_share(image);
 		}
 		break;
 	default:  // invalid version number
@@ -159,14 +160,17 @@ draw_window(windowstyle_t* winstyle, color_t mask, int x, int y, int width, int
 		image_draw_scaled_masked(winstyle->images[8], mask, x, y, width, height);
 		break;
 	case WSTYLE_BG_GRADIENT:
+		screen_flush(g_screen);
 		al_draw_prim(verts, NULL, NULL, 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
 		break;
 	case WSTYLE_BG_TILE_GRADIENT:
 		image_draw_tiled_masked(winstyle->images[8], mask, x, y, width, height);
+		screen_flush(g_screen);
 		al_draw_prim(verts, NULL, NULL, 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
 		break;
 	case WSTYLE_BG_STRETCH_GRADIENT:
 		image_draw_scaled_masked(winstyle->images[8], mask, x, y, width, height);
+		screen_flush(g_screen);
 		al_draw_prim(verts, NULL, NULL, 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
 		break;
 	}
@@ -90,6 +90,22 @@ vector_push(vector_t* vector, const void* in_object)
 	return true;
 }
 
+bool
+vector_insert(vector_t* vector, size_t index, const void* in_object)
+{
+	size_t   move_size;
+	uint8_t* p_item;
+
+	if (!vector_resize(vector, vector->num_items + 1))
+		return false;
+	move_size = (vector->num_items - index) * vector->pitch;
+	p_item = vector->buffer + index * vector->pitch;
+	memmove(p_item + vector->pitch, p_item, move_size);
+	memcpy(p_item, in_object, vector->pitch);
+	++vector->num_items;
+	return true;
+}
+
 void
 vector_remove(vector_t* vector, size_t index)
 {
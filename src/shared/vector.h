@@ -21,6 +21,7 @@ void      vector_free   (vector_t* vector);
 void      vector_clear  (vector_t* vector);
 size_t    vector_len    (const vector_t* vector);
 bool      vector_push   (vector_t* vector, const void* in_object);
+bool      vector_insert (vector_t* vector, size_t index, const void* in_object);
 void      vector_remove (vector_t* vector, size_t index);
 vector_t* vector_sort   (vector_t* vector, int(*comparer)(const void* in_a, const void* in_b));
 